@@ -0,0 +1,54 @@
+// Copyright (C) 2015 Philip Cronje. All rights reserved.
+#include <chrono>
+#include <cstdlib>
+#include <ctime>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "cloudwatch.h"
+
+namespace {
+	/* CPU time used by the process, which is what a flush costs the host, rather than wall-clock time. */
+	std::chrono::nanoseconds cpuTime() {
+		timespec now;
+		clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now);
+		return std::chrono::seconds(now.tv_sec) + std::chrono::nanoseconds(now.tv_nsec);
+	}
+
+	void benchmark(const std::string& name, const unsigned int iterations, const bool compress,
+			const std::vector<const aws::cloudwatch::requestTemplate*>& templates) {
+		aws::signer signer("AKIDEXAMPLE", "wJalrXUtnFEMI/K7MDENG+bPxRfiCYEXAMPLEKEY", "us-east-1", "monitoring");
+		aws::cloudwatch::requestBuilder builder("monitoring.us-east-1.amazonaws.com", signer, "Panopticon",
+				compress);
+		std::size_t bytes = 0;
+		const auto start = cpuTime();
+		for(unsigned int i = 0; i < iterations; ++i) {
+			bytes = builder.build(1440938160 + i, templates.cbegin(), templates.cend()).size();
+		}
+		const auto elapsed = cpuTime() - start;
+		std::cout << name << ": " << bytes << " bytes/flush, " << (elapsed.count() / iterations / 1000)
+			<< " us CPU/flush" << std::endl;
+	}
+}
+
+int main(int argc, char** argv) {
+	const unsigned int iterations = (argc > 1) ? std::strtoul(argv[1], nullptr, 10) : 2000;
+
+	// A flush from a 64-core host reporting every core, as with --cores all, plus the distribution of its CPU usage
+	std::vector<stat::aggregation<double>> cores(64);
+	std::vector<stat::metric> metrics;
+	for(std::size_t i = 0; i < cores.size(); ++i) {
+		for(int sample = 0; sample < 60; ++sample) cores[i] += (i * 7 + sample * 13) % 1000 / 10.0;
+		metrics.emplace_back("Core" + std::to_string(i) + "CPU", &cores[i]);
+	}
+	stat::histogram<double> distribution;
+	for(int sample = 0; sample < 60 * 64; ++sample) distribution += (sample * 37) % 1000 / 10.0;
+	metrics.emplace_back("CPUDistribution", &distribution);
+	const aws::cloudwatch::requestTemplate requestTemplate({ { "Host", "ip-10-0-0-1.ec2.internal" } }, metrics);
+	const std::vector<const aws::cloudwatch::requestTemplate*> templates { &requestTemplate };
+
+	benchmark("identity", iterations, false, templates);
+	benchmark("gzip", iterations, true, templates);
+	return 0;
+}
@@ -0,0 +1,57 @@
+// Copyright (C) 2015 Philip Cronje. All rights reserved.
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include "procfs.h"
+#include "stat-cpu.h"
+
+namespace {
+	volatile unsigned long long sink;
+
+	template<typename F>
+	void benchmark(const std::string& name, const unsigned int iterations, const F& f) {
+		using clock = std::chrono::steady_clock;
+		const auto start = clock::now();
+		for(unsigned int i = 0; i < iterations; ++i) f();
+		const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start);
+		std::cout << name << ": " << (elapsed.count() / iterations) << " ns/iteration" << std::endl;
+	}
+}
+
+int main(int argc, char** argv) {
+	const unsigned int iterations = (argc > 1) ? std::strtoul(argv[1], nullptr, 10) : 20000;
+
+	benchmark("ifstream + std::istream parser (live)", iterations, [] {
+		sink = sink + stat::cpu(std::ifstream("/proc/stat")).total;
+	});
+
+	procfs::file procStat("/proc/stat");
+	benchmark("procfs::file + procfs::scanner parser (live)", iterations, [&procStat] {
+		procStat.read();
+		sink = sink + stat::cpu(procStat.scan()).total;
+	});
+
+	// Parse-only comparison against a snapshot held in memory, placing the combined line last so that both parsers
+	// have to skip over every per-core line
+	std::string snapshot(procStat.data(), procStat.size());
+	const std::string::size_type combined = snapshot.find('\n') + 1;
+	snapshot = snapshot.substr(combined) + snapshot.substr(0, combined);
+
+	benchmark("std::istream parser (snapshot)", iterations * 10, [&snapshot] {
+		sink = sink + stat::cpu(std::istringstream(snapshot)).total;
+	});
+	benchmark("procfs::scanner parser (snapshot)", iterations * 10, [&snapshot] {
+		sink = sink + stat::cpu(procfs::scanner(snapshot.data(), snapshot.data() + snapshot.size())).total;
+	});
+
+	stat::cores cores(procStat.scan());
+	benchmark("procfs::scanner per-core update (snapshot, " + std::to_string(cores.count()) + " cores)",
+			iterations * 10, [&snapshot, &cores] {
+		cores.update(procfs::scanner(snapshot.data(), snapshot.data() + snapshot.size()));
+	});
+	return 0;
+}
@@ -1,128 +1,376 @@
 // Copyright (C) 2015 Philip Cronje. All rights reserved.
 #pragma once
 
-#include <cstring>
-#include <map>
-#include <sstream>
+#include <algorithm>
+#include <charconv>
+#include <ctime>
+#include <iterator>
+#include <memory>
 #include <string>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
-#include "crypto.h"
+#include "gzip.h"
+#include "sigv4.h"
 #include "stat.h"
 #include "util.h"
 
 namespace aws {
 	namespace cloudwatch {
-		void addMetricData(std::ostream& payload, const int index,
-				const std::pair<std::string, stat::aggregation<double>>& metricData,
-				const std::unordered_map<std::string, std::string>& dimensions) {
-			const char* prefix = "&MetricData.member.";
-			const char* dimensionPrefix = ".Dimensions.member.";
-			const char* statisticValuesPrefix = ".StatisticValues.";
-
-			payload << prefix << index << ".MetricName=" << metricData.first
-				<< prefix << index << ".Unit=Percent"
-				<< prefix << index << statisticValuesPrefix << "Minimum=" << metricData.second.min
-				<< prefix << index << statisticValuesPrefix << "Maximum=" << metricData.second.max
-				<< prefix << index << statisticValuesPrefix << "Sum=" << metricData.second.sum
-				<< prefix << index << statisticValuesPrefix << "SampleCount=" << metricData.second.count;
-			int dimensionIndex = 0;
-			for(const auto& dimension: dimensions) {
-				++dimensionIndex;
-				payload << prefix << index << dimensionPrefix << dimensionIndex << ".Name=" << dimension.first
-					<< prefix << index << dimensionPrefix << dimensionIndex << ".Value=" << dimension.second;
-			}
-		}
+		typedef stat::histogram<double> distribution;
+		typedef stat::metric metric;
 
-		util::buffer newPutMetricDataRequest(const std::string& hostName, const std::string& region,
-				const std::string& accessKey, const std::string& secretKey,const std::string& nameSpace,
-				const std::unordered_map<std::string, std::string>& dimensions,
-				const std::unordered_map<std::string, stat::aggregation<double>>& aggregations) {
-			const auto now = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
-			const auto nowTm = std::gmtime(&now);
+		inline void appendInteger(util::buffer& buffer, const unsigned long long value) {
+			char string[24];
+			buffer.append(string, std::to_chars(string, string + sizeof(string), value).ptr - string);
+		}
 
-			std::ostringstream payload;
-			payload << "Action=PutMetricData&Version=2010-08-01"
-				<< "&Namespace=" << nameSpace;
+		/* Appends the shortest decimal representation of the value that parses back to the same double. */
+		inline void appendDouble(util::buffer& buffer, const double value) {
+			char string[32];
+			buffer.append(string, std::to_chars(string, string + sizeof(string), value).ptr - string);
+		}
 
-			int metricDataCount = 0;
-			for(const auto& metricData: aggregations) {
-				addMetricData(payload, ++metricDataCount, metricData, dimensions);
-			}
+		/* The parts of a PutMetricData form body that stay the same from one request to the next, for a given list of
+		 * metrics and set of dimensions shared by them, to which each metric may add its own. Names and values are
+		 * URL-encoded once when the template is compiled; writing a request then only copies the invariant text and
+		 * splices in each metric's member index and statistics. Metrics without samples are left out, and templates
+		 * may be combined in one request, so member indices are not baked into the text either.
+		 *
+		 * Distributions are sent as Values and Counts lists, holding one entry for each non-empty histogram bucket. A
+		 * datum holds at most maxValues entries, so a wide distribution is split over as many datums as needed. */
+		class requestTemplate {
+			constexpr static size_t maxValues = 150;
 
-			const std::string payloadString = payload.str();
-			crypto::digestContext digestContext(crypto::digestType::SHA256);
-			const std::string payloadHash = digestContext.hashString(payloadString);
+			struct splice {
+				enum type { Index, Timestamp, Minimum, Maximum, Sum, SampleCount, Distribution };
 
-			char headerDate[30];
-			//std::strftime(headerDate, sizeof(headerDate), "%a, %d %b %Y %T %Z", nowTm); // TODO: Return value
-			// FIXME: Same as amazonDate
-			std::strftime(headerDate, sizeof(headerDate), "%Y%m%dT%H%M%SZ", nowTm); // TODO: Return value
+				size_t offset;
+				type inserts;
+			};
 
-			std::map<std::string, std::string> headers {
-				{ "content-type", "application/x-www-form-urlencoded" },
-				{ "content-length", std::to_string(payloadString.size()) },
-				{ "x-amz-date", headerDate },
-				{ "host", hostName },
+			struct datum {
+				const stat::aggregation<double>* aggregation;
+				const distribution* histogram;
+				std::string text;
+				std::vector<splice> splices;
 			};
 
-			std::ostringstream canonicalString;
-			canonicalString << "POST\n" // Request method
-				"/\n" // Canonical URI
-				"\n"; // Canonical query string
-			for(const auto& header: headers) canonicalString << header.first << ':' << header.second << '\n';
-			canonicalString << '\n';
-
-			std::ostringstream signedHeaders;
-			auto headerIt = headers.cbegin();
-			signedHeaders << headerIt->first;
-			for(++headerIt; headerIt != headers.cend(); ++headerIt) {
-				signedHeaders << ';' << headerIt->first;
+			std::vector<datum> data_;
+
+			static datum compile(const metric& metric, const std::unordered_map<std::string, std::string>& dimensions) {
+				datum datum { metric.statistics, metric.distribution, std::string(), std::vector<splice>() };
+				const auto key = [&datum](const std::string& suffix) {
+					datum.text += "&MetricData.member.";
+					datum.splices.push_back({ datum.text.size(), splice::Index });
+					datum.text += suffix;
+				};
+				const auto statistic = [&key, &datum](const char* name, const splice::type inserts) {
+					key(std::string(".StatisticValues.") + name + '=');
+					datum.splices.push_back({ datum.text.size(), inserts });
+				};
+
+				key(".MetricName=" + util::urlEncode(metric.name));
+				key(".Unit=" + util::urlEncode(metric.unit));
+				key(".Timestamp=");
+				datum.splices.push_back({ datum.text.size(), splice::Timestamp });
+				int dimensionIndex = 0;
+				const auto dimension = [&key, &dimensionIndex](const std::string& name, const std::string& value) {
+					const std::string dimensionPrefix = ".Dimensions.member." + std::to_string(++dimensionIndex);
+					key(dimensionPrefix + ".Name=" + util::urlEncode(name));
+					key(dimensionPrefix + ".Value=" + util::urlEncode(value));
+				};
+				for(const auto& shared: dimensions) dimension(shared.first, shared.second);
+				for(const auto& own: metric.dimensions) dimension(own.first, own.second);
+				if(datum.histogram != nullptr) {
+					datum.splices.push_back({ datum.text.size(), splice::Distribution });
+				} else {
+					statistic("Minimum", splice::Minimum);
+					statistic("Maximum", splice::Maximum);
+					statistic("Sum", splice::Sum);
+					statistic("SampleCount", splice::SampleCount);
+				}
+				return datum;
 			}
-			canonicalString << signedHeaders.str() << '\n' << payloadHash;
-			//std::cout << "Canonical string: <" << canonicalString.str() << '>' << std::endl;
-
-			const std::string canonicalRequestHash = digestContext.hashString(canonicalString.str());
-
-			char amazonDate[17];
-			std::strftime(amazonDate, sizeof(amazonDate), "%Y%m%dT%H%M%SZ", nowTm); // TODO: Return value
-			const std::string amazonDateOnly(amazonDate, amazonDate + 8);
-
-			std::ostringstream credentialScope;
-			credentialScope << amazonDateOnly << '/' << region << "/monitoring/aws4_request";
-
-			std::ostringstream signingString;
-			signingString << "AWS4-HMAC-SHA256\n"
-				<< amazonDate << "\n"
-				<< credentialScope.str() << '\n'
-				<< canonicalRequestHash;
-			//std::cout << "String to sign: <" << signingString.str() << '>' << std::endl;
-
-			std::cout << "Date only: <" << amazonDateOnly << ">" << std::endl;
-			uint8_t hmac1[256 / 8];
-			uint8_t hmac2[256 / 8];
-			crypto::hmac("AWS4" + secretKey, amazonDateOnly, hmac1);
-			crypto::hmac(hmac1, sizeof(hmac1), region, hmac2);
-			crypto::hmac(hmac2, sizeof(hmac2), "monitoring", hmac1);
-			crypto::hmac(hmac1, sizeof(hmac1), "aws4_request", hmac2);
-			crypto::hmac(hmac2, sizeof(hmac2), signingString.str(), hmac1);
-			std::string signature = util::hexEncode(hmac1, sizeof(hmac1));
-
-			std::ostringstream authorization;
-			authorization << "AWS4-HMAC-SHA256 Credential=" << accessKey << '/' << credentialScope.str()
-				<< ", SignedHeaders=" << signedHeaders.str() << ", Signature=" << signature;
-			headers.emplace("authorization", authorization.str());
-
-			std::ostringstream request;
-			request << "POST / HTTP/1.1\r\n";
-			for(const auto& header: headers) request << header.first << ": " << header.second << "\r\n";
-			request << "\r\n" << payloadString;
-
-			const std::string requestString = request.str();
-			//std::cout << "Request: <" << requestString << ">" << std::endl;
-			std::unique_ptr<uint8_t[]> data(new uint8_t[requestString.size()]);
-			std::memcpy(data.get(), requestString.c_str(), requestString.size());
-			return util::buffer(std::move(data), requestString.size());
-		}
+
+			static size_t nextBucket(const distribution& histogram, size_t bucket) {
+				while((bucket < distribution::bucketCount) && (histogram.buckets[bucket] == 0)) ++bucket;
+				return bucket;
+			}
+
+			/* Writes the values and counts of up to maxValues non-empty buckets, starting at the given bucket, and
+			 * returns the next non-empty bucket. */
+			static size_t writeDistribution(util::buffer& payload, const unsigned int index,
+					const distribution& histogram, size_t bucket) {
+				for(size_t value = 1; (value <= maxValues) && (bucket < distribution::bucketCount); ++value) {
+					payload.append("&MetricData.member."); appendInteger(payload, index);
+					payload.append(".Values.member."); appendInteger(payload, value);
+					payload.append('='); appendDouble(payload, distribution::value(bucket));
+					payload.append("&MetricData.member."); appendInteger(payload, index);
+					payload.append(".Counts.member."); appendInteger(payload, value);
+					payload.append('='); appendInteger(payload, histogram.buckets[bucket]);
+					bucket = nextBucket(histogram, bucket + 1);
+				}
+				return bucket;
+			}
+
+			/* Writes one datum from the template, returning the next bucket to be written for a distribution. */
+			static size_t write(util::buffer& payload, const datum& datum, const unsigned int index,
+					const char* timestamp, size_t bucket) {
+				size_t position = 0;
+				for(const splice& splice: datum.splices) {
+					payload.append(datum.text.data() + position, splice.offset - position);
+					position = splice.offset;
+					switch(splice.inserts) {
+						case splice::Index: appendInteger(payload, index); break;
+						case splice::Timestamp: payload.append(timestamp); break;
+						case splice::Minimum: appendDouble(payload, datum.aggregation->min); break;
+						case splice::Maximum: appendDouble(payload, datum.aggregation->max); break;
+						case splice::Sum: appendDouble(payload, datum.aggregation->sum); break;
+						case splice::SampleCount: appendInteger(payload, datum.aggregation->count); break;
+						case splice::Distribution:
+							bucket = writeDistribution(payload, index, *datum.histogram, bucket);
+							break;
+					}
+				}
+				payload.append(datum.text.data() + position, datum.text.size() - position);
+				return bucket;
+			}
+
+			public:
+				requestTemplate(const std::unordered_map<std::string, std::string>& dimensions,
+						const std::vector<metric>& metrics) {
+					data_.reserve(metrics.size());
+					for(const metric& metric: metrics) data_.push_back(compile(metric, dimensions));
+				}
+
+				/* Where writing a template's datums has got to: the metric, and for a distribution the next bucket. */
+				struct position {
+					size_t datum = 0;
+					size_t bucket = 0;
+					bool started = false;
+				};
+
+				/* Appends the next datum, numbered index, for a metric that has at least one sample, and moves the
+				 * position past it. Returns false, having written nothing, once every datum has been written. The
+				 * datum carries the timestamp, in ISO 8601 form, so that it is recorded against the time it was
+				 * collected however late it is sent. */
+				bool writeNext(util::buffer& payload, const unsigned int index, const char* timestamp,
+						position& position) const {
+					for(; position.datum < data_.size(); ++position.datum, position.started = false) {
+						const datum& datum = data_[position.datum];
+						if(datum.histogram != nullptr) {
+							if(!position.started) position.bucket = nextBucket(*datum.histogram, 0);
+							position.started = true;
+							if(position.bucket < distribution::bucketCount) {
+								position.bucket = write(payload, datum, index, timestamp, position.bucket);
+								return true;
+							}
+						} else if(!position.started && (datum.aggregation->count != 0)) {
+							position.started = true;
+							write(payload, datum, index, timestamp, 0);
+							return true;
+						}
+					}
+					return false;
+				}
+
+				/* Appends every datum, numbering them on from the given member index. */
+				void write(util::buffer& payload, unsigned int& index, const char* timestamp) const {
+					position position;
+					while(writeNext(payload, index + 1, timestamp, position)) ++index;
+				}
+		};
+
+		/* Builds signed PutMetricData requests in a single buffer that is reused from one request to the next. The
+		 * form body is written after a headroom reserved at the front of the buffer, the canonical request and string
+		 * to sign are built in a scratch buffer, and the request line and headers are finally written into the
+		 * headroom, so the finished request is contiguous without copying the body. Once both buffers have grown to
+		 * fit, building a request does not allocate.
+		 *
+		 * Bodies may be sent with gzip content encoding, which they take to well, as the text of one datum repeats
+		 * that of the next but for its member index. The body is then compressed into a second buffer, with the
+		 * same headroom, and signed as it is sent. */
+		class requestBuilder {
+			constexpr static const char* contentType = "application/x-www-form-urlencoded";
+			constexpr static const char* signedHeaders = "content-length;content-type;host;x-amz-date";
+			constexpr static const char* gzipSignedHeaders = "content-encoding;content-length;content-type;host;x-amz-date";
+
+			const std::string hostName_;
+			aws::signer& signer_;
+			const std::string prefix_;
+			size_t headroom_ = 1024;
+			util::buffer request_;
+			util::buffer scratch_;
+			std::unique_ptr<gzip::deflater> deflater_;
+			util::buffer compressed_;
+
+			public:
+				requestBuilder(const std::string& hostName, aws::signer& signer, const std::string& nameSpace,
+						const bool compress = false) : hostName_(hostName), signer_(signer),
+						prefix_("Action=PutMetricData&Version=2010-08-01&Namespace=" + util::urlEncode(nameSpace)),
+						deflater_(compress ? new gzip::deflater() : nullptr) {}
+
+				util::buffer& build(const std::time_t now, const requestTemplate& single) {
+					const requestTemplate* requestTemplates[] = { &single };
+					return build(now, std::begin(requestTemplates), std::end(requestTemplates));
+				}
+
+				/* Replaces the request buffer's content with a request publishing every metric of the range of
+				 * templates that has at least one sample. */
+				template<typename I>
+				util::buffer& build(const std::time_t now, const I begin, const I end) {
+					payload(now, begin, end);
+					return sign(now);
+				}
+
+				/* Replaces the request buffer's content with a request carrying a form body written earlier by
+				 * payload(). */
+				util::buffer& build(const std::time_t now, const void* payload, const size_t size) {
+					request_.clear(headroom_);
+					request_.append(payload, size);
+					return sign(now);
+				}
+
+				/* Replaces the request buffer's content with just the form body of a request publishing the range of
+				 * templates, with its datums timestamped now, so that it can be kept and signed when it is sent. */
+				template<typename I>
+				util::buffer& payload(const std::time_t now, const I begin, const I end) {
+					char timestamp[timestampSize];
+					formatTimestamp(now, timestamp);
+					request_.clear(headroom_);
+					request_.append(prefix_);
+					unsigned int index = 0;
+					for(I it = begin; it != end; ++it) (*it)->write(request_, index, timestamp);
+					return request_;
+				}
+
+				/* Like payload(), but packs the datums into as few form bodies as it can without any holding more
+				 * than maxDatums datums or maxBytes bytes. Each body is handed to emit, along with the number of datums
+				 * in it, as soon as it is full; the request buffer is overwritten once emit returns. Returns the
+				 * number of datums dropped for being too large to fit in a request on their own. */
+				template<typename I, typename F>
+				unsigned int pack(const std::time_t now, const I begin, const I end, const unsigned int maxDatums,
+						const size_t maxBytes, const F& emit) {
+					char timestamp[timestampSize];
+					formatTimestamp(now, timestamp);
+					request_.clear(headroom_);
+					request_.append(prefix_);
+					unsigned int datums = 0;
+					unsigned int dropped = 0;
+					for(I it = begin; it != end; ++it) {
+						requestTemplate::position position;
+						for(;;) {
+							const requestTemplate::position start = position;
+							const size_t size = request_.size();
+							if(!(*it)->writeNext(request_, datums + 1, timestamp, position)) break;
+							if(request_.size() <= maxBytes) {
+								if(++datums == maxDatums) {
+									emit(request_, datums);
+									request_.clear(headroom_);
+									request_.append(prefix_);
+									datums = 0;
+								}
+								continue;
+							}
+
+							// Start a new body with the datum that did not fit, unless it had one to itself
+							request_.truncate(size);
+							if(datums == 0) {
+								++dropped;
+								continue;
+							}
+							emit(request_, datums);
+							request_.clear(headroom_);
+							request_.append(prefix_);
+							datums = 0;
+							position = start;
+						}
+					}
+					if(datums != 0) emit(request_, datums);
+					return dropped;
+				}
+
+			private:
+				// The length of an ISO 8601 timestamp with URL-encoded colons, and its terminator
+				constexpr static size_t timestampSize = 25;
+
+				static void formatTimestamp(const std::time_t now, char* timestamp) {
+					std::tm nowTm;
+					gmtime_r(&now, &nowTm);
+					// The colons are URL-encoded, like any other reserved character in a form value
+					if(std::strftime(timestamp, timestampSize, "%Y-%m-%dT%H%%3A%M%%3A%SZ", &nowTm) == 0) {
+						throw std::logic_error("Failed to format datum timestamp");
+					}
+				}
+
+				/* Signs the form body in the request buffer, compressing it first if bodies are to be compressed, and
+				 * writes the request line and headers in front of it. Returns the buffer holding the request. */
+				util::buffer& sign(const std::time_t now) {
+					util::buffer& request = deflater_ ? compressed_ : request_;
+					if(deflater_) {
+						compressed_.clear(headroom_);
+						deflater_->compress(request_.data(), request_.size(), compressed_);
+					}
+					const char* const headerList = deflater_ ? gzipSignedHeaders : signedHeaders;
+
+					std::tm nowTm;
+					gmtime_r(&now, &nowTm);
+					char amazonDate[17];
+					if(std::strftime(amazonDate, sizeof(amazonDate), "%Y%m%dT%H%M%SZ", &nowTm) == 0) {
+						throw std::logic_error("Failed to format request date");
+					}
+					signer_.date(amazonDate);
+
+					// The payload hash covers the body as it is sent, compressed or not
+					const size_t payloadSize = request.size();
+					char payloadHash[signer::hashSize];
+					signer_.hash(request.data(), payloadSize, payloadHash);
+					char contentLength[24];
+					const size_t contentLengthSize = std::to_chars(contentLength,
+							contentLength + sizeof(contentLength), payloadSize).ptr - contentLength;
+
+					scratch_.clear();
+					scratch_.append("POST\n" // Request method
+							"/\n" // Canonical URI
+							"\n"); // Canonical query string
+					if(deflater_) scratch_.append("content-encoding:gzip\n");
+					scratch_.append("content-length:"); scratch_.append(contentLength, contentLengthSize);
+					scratch_.append("\ncontent-type:"); scratch_.append(contentType);
+					scratch_.append("\nhost:"); scratch_.append(hostName_);
+					scratch_.append("\nx-amz-date:"); scratch_.append(amazonDate);
+					scratch_.append("\n\n");
+					scratch_.append(headerList); scratch_.append('\n');
+					scratch_.append(payloadHash, sizeof(payloadHash));
+					char canonicalRequestHash[signer::hashSize];
+					signer_.hash(scratch_.data(), scratch_.size(), canonicalRequestHash);
+
+					scratch_.clear();
+					scratch_.append("AWS4-HMAC-SHA256\n");
+					scratch_.append(amazonDate); scratch_.append('\n');
+					scratch_.append(signer_.credentialScope()); scratch_.append('\n');
+					scratch_.append(canonicalRequestHash, sizeof(canonicalRequestHash));
+					char signature[signer::hashSize];
+					signer_.sign(scratch_.data(), scratch_.size(), signature);
+
+					scratch_.clear();
+					scratch_.append("POST / HTTP/1.1\r\n");
+					scratch_.append("authorization: AWS4-HMAC-SHA256 Credential=");
+					scratch_.append(signer_.accessKey());
+					scratch_.append('/'); scratch_.append(signer_.credentialScope());
+					scratch_.append(", SignedHeaders="); scratch_.append(headerList);
+					scratch_.append(", Signature="); scratch_.append(signature, sizeof(signature));
+					if(deflater_) scratch_.append("\r\ncontent-encoding: gzip");
+					scratch_.append("\r\ncontent-length: "); scratch_.append(contentLength, contentLengthSize);
+					scratch_.append("\r\ncontent-type: "); scratch_.append(contentType);
+					scratch_.append("\r\nhost: "); scratch_.append(hostName_);
+					scratch_.append("\r\nx-amz-date: "); scratch_.append(amazonDate);
+					scratch_.append("\r\n\r\n");
+					request.prepend(scratch_.data(), scratch_.size());
+					headroom_ = std::max(headroom_, scratch_.size());
+					return request;
+				}
+		};
 	}
 }
@@ -0,0 +1,57 @@
+// Copyright (C) 2015 Philip Cronje. All rights reserved.
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "stat.h"
+
+namespace stat {
+	/* A source of metrics. A collector samples its source every interval, accumulating the samples in aggregations
+	 * that its metrics refer to, and those metrics are published and reset every flush period. */
+	class collector {
+		const std::chrono::milliseconds interval_;
+		const std::chrono::milliseconds flushPeriod_;
+
+		protected:
+			collector(const std::chrono::milliseconds interval, const std::chrono::milliseconds flushPeriod)
+					: interval_(interval), flushPeriod_(flushPeriod) {}
+
+		public:
+			collector(const collector&) = delete;
+			virtual ~collector() = default;
+
+			std::chrono::milliseconds interval() const noexcept { return interval_; }
+			std::chrono::milliseconds flushPeriod() const noexcept { return flushPeriod_; }
+
+			/* The metrics published by this collector, which must refer to aggregations that live as long as the
+			 * collector does, or until metricsChanged() says otherwise. Called when the collector is registered. */
+			virtual std::vector<metric> metrics() = 0;
+			/* Whether metrics() would now give a different list, as when a device has come or gone. Checked before
+			 * every flush; calling metrics() clears it. */
+			virtual bool metricsChanged() const { return false; }
+
+			virtual void sample() = 0;
+
+			/* Clears the aggregations once their metrics have been published. */
+			virtual void reset() = 0;
+	};
+
+	/* Publishes the distribution of values recorded as events happen, such as latencies, rather than sampled. */
+	class eventCollector : public collector {
+		const std::string name_;
+		const std::string unit_;
+		histogram<double> distribution_;
+
+		public:
+			eventCollector(const std::string& name, const std::string& unit, const std::chrono::milliseconds flushPeriod)
+					: collector(flushPeriod, flushPeriod), name_(name), unit_(unit) {}
+
+			void record(const double value) { distribution_ += value; }
+
+			std::vector<metric> metrics() override { return { { name_, &distribution_, unit_ } }; }
+			void sample() override {}
+			void reset() override { distribution_ = histogram<double>(); }
+	};
+}
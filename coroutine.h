@@ -0,0 +1,113 @@
+// Copyright (C) 2015 Philip Cronje. All rights reserved.
+#pragma once
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+
+namespace co {
+	template<typename T = void>
+	class task;
+
+	namespace detail {
+		/* Resumes whichever coroutine awaited the task once it has finished, without growing the stack. */
+		struct finalAwaiter {
+			bool await_ready() const noexcept { return false; }
+			template<typename P>
+			std::coroutine_handle<> await_suspend(const std::coroutine_handle<P> handle) const noexcept {
+				const std::coroutine_handle<> continuation = handle.promise().continuation;
+				return continuation ? continuation : std::noop_coroutine();
+			}
+			void await_resume() const noexcept {}
+		};
+
+		struct promiseBase {
+			std::coroutine_handle<> continuation;
+			std::exception_ptr exception;
+
+			std::suspend_always initial_suspend() const noexcept { return {}; }
+			finalAwaiter final_suspend() const noexcept { return {}; }
+			void unhandled_exception() noexcept { exception = std::current_exception(); }
+
+			void rethrow() const {
+				if(exception) std::rethrow_exception(exception);
+			}
+		};
+
+		template<typename T>
+		struct promise : promiseBase {
+			std::optional<T> value;
+
+			task<T> get_return_object() noexcept;
+			template<typename V>
+			void return_value(V&& value_) { value.emplace(std::forward<V>(value_)); }
+
+			T result() {
+				rethrow();
+				return std::move(*value);
+			}
+		};
+
+		template<>
+		struct promise<void> : promiseBase {
+			task<void> get_return_object() noexcept;
+			void return_void() const noexcept {}
+
+			void result() const { rethrow(); }
+		};
+	}
+
+	/* A coroutine that starts when it is awaited, or when start() is called on one that nothing awaits, and hands its
+	 * result or exception to whatever awaits it. The task owns the coroutine's frame, which is freed with it. */
+	template<typename T>
+	class task {
+		public:
+			typedef detail::promise<T> promise_type;
+
+		private:
+			std::coroutine_handle<promise_type> handle_;
+
+			struct awaiter {
+				const std::coroutine_handle<promise_type> handle;
+
+				bool await_ready() const noexcept { return handle.done(); }
+				std::coroutine_handle<> await_suspend(const std::coroutine_handle<> awaiting) const noexcept {
+					handle.promise().continuation = awaiting;
+					return handle;
+				}
+				T await_resume() const { return handle.promise().result(); }
+			};
+
+		public:
+			explicit task(const std::coroutine_handle<promise_type> handle) noexcept : handle_(handle) {}
+			task(task&& other) noexcept : handle_(std::exchange(other.handle_, nullptr)) {}
+			task(const task&) = delete;
+			~task() noexcept { if(handle_) handle_.destroy(); }
+
+			task& operator=(task&& other) noexcept {
+				if(handle_) handle_.destroy();
+				handle_ = std::exchange(other.handle_, nullptr);
+				return *this;
+			}
+
+			awaiter operator co_await() const noexcept { return awaiter { handle_ }; }
+
+			/* Runs a task that nothing awaits until it first suspends. */
+			void start() const { handle_.resume(); }
+			bool done() const noexcept { return handle_.done(); }
+			/* The result of a task that is done, rethrowing the exception it ended with, if any. */
+			T result() const { return handle_.promise().result(); }
+	};
+
+	namespace detail {
+		template<typename T>
+		task<T> promise<T>::get_return_object() noexcept {
+			return task<T>(std::coroutine_handle<promise<T>>::from_promise(*this));
+		}
+
+		inline task<void> promise<void>::get_return_object() noexcept {
+			return task<void>(std::coroutine_handle<promise<void>>::from_promise(*this));
+		}
+	}
+}
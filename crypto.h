@@ -1,8 +1,10 @@
 // Copyright (C) 2015 Philip Cronje. All rights reserved.
 #pragma once
 
+#include <openssl/core_names.h>
 #include <openssl/evp.h>
 #include <openssl/hmac.h>
+#include <openssl/params.h>
 
 #include "util.h"
 
@@ -41,24 +43,73 @@ namespace crypto {
 			}
 			~digestContext() { EVP_MD_CTX_destroy(context_); }
 
-			std::string hashString(const std::string& input) {
+			/* Hashes the input into output, which must have room for EVP_MAX_MD_SIZE bytes, returning the size of
+			 * the hash. */
+			unsigned int hash(const void* input, const size_t size, uint8_t* output) {
 				if(needsReinitialization_) {
 					initialize();
 				}
 
-				if(EVP_DigestUpdate(context_, input.c_str(), input.size() * sizeof(char)) == 0) {
+				if(EVP_DigestUpdate(context_, input, size) == 0) {
 					throw std::runtime_error("Failed to hash input");
 				}
-				uint8_t rawHash[EVP_MAX_MD_SIZE];
-				unsigned int rawHashSize;
-				if(EVP_DigestFinal_ex(context_, rawHash, &rawHashSize) == 0) {
+				unsigned int outputSize;
+				if(EVP_DigestFinal_ex(context_, output, &outputSize) == 0) {
 					throw std::runtime_error("Failed to obtain hash bytes");
 				}
 				needsReinitialization_ = true;
+				return outputSize;
+			}
+
+			std::string hashString(const std::string& input) {
+				uint8_t rawHash[EVP_MAX_MD_SIZE];
+				const unsigned int rawHashSize = hash(input.c_str(), input.size() * sizeof(char), rawHash);
 				return util::hexEncode(rawHash, rawHashSize);
 			}
 	};
 
+	/* HMAC-SHA256 context that keeps its key across messages, so that signing several messages with the same key only
+	 * pays for the key schedule once. */
+	class hmacContext {
+		EVP_MAC* mac_;
+		EVP_MAC_CTX* context_;
+
+		public:
+			hmacContext() : mac_(EVP_MAC_fetch(nullptr, "HMAC", nullptr)),
+					context_((mac_ != nullptr) ? EVP_MAC_CTX_new(mac_) : nullptr) {
+				if(context_ == nullptr) {
+					EVP_MAC_free(mac_);
+					throw std::runtime_error("Failed to allocate HMAC context");
+				}
+			}
+			hmacContext(const hmacContext&) = delete;
+			~hmacContext() {
+				EVP_MAC_CTX_free(context_);
+				EVP_MAC_free(mac_);
+			}
+
+			void key(const uint8_t* key, const size_t keySize) {
+				char digest[] = "SHA256";
+				const OSSL_PARAM parameters[] = {
+					OSSL_PARAM_construct_utf8_string(OSSL_MAC_PARAM_DIGEST, digest, 0),
+					OSSL_PARAM_construct_end()
+				};
+				if(EVP_MAC_init(context_, key, keySize, parameters) == 0) {
+					throw std::runtime_error("Failed to key HMAC context");
+				}
+			}
+
+			void sign(const void* data, const size_t size, uint8_t* output) {
+				// A null key re-initialises the context with the key it already holds
+				size_t outputSize;
+				if((EVP_MAC_init(context_, nullptr, 0, nullptr) == 0)
+						|| (EVP_MAC_update(context_, static_cast<const unsigned char*>(data), size) == 0)
+						|| (EVP_MAC_final(context_, output, &outputSize, EVP_MAX_MD_SIZE) == 0)) {
+					throw std::runtime_error("Failed to generate HMAC");
+				}
+			}
+	};
+
 	void hmac(const uint8_t* key, const size_t keySize, const std::string& data, uint8_t* output) {
 		if(HMAC(EVP_sha256(), key, keySize, reinterpret_cast<const unsigned char*>(data.c_str()),
 					data.size() * sizeof(char), output, nullptr) == nullptr) {
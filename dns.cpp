@@ -0,0 +1,344 @@
+// Copyright (C) 2015 Philip Cronje. All rights reserved.
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+
+#include <netinet/in.h>
+
+#include "dns.h"
+
+namespace {
+	struct dnsCategory_ : public std::error_category {
+		const char* name() const noexcept override { return "dns"; }
+		std::string message(int code) const noexcept override {
+			switch(static_cast<dns::error>(code)) {
+				case dns::error::NameError: return "Host not found";
+				case dns::error::ServerFailure: return "Name server failure";
+				case dns::error::Refused: return "Query refused by name server";
+				case dns::error::Timeout: return "Name server did not answer";
+				case dns::error::NoAddresses: return "Host has no addresses";
+			}
+			return "Unknown error";
+		}
+	};
+	dnsCategory_ dnsCategory;
+
+	enum recordType : std::uint16_t {
+		A = 1,
+		CName = 5,
+		Soa = 6,
+		AAAA = 28
+	};
+	// The record type asked for by each of a lookup's two queries
+	constexpr std::uint16_t queryTypes[2] = { A, AAAA };
+
+	constexpr std::uint16_t classInternet = 1;
+	constexpr std::size_t headerSize = 12;
+	// Without EDNS, answers over UDP are limited to 512 bytes
+	constexpr std::size_t maxMessageSize = 512;
+
+	enum responseCode {
+		NoError = 0,
+		ServerFailure = 2,
+		NameError = 3,
+		Refused = 5
+	};
+
+	/* Bounds-checked big-endian reader over a DNS message. A read past the end sets failed instead. */
+	struct reader {
+		const std::uint8_t* const end;
+		const std::uint8_t* p;
+		bool failed = false;
+
+		reader(const std::uint8_t* message, const std::size_t size) : end(message + size), p(message) {}
+
+		bool available(const std::size_t n) {
+			if(static_cast<std::size_t>(end - p) < n) failed = true;
+			return !failed;
+		}
+
+		std::uint16_t u16() {
+			if(!available(2)) return 0;
+			const std::uint16_t value = (p[0] << 8) | p[1];
+			p += 2;
+			return value;
+		}
+
+		std::uint32_t u32() {
+			const std::uint32_t high = u16();
+			return (high << 16) | u16();
+		}
+
+		void skip(const std::size_t n) { if(available(n)) p += n; }
+
+		/* Skips a domain name, which either ends in the root label or in a pointer to a name elsewhere. */
+		void skipName() {
+			while(available(1)) {
+				const std::uint8_t length = *p;
+				if((length & 0xC0) == 0xC0) {
+					skip(2);
+					return;
+				}
+				skip(1 + length);
+				if(length == 0) return;
+			}
+		}
+	};
+
+	/* Encodes a query for host, returning its size, or zero if host is not a valid domain name. */
+	std::size_t encodeQuery(std::uint8_t* message, const std::uint16_t id, const std::string& host,
+			const std::uint16_t type) {
+		std::uint8_t* p = message;
+		const std::uint8_t header[headerSize] = {
+			static_cast<std::uint8_t>(id >> 8), static_cast<std::uint8_t>(id),
+			0x01, 0x00, // Recursion desired
+			0x00, 0x01, // One question
+			0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+		};
+		p = std::copy(header, header + headerSize, p);
+
+		std::size_t labelStart = 0;
+		while(labelStart < host.size()) {
+			std::size_t labelEnd = host.find('.', labelStart);
+			if(labelEnd == std::string::npos) labelEnd = host.size();
+			const std::size_t length = labelEnd - labelStart;
+			if((length == 0) || (length > 63)) return 0;
+			*p++ = length;
+			p = std::copy(host.data() + labelStart, host.data() + labelEnd, p);
+			labelStart = labelEnd + 1;
+		}
+		*p++ = 0;
+		if(p - message - headerSize > 255) return 0;
+
+		const std::uint8_t question[4] = { static_cast<std::uint8_t>(type >> 8), static_cast<std::uint8_t>(type),
+			0x00, classInternet };
+		p = std::copy(question, question + sizeof(question), p);
+		return p - message;
+	}
+}
+
+const std::error_category& dns::category() noexcept { return dnsCategory; }
+
+dns::resolver::resolver(const epoll& epoll, const net::address& nameServer, const std::chrono::milliseconds timeout)
+		: fd_(::socket(nameServer.family(), SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)), timeout_(timeout),
+		random_(std::random_device()()) {
+	if(fd_ == -1) throw std::system_error(errno, std::system_category(), "Failed to create DNS socket");
+	// Connecting the socket makes the kernel drop datagrams from anywhere but the name server
+	if(::connect(fd_, reinterpret_cast<const sockaddr*>(&nameServer.storage), nameServer.length) == -1) {
+		const int error = errno;
+		close(fd_);
+		throw std::system_error(error, std::system_category(), "Failed to connect to name server");
+	}
+	epoll.add(fd_, *this, EPOLLIN);
+}
+
+dns::resolver::~resolver() noexcept { close(fd_); }
+
+net::address dns::resolver::systemNameServer() {
+	net::address address;
+	std::ifstream resolvConf("/etc/resolv.conf");
+	bool found = false;
+	for(std::string line; !found && std::getline(resolvConf, line);) {
+		std::istringstream fields(line);
+		std::string keyword, value;
+		found = (fields >> keyword >> value) && (keyword == "nameserver") && net::address::parse(value, address);
+	}
+	if(!found) net::address::parse("127.0.0.1", address);
+	address.port(53);
+	return address;
+}
+
+void dns::resolver::resolve(const std::string& host, completion completion) {
+	std::vector<net::address> addresses(1);
+	if(net::address::parse(host, addresses[0])) {
+		completion(addresses, std::error_code());
+		return;
+	}
+
+	const clock::time_point now = clock::now();
+	const auto cached = cache_.find(host);
+	if(cached != cache_.end()) {
+		if(cached->second.expiry > now) {
+			completion(cached->second.addresses, cached->second.error);
+			return;
+		}
+		cache_.erase(cached);
+	}
+
+	const auto pending = lookups_.find(host);
+	if(pending != lookups_.end()) {
+		pending->second->completions.push_back(std::move(completion));
+		return;
+	}
+
+	std::uint8_t message[maxMessageSize];
+	if(encodeQuery(message, 0, host, A) == 0) {
+		completion({ }, error::NameError);
+		return;
+	}
+
+	lookup& lookup = *(lookups_[host] = std::unique_ptr<resolver::lookup>(new resolver::lookup()));
+	lookup.host = host;
+	lookup.completions.push_back(std::move(completion));
+	for(unsigned int query = 0; query < 2; ++query) {
+		std::uint16_t id;
+		do id = random_(); while(queries_.count(id) != 0);
+		lookup.ids[query] = id;
+		queries_[id] = &lookup;
+	}
+	lookup.attempts = 1;
+	lookup.deadline = now + timeout_;
+	send(lookup, 0);
+	send(lookup, 1);
+}
+
+void dns::resolver::send(lookup& lookup, const unsigned int query) {
+	std::uint8_t message[maxMessageSize];
+	const std::size_t size = encodeQuery(message, lookup.ids[query], lookup.host, queryTypes[query]);
+	// Failures, such as an ICMP error from an earlier query, are left for the retry to deal with
+	::send(fd_, message, size, MSG_NOSIGNAL);
+}
+
+void dns::resolver::ready(std::uint32_t) {
+	std::uint8_t message[maxMessageSize];
+	for(;;) {
+		const ssize_t size = recv(fd_, message, sizeof(message), 0);
+		if(size == -1) {
+			if((errno == EAGAIN) || (errno == EWOULDBLOCK)) return;
+			if((errno == ECONNREFUSED) || (errno == EINTR)) continue;
+			throw std::system_error(errno, std::system_category(), "Failed to receive from name server");
+		}
+		receive(message, size);
+	}
+}
+
+void dns::resolver::receive(const std::uint8_t* message, const std::size_t size) {
+	reader reader(message, size);
+	const auto query = queries_.find(reader.u16());
+	if(query == queries_.end()) return;
+	lookup& lookup = *query->second;
+	const unsigned int index = (lookup.ids[0] == query->first) ? 0 : 1;
+
+	const std::uint16_t flags = reader.u16();
+	const std::uint16_t questions = reader.u16();
+	const std::uint16_t answers = reader.u16();
+	const std::uint16_t authorities = reader.u16();
+	reader.skip(2);
+	if(reader.failed || ((flags & 0x8000) == 0) || (questions != 1)) return;
+	reader.skipName();
+	if((reader.u16() != queryTypes[index]) || (reader.u16() != classInternet) || reader.failed) return;
+
+	switch(flags & 0x000F) {
+		case NoError: break;
+		case NameError: lookup.error = error::NameError; break;
+		case Refused: lookup.error = error::Refused; break;
+		default: lookup.error = error::ServerFailure; break;
+	}
+
+	std::vector<net::address>& addresses = lookup.answers[index];
+	for(unsigned int i = 0; (i < answers) && !reader.failed; ++i) {
+		reader.skipName();
+		const std::uint16_t type = reader.u16();
+		const std::uint16_t recordClass = reader.u16();
+		const std::uint32_t ttl = reader.u32();
+		const std::uint16_t length = reader.u16();
+		if(!reader.available(length)) break;
+
+		if(recordClass == classInternet) {
+			net::address address;
+			if((type == A) && (length == 4)) {
+				sockaddr_in& in = reinterpret_cast<sockaddr_in&>(address.storage);
+				in.sin_family = AF_INET;
+				std::memcpy(&in.sin_addr, reader.p, 4);
+				address.length = sizeof(in);
+			} else if((type == AAAA) && (length == 16)) {
+				sockaddr_in6& in6 = reinterpret_cast<sockaddr_in6&>(address.storage);
+				in6.sin6_family = AF_INET6;
+				std::memcpy(&in6.sin6_addr, reader.p, 16);
+				address.length = sizeof(in6);
+			}
+			// The answer lasts only as long as every record in the chain leading to it
+			if((address.length != 0) || (type == CName)) lookup.ttl = std::min(lookup.ttl, ttl);
+			if(address.length != 0) addresses.push_back(address);
+		}
+		reader.skip(length);
+	}
+
+	if(addresses.empty()) {
+		for(unsigned int i = 0; (i < authorities) && !reader.failed; ++i) {
+			reader.skipName();
+			const std::uint16_t type = reader.u16();
+			reader.skip(2);
+			const std::uint32_t ttl = reader.u32();
+			const std::uint16_t length = reader.u16();
+			if(!reader.available(length)) break;
+			const std::uint8_t* const next = reader.p + length;
+			if(type == Soa) {
+				// RFC 2308: negative answers are cached for the lesser of the SOA's TTL and its MINIMUM field
+				reader.skipName();
+				reader.skipName();
+				reader.skip(16);
+				const std::uint32_t minimum = reader.u32();
+				if(!reader.failed) lookup.negativeTtl = std::min(ttl, minimum);
+			}
+			reader.p = next;
+		}
+	}
+
+	queries_.erase(query);
+	lookup.answered[index] = true;
+	if(lookup.answered[0] && lookup.answered[1]) finish(&lookup);
+}
+
+void dns::resolver::finish(const lookup* finished) {
+	const auto found = lookups_.find(finished->host);
+	// A completion may already have started a new lookup for the host
+	if((found == lookups_.end()) || (found->second.get() != finished)) return;
+	const std::unique_ptr<lookup> lookup = std::move(found->second);
+	lookups_.erase(found);
+	for(unsigned int query = 0; query < 2; ++query) {
+		if(!lookup->answered[query]) queries_.erase(lookup->ids[query]);
+	}
+
+	std::vector<net::address> addresses = std::move(lookup->answers[0]);
+	addresses.insert(addresses.end(), lookup->answers[1].cbegin(), lookup->answers[1].cend());
+	std::error_code result;
+	const clock::time_point now = clock::now();
+	if(!addresses.empty()) {
+		cache_[lookup->host] = { addresses, result, now + std::chrono::seconds(std::min(lookup->ttl, maxTtl)) };
+	} else {
+		result = lookup->error ? lookup->error : make_error_code(error::NoAddresses);
+		// Only answers saying that there is nothing to be found are cached; other failures may be transient
+		if((result == error::NameError) || (result == error::NoAddresses)) {
+			cache_[lookup->host] = { addresses, result,
+				now + std::chrono::seconds(std::min(lookup->negativeTtl, maxNegativeTtl)) };
+		}
+	}
+
+	for(const completion& completion: lookup->completions) completion(addresses, result);
+}
+
+void dns::resolver::expire() {
+	const clock::time_point now = clock::now();
+	std::vector<const lookup*> failed;
+	for(const auto& pending: lookups_) {
+		lookup& lookup = *pending.second;
+		if(lookup.deadline > now) continue;
+		if(lookup.attempts == maxAttempts) {
+			// Settle for whichever of the two queries has been answered
+			if(!lookup.error && lookup.answers[0].empty() && lookup.answers[1].empty()) {
+				lookup.error = error::Timeout;
+			}
+			failed.push_back(&lookup);
+			continue;
+		}
+
+		++lookup.attempts;
+		lookup.deadline = now + timeout_;
+		for(unsigned int query = 0; query < 2; ++query) {
+			if(!lookup.answered[query]) send(lookup, query);
+		}
+	}
+	for(const resolver::lookup* lookup: failed) finish(lookup);
+}
@@ -0,0 +1,138 @@
+// Copyright (C) 2015 Philip Cronje. All rights reserved.
+#pragma once
+
+#include <chrono>
+#include <coroutine>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <random>
+#include <string>
+#include <system_error>
+#include <unordered_map>
+#include <vector>
+
+#include "epoll.h"
+#include "net.h"
+
+namespace dns {
+	enum class error {
+		NameError = 1,
+		ServerFailure,
+		Refused,
+		Timeout,
+		NoAddresses
+	};
+}
+
+namespace std {
+	template<> struct is_error_code_enum<dns::error> : true_type {};
+}
+
+namespace dns {
+	const std::error_category& category() noexcept;
+	inline std::error_code make_error_code(const error e) noexcept {
+		return std::error_code(static_cast<int>(e), category());
+	}
+
+	/* Asynchronous stub resolver, querying a single name server over UDP from the reactor. Lookups ask for both A
+	 * and AAAA records; their answers, and failures, are cached for as long as the server says they may be. */
+	class resolver : public epoll::handler {
+		public:
+			typedef std::chrono::steady_clock clock;
+			typedef std::function<void(const std::vector<net::address>& addresses, std::error_code error)>
+				completion;
+
+			constexpr static unsigned int maxAttempts = 3;
+			// Bounds on how long answers are cached, whatever the server says
+			constexpr static std::uint32_t maxTtl = 86400;
+			constexpr static std::uint32_t maxNegativeTtl = 300;
+			constexpr static std::uint32_t defaultNegativeTtl = 30;
+
+		private:
+			struct cached {
+				std::vector<net::address> addresses;
+				std::error_code error;
+				clock::time_point expiry;
+			};
+
+			struct lookup {
+				std::string host;
+				std::vector<completion> completions;
+				// IPv4 and IPv6 answers, kept apart so that they can be ordered
+				std::vector<net::address> answers[2];
+				std::error_code error;
+				std::uint32_t ttl = maxTtl;
+				// How long a failure may be cached, from the SOA record that comes with it
+				std::uint32_t negativeTtl = defaultNegativeTtl;
+				std::uint16_t ids[2];
+				bool answered[2] = { false, false };
+				unsigned int attempts = 0;
+				clock::time_point deadline;
+			};
+
+			const int fd_;
+			const std::chrono::milliseconds timeout_;
+			std::unordered_map<std::string, cached> cache_;
+			std::unordered_map<std::string, std::unique_ptr<lookup>> lookups_;
+			std::unordered_map<std::uint16_t, lookup*> queries_;
+			std::mt19937 random_;
+
+			void send(lookup& lookup, unsigned int query);
+			void receive(const std::uint8_t* message, std::size_t size);
+			/* Completes a lookup, caching its answer. */
+			void finish(const lookup* finished);
+
+		public:
+			resolver(const epoll& epoll, const net::address& nameServer,
+					std::chrono::milliseconds timeout = std::chrono::seconds(1));
+			resolver(const resolver&) = delete;
+			~resolver() noexcept;
+
+			/* The first name server in /etc/resolv.conf, or the local host if there is none. */
+			static net::address systemNameServer();
+
+			/* Looks up the addresses of host, IPv4 first. The completion is called straight away if the host is
+			 * numeric or its answer is cached, and otherwise from the reactor once the server has answered. */
+			void resolve(const std::string& host, completion completion);
+
+			/* Retries queries whose answers are overdue, and fails those out of attempts. Call it regularly. */
+			void expire();
+
+			std::size_t pending() const noexcept { return lookups_.size(); }
+
+			void ready(std::uint32_t events) override;
+	};
+
+	/* Awaits the addresses of a host, for a coroutine to use in place of a completion, throwing std::system_error if
+	 * they cannot be had. A numeric or cached host is answered without suspending. */
+	class resolution {
+		resolver& resolver_;
+		const std::string host_;
+		std::vector<net::address> addresses_;
+		std::error_code error_;
+		bool answered_ = false;
+		std::coroutine_handle<> waiting_;
+
+		public:
+			resolution(resolver& resolver, std::string host) : resolver_(resolver), host_(std::move(host)) {}
+			resolution(const resolution&) = delete;
+
+			bool await_ready() const noexcept { return false; }
+			bool await_suspend(const std::coroutine_handle<> waiting) {
+				resolver_.resolve(host_, [this](const std::vector<net::address>& addresses, const std::error_code error) {
+					addresses_ = addresses;
+					error_ = error;
+					answered_ = true;
+					if(waiting_) waiting_.resume();
+				});
+				if(answered_) return false;
+				waiting_ = waiting;
+				return true;
+			}
+			std::vector<net::address> await_resume() {
+				if(error_) throw std::system_error(error_, "Failed to resolve " + host_);
+				return std::move(addresses_);
+			}
+	};
+}
@@ -1,52 +1,187 @@
 // Copyright (C) 2015 Philip Cronje. All rights reserved.
 #pragma once
 
+#include <array>
 #include <chrono>
+#include <cstdint>
+#include <ctime>
+#include <functional>
 #include <system_error>
+#include <utility>
 
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
 #include <unistd.h>
 
 class epoll {
 	const int fd_;
 
 	public:
-		epoll() : fd_(epoll_create1(0)) {
+		/* A periodic timer on the monotonic clock. Its deadlines are absolute, so time spent handling one expiry
+		 * does not push back the next, and expiries that pass without being read are counted as missed. The first
+		 * expiry may be put off by a delay, shifting every later one with it. */
+		class timer {
+			const int fd_;
+			unsigned long long missed_ = 0;
+			// The first deadline and the period, on the monotonic clock, and the number of deadlines that have passed
+			std::chrono::nanoseconds first_;
+			std::chrono::nanoseconds interval_;
+			unsigned long long expired_ = 0;
+
+			static std::chrono::nanoseconds now() noexcept {
+				timespec now;
+				clock_gettime(CLOCK_MONOTONIC, &now);
+				return std::chrono::seconds(now.tv_sec) + std::chrono::nanoseconds(now.tv_nsec);
+			}
+
+			public:
+				template<typename D, typename E = std::chrono::nanoseconds>
+				explicit timer(const D& period, const E& delay = E::zero())
+						: fd_(timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) {
+					if(fd_ == -1) throw std::system_error(errno, std::system_category(), "Failed to create timer");
+
+					interval_ = std::chrono::duration_cast<std::chrono::nanoseconds>(period);
+					first_ = now() + interval_ + std::chrono::duration_cast<std::chrono::nanoseconds>(delay);
+					itimerspec spec;
+					spec.it_interval.tv_sec = interval_.count() / 1000000000;
+					spec.it_interval.tv_nsec = interval_.count() % 1000000000;
+					spec.it_value.tv_sec = first_.count() / 1000000000;
+					spec.it_value.tv_nsec = first_.count() % 1000000000;
+					if(timerfd_settime(fd_, TFD_TIMER_ABSTIME, &spec, nullptr) == -1) {
+						const int error = errno;
+						close(fd_);
+						throw std::system_error(error, std::system_category(), "Failed to arm timer");
+					}
+				}
+				timer(const timer&) = delete;
+				~timer() noexcept { close(fd_); }
+
+				operator int() const noexcept { return fd_; }
+
+				/* Returns the number of times the timer has expired since this was last called, which is zero if it
+				 * has not. Every expiry beyond the first is added to the missed count. */
+				unsigned long long expirations() {
+					std::uint64_t expirations;
+					if(read(fd_, &expirations, sizeof(expirations)) == -1) {
+						if(errno == EAGAIN) return 0;
+						throw std::system_error(errno, std::system_category(), "Failed to read timer");
+					}
+					if(expirations > 1) missed_ += expirations - 1;
+					expired_ += expirations;
+					return expirations;
+				}
+
+				unsigned long long missed() const noexcept { return missed_; }
+
+				/* How long ago the latest deadline read by expirations() passed, which is how late its expiry is being
+				 * handled. */
+				std::chrono::nanoseconds lateness() const noexcept {
+					if(expired_ == 0) return std::chrono::nanoseconds::zero();
+					return now() - (first_ + interval_ * (expired_ - 1));
+				}
+		};
+
+		/* A counter that one thread can bump to wake another waiting on it in epoll. */
+		class event {
+			const int fd_;
+
+			public:
+				event() : fd_(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) {
+					if(fd_ == -1) throw std::system_error(errno, std::system_category(), "Failed to create event");
+				}
+				event(const event&) = delete;
+				~event() noexcept { close(fd_); }
+
+				operator int() const noexcept { return fd_; }
+
+				void notify() const {
+					const std::uint64_t one = 1;
+					if(write(fd_, &one, sizeof(one)) == -1) {
+						throw std::system_error(errno, std::system_category(), "Failed to signal event");
+					}
+				}
+
+				/* Returns the number of notifications since this was last called, and resets it to zero. */
+				unsigned long long consume() const {
+					std::uint64_t count;
+					if(read(fd_, &count, sizeof(count)) == -1) {
+						if(errno == EAGAIN) return 0;
+						throw std::system_error(errno, std::system_category(), "Failed to read event");
+					}
+					return count;
+				}
+		};
+
+		/* Receives the events reported for a file descriptor, and must stay alive for as long as the descriptor is
+		 * registered. */
+		class handler {
+			public:
+				virtual ~handler() = default;
+				virtual void ready(std::uint32_t events) = 0;
+		};
+
+		class callback : public handler {
+			const std::function<void(std::uint32_t)> function_;
+
+			public:
+				explicit callback(std::function<void(std::uint32_t)> function) : function_(std::move(function)) {}
+				void ready(const std::uint32_t events) override { function_(events); }
+		};
+
+		constexpr static unsigned int maxEvents = 64;
+
+		epoll() : fd_(epoll_create1(EPOLL_CLOEXEC)) {
 			if(fd_ == -1) throw std::system_error(errno, std::system_category(),
 					"Failed to create epoll file descriptor");
 		}
+		epoll(const epoll&) = delete;
 		~epoll() noexcept { close(fd_); }
 
 		operator int() const noexcept { return fd_; }
 
-		const epoll& operator+=(const int fd) const {
-			epoll_event event { EPOLLIN | EPOLLOUT | EPOLLET, reinterpret_cast<void*>(fd) };
-			const int rc = epoll_ctl(fd_, EPOLL_CTL_ADD, fd, &event);
-			if(rc == -1) {
-				throw std::system_error(errno, std::system_category(),
-						"Failed to register file descriptor with epoll");
-			}
-			return *this;
+		void add(const int fd, handler& handler, const std::uint32_t events) const {
+			control(EPOLL_CTL_ADD, fd, &handler, events, "Failed to register file descriptor with epoll");
 		}
 
-		const epoll& operator-=(const int fd) const {
-			const int rc = epoll_ctl(fd_, EPOLL_CTL_DEL, fd, nullptr);
-			if(rc == -1) {
+		/* Replaces the interest mask and handler of a registered file descriptor. */
+		void modify(const int fd, handler& handler, const std::uint32_t events) const {
+			control(EPOLL_CTL_MOD, fd, &handler, events, "Failed to modify epoll registration");
+		}
+
+		void remove(const int fd) const {
+			if(epoll_ctl(fd_, EPOLL_CTL_DEL, fd, nullptr) == -1) {
 				throw std::system_error(errno, std::system_category(), "Failed to remove file descriptor from epoll");
 			}
-			return *this;
 		}
 
+		/* Waits for up to maxEvents events and hands each to the handler of its file descriptor. Returns the number
+		 * of events dispatched, which is zero on timeout or if the wait was interrupted by a signal. */
 		template<typename D>
-		bool wait(epoll_event& event, const D& timeout) const {
-			const int rc = epoll_wait(fd_, &event, 1,
-					std::chrono::duration_cast<std::chrono::milliseconds>(timeout).count());
-			if((rc == 0) || (errno == EINTR)) {
-				return false;
-			} else if(rc == -1) {
+		unsigned int dispatch(const D& timeout) {
+			return wait(static_cast<int>(std::chrono::duration_cast<std::chrono::milliseconds>(timeout).count()));
+		}
+
+		unsigned int dispatch() { return wait(-1); }
+
+	private:
+		std::array<epoll_event, maxEvents> events_;
+
+		void control(const int operation, const int fd, handler* handler, const std::uint32_t events,
+				const char* what) const {
+			epoll_event event { events, { handler } };
+			if(epoll_ctl(fd_, operation, fd, &event) == -1) {
+				throw std::system_error(errno, std::system_category(), what);
+			}
+		}
+
+		unsigned int wait(const int timeout) {
+			const int rc = epoll_wait(fd_, events_.data(), events_.size(), timeout);
+			if(rc == -1) {
+				if(errno == EINTR) return 0;
 				throw std::system_error(errno, std::system_category(), "Failed to poll I/O events");
-			} else {
-				return true;
 			}
+			for(int i = 0; i < rc; ++i) static_cast<handler*>(events_[i].data.ptr)->ready(events_[i].events);
+			return rc;
 		}
 };
@@ -0,0 +1,44 @@
+// Copyright (C) 2015 Philip Cronje. All rights reserved.
+#pragma once
+
+#include <algorithm>
+#include <stdexcept>
+
+#include <zlib.h>
+
+#include "util.h"
+
+namespace gzip {
+	/* Compresses whole messages into gzip streams. The deflate state is allocated once and reset between messages, so
+	 * that compressing a message costs no allocations beyond growing the output buffer. */
+	class deflater {
+		z_stream stream_ {};
+
+		public:
+			explicit deflater(const int level = Z_DEFAULT_COMPRESSION) {
+				// A window of 2^15 bytes, with a gzip header and trailer rather than a zlib one
+				if(deflateInit2(&stream_, level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+					throw std::runtime_error("Failed to initialise deflate context");
+				}
+			}
+			deflater(const deflater&) = delete;
+			~deflater() { deflateEnd(&stream_); }
+
+			/* Appends the gzip stream of the input to output. */
+			void compress(const void* input, const size_t size, util::buffer& output) {
+				if(deflateReset(&stream_) != Z_OK) throw std::runtime_error("Failed to reset deflate context");
+				stream_.next_in = static_cast<Bytef*>(const_cast<void*>(input));
+				stream_.avail_in = size;
+				for(;;) {
+					// The bound holds for the whole stream, so a single pass is the rule
+					const size_t room = std::max<size_t>(deflateBound(&stream_, stream_.avail_in), 64);
+					stream_.next_out = output.reserve(room);
+					stream_.avail_out = room;
+					const int rc = deflate(&stream_, Z_FINISH);
+					output.extend(room - stream_.avail_out);
+					if(rc == Z_STREAM_END) return;
+					if((rc != Z_OK) && (rc != Z_BUF_ERROR)) throw std::runtime_error("Failed to compress message");
+				}
+			}
+	};
+}
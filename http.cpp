@@ -0,0 +1,202 @@
+// Copyright (C) 2015 Philip Cronje. All rights reserved.
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include <strings.h>
+
+#include "http.h"
+
+namespace {
+	// Status lines and headers are short; anything longer is not a response we can handle
+	constexpr std::size_t maxLineLength = 8192;
+
+	bool headerNamed(const std::string& line, const std::size_t colon, const char* name) {
+		return (colon == std::strlen(name)) && (strncasecmp(line.data(), name, colon) == 0);
+	}
+
+	bool containsToken(const std::string& line, const std::size_t from, const char* token) {
+		const std::size_t length = std::strlen(token);
+		for(std::size_t i = from; i + length <= line.size(); ++i) {
+			if(strncasecmp(line.data() + i, token, length) == 0) return true;
+		}
+		return false;
+	}
+
+	/* Parses digits in the given base, failing if there are none or the value would overflow. */
+	unsigned long long parseNumber(const char* begin, const char* end, const unsigned int base) {
+		unsigned long long value = 0;
+		const char* p = begin;
+		for(; p != end; ++p) {
+			unsigned int digit;
+			if((*p >= '0') && (*p <= '9')) digit = *p - '0';
+			else if((base == 16) && (*p >= 'a') && (*p <= 'f')) digit = *p - 'a' + 10;
+			else if((base == 16) && (*p >= 'A') && (*p <= 'F')) digit = *p - 'A' + 10;
+			else break;
+			if(value > (~0ULL - digit) / base) throw std::runtime_error("HTTP length overflow");
+			value = value * base + digit;
+		}
+		if(p == begin) throw std::runtime_error("Malformed HTTP length");
+		return value;
+	}
+}
+
+bool http::responseParser::readLine(const char*& data, const char* end) {
+	const char* newline = static_cast<const char*>(std::memchr(data, '\n', end - data));
+	const char* lineEnd = (newline != nullptr) ? newline : end;
+	if(line_.size() + (lineEnd - data) > maxLineLength) throw std::runtime_error("HTTP response line too long");
+	line_.append(data, lineEnd);
+	if(newline == nullptr) {
+		data = end;
+		return false;
+	}
+	data = newline + 1;
+	if(!line_.empty() && (line_.back() == '\r')) line_.pop_back();
+	return true;
+}
+
+void http::responseParser::statusLine() {
+	// HTTP/1.x SP 3DIGIT SP reason-phrase
+	if((line_.size() < 12) || (line_.compare(0, 7, "HTTP/1.") != 0) || (line_[8] != ' ')) {
+		throw std::runtime_error("Malformed HTTP status line");
+	}
+	response_ = response();
+	response_.status = parseNumber(line_.data() + 9, line_.data() + 12, 10);
+	response_.keepAlive = line_[7] != '0';
+	chunked_ = false;
+	hasContentLength_ = false;
+	remaining_ = 0;
+}
+
+void http::responseParser::header() {
+	const std::size_t colon = line_.find(':');
+	if(colon == std::string::npos) throw std::runtime_error("Malformed HTTP header");
+	std::size_t value = colon + 1;
+	while((value < line_.size()) && ((line_[value] == ' ') || (line_[value] == '\t'))) ++value;
+
+	if(headerNamed(line_, colon, "content-length")) {
+		remaining_ = parseNumber(line_.data() + value, line_.data() + line_.size(), 10);
+		hasContentLength_ = true;
+	} else if(headerNamed(line_, colon, "transfer-encoding")) {
+		chunked_ = containsToken(line_, value, "chunked");
+	} else if(headerNamed(line_, colon, "connection")) {
+		if(containsToken(line_, value, "close")) response_.keepAlive = false;
+		else if(containsToken(line_, value, "keep-alive")) response_.keepAlive = true;
+	}
+}
+
+void http::responseParser::headersComplete(const responseHandler& handler) {
+	if((response_.status < 200) || (response_.status == 204) || (response_.status == 304)) {
+		// Interim responses precede the real one; the others never have a body
+		if(response_.status < 200) state_ = StatusLine;
+		else complete(handler);
+	} else if(chunked_) {
+		state_ = ChunkSize;
+	} else if(hasContentLength_) {
+		if(remaining_ == 0) complete(handler);
+		else state_ = Body;
+	} else {
+		response_.keepAlive = false;
+		state_ = UntilClose;
+	}
+}
+
+void http::responseParser::complete(const responseHandler& handler) {
+	state_ = StatusLine;
+	handler(response_);
+}
+
+void http::responseParser::feed(const char* data, const std::size_t size, const responseHandler& handler) {
+	const char* const end = data + size;
+	while(data != end) {
+		switch(state_) {
+			case StatusLine:
+				if(!readLine(data, end)) break;
+				// Tolerate blank lines between responses
+				if(!line_.empty()) {
+					statusLine();
+					state_ = Headers;
+				}
+				line_.clear();
+				break;
+			case Headers:
+				if(!readLine(data, end)) break;
+				if(line_.empty()) headersComplete(handler);
+				else header();
+				line_.clear();
+				break;
+			case Body:
+			case ChunkData: {
+				const std::size_t n = std::min<unsigned long long>(remaining_, end - data);
+				response_.body.append(data, n);
+				data += n;
+				if((remaining_ -= n) != 0) break;
+				if(state_ == Body) complete(handler);
+				else state_ = ChunkDataEnd;
+				break;
+			}
+			case ChunkDataEnd:
+				if(!readLine(data, end)) break;
+				if(!line_.empty()) throw std::runtime_error("Malformed HTTP chunk");
+				state_ = ChunkSize;
+				break;
+			case ChunkSize:
+				if(!readLine(data, end)) break;
+				// Chunk extensions follow a semicolon and are ignored
+				remaining_ = parseNumber(line_.data(), line_.data() + line_.size(), 16);
+				line_.clear();
+				state_ = (remaining_ != 0) ? ChunkData : Trailers;
+				break;
+			case Trailers:
+				if(!readLine(data, end)) break;
+				if(line_.empty()) complete(handler);
+				line_.clear();
+				break;
+			case UntilClose:
+				response_.body.append(data, end);
+				data = end;
+				break;
+		}
+	}
+}
+
+bool http::responseParser::close(const responseHandler& handler) {
+	if(state_ == UntilClose) {
+		complete(handler);
+		return true;
+	}
+	const bool wasIdle = idle();
+	reset();
+	return wasIdle;
+}
+
+void http::responseParser::reset() {
+	state_ = StatusLine;
+	line_.clear();
+}
+
+http::client::client() : responseHandler_([this](response& response) {
+			if(!response.keepAlive) closing_ = true;
+			if(inFlight_.empty()) throw std::runtime_error("Unsolicited HTTP response");
+			const completion completion = std::move(inFlight_.front());
+			inFlight_.pop_front();
+			completion(response);
+		}) {}
+
+void http::client::enqueue(const util::buffer& request, completion completion) {
+	if(!outbound_) outbound_.clear();
+	outbound_.append(request.data(), request.size());
+	inFlight_.push_back(std::move(completion));
+}
+
+void http::client::disconnected() {
+	parser_.close(responseHandler_);
+	const response failed;
+	while(!inFlight_.empty()) {
+		const completion completion = std::move(inFlight_.front());
+		inFlight_.pop_front();
+		completion(failed);
+	}
+	outbound_.clear();
+	closing_ = false;
+}
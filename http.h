@@ -0,0 +1,101 @@
+// Copyright (C) 2015 Philip Cronje. All rights reserved.
+#pragma once
+
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <string>
+
+#include "util.h"
+
+namespace http {
+	struct response {
+		// Zero if the connection was lost before the response was complete
+		unsigned int status = 0;
+		bool keepAlive = true;
+		std::string body;
+
+		bool successful() const noexcept { return (status >= 200) && (status < 300); }
+	};
+
+	/* Incremental HTTP/1.1 response parser. Input may be split anywhere, and may hold several pipelined responses;
+	 * each is handed to the handler as soon as its last byte has been fed. Interim (1xx) responses are skipped. */
+	class responseParser {
+		public:
+			typedef std::function<void(response&)> responseHandler;
+
+		private:
+			enum state {
+				StatusLine,
+				Headers,
+				Body,
+				ChunkSize,
+				ChunkData,
+				ChunkDataEnd,
+				Trailers,
+				UntilClose
+			};
+
+			state state_ = StatusLine;
+			std::string line_;
+			response response_;
+			bool chunked_ = false;
+			bool hasContentLength_ = false;
+			unsigned long long remaining_ = 0;
+
+			/* Accumulates a line, returning true once it is complete (without its line terminator). */
+			bool readLine(const char*& data, const char* end);
+			void statusLine();
+			void header();
+			void headersComplete(const responseHandler& handler);
+			void complete(const responseHandler& handler);
+
+		public:
+			responseParser() { line_.reserve(256); }
+
+			void feed(const char* data, std::size_t size, const responseHandler& handler);
+
+			/* Tells the parser that the connection has been closed, which completes a response delimited by the
+			 * close. Returns false if a response was left incomplete. */
+			bool close(const responseHandler& handler);
+
+			/* Whether the parser is between responses. */
+			bool idle() const noexcept { return (state_ == StatusLine) && line_.empty(); }
+
+			void reset();
+	};
+
+	/* Queues requests for one persistent connection and matches responses to them in order, so that requests can
+	 * be pipelined or sent back-to-back without waiting for each response. */
+	class client {
+		public:
+			typedef std::function<void(const response&)> completion;
+
+		private:
+			util::buffer outbound_;
+			std::deque<completion> inFlight_;
+			responseParser parser_;
+			const responseParser::responseHandler responseHandler_;
+			bool closing_ = false;
+
+		public:
+			client();
+			client(const client&) = delete;
+
+			/* Queues a copy of a complete request; completion is called with its response. */
+			void enqueue(const util::buffer& request, completion completion);
+
+			/* Request bytes that have not yet been written to the connection. */
+			util::buffer& outbound() noexcept { return outbound_; }
+			std::size_t inFlight() const noexcept { return inFlight_.size(); }
+
+			/* Whether the server asked for the connection to be closed once its response was complete. */
+			bool closing() const noexcept { return closing_; }
+
+			void receive(const char* data, const std::size_t size) { parser_.feed(data, size, responseHandler_); }
+
+			/* Handles the connection closing: outstanding requests fail, and queued request bytes are discarded so
+			 * that the next connection starts on a request boundary. */
+			void disconnected();
+	};
+}
@@ -1,77 +1,168 @@
 // Copyright (C) 2015 Philip Cronje. All rights reserved.
-#include <netdb.h>
+#include <algorithm>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
 
 #include "net.h"
 
-namespace {
-	struct getaddrinfoCategory_ : public std::error_category {
-		const char* name() const noexcept override { return "getaddrinfo"; }
-		std::string message(int code) const noexcept override { return gai_strerror(code); }
-	};
+void net::address::port(const std::uint16_t port) noexcept {
+	if(family() == AF_INET) {
+		reinterpret_cast<sockaddr_in&>(storage).sin_port = htons(port);
+	} else if(family() == AF_INET6) {
+		reinterpret_cast<sockaddr_in6&>(storage).sin6_port = htons(port);
+	}
+}
 
-	getaddrinfoCategory_ getaddrinfoCategory;
+std::string net::address::toString() const {
+	char text[INET6_ADDRSTRLEN];
+	const void* data = (family() == AF_INET)
+		? static_cast<const void*>(&reinterpret_cast<const sockaddr_in&>(storage).sin_addr)
+		: static_cast<const void*>(&reinterpret_cast<const sockaddr_in6&>(storage).sin6_addr);
+	return (inet_ntop(family(), data, text, sizeof(text)) != nullptr) ? text : "?";
 }
 
-void net::socket::connect(const char* hostName, const int port, const epoll& epoll) {
-	const addrinfo hint {
-		AI_NUMERICSERV | AI_V4MAPPED | AI_ADDRCONFIG, AF_UNSPEC, SOCK_STREAM, 0/*ai_protocol*/,
-		0, nullptr, nullptr, nullptr
-	};
-
-	addrinfo* addresses;
-	int rc = getaddrinfo(hostName, std::to_string(port).c_str(), &hint, &addresses);
-	if(rc != 0) {
-		if(rc == EAI_SYSTEM) {
-			throw std::system_error(errno, std::system_category(), "Failed to resolve host");
-		} else {
-			throw std::system_error(rc, getaddrinfoCategory, "Failed to resolve host");
-		}
+bool net::address::parse(const std::string& text, address& address) noexcept {
+	address = net::address();
+	sockaddr_in& in = reinterpret_cast<sockaddr_in&>(address.storage);
+	sockaddr_in6& in6 = reinterpret_cast<sockaddr_in6&>(address.storage);
+	if(inet_pton(AF_INET, text.c_str(), &in.sin_addr) == 1) {
+		in.sin_family = AF_INET;
+		address.length = sizeof(in);
+	} else if(inet_pton(AF_INET6, text.c_str(), &in6.sin6_addr) == 1) {
+		in6.sin6_family = AF_INET6;
+		address.length = sizeof(in6);
+	} else {
+		return false;
 	}
+	return true;
+}
 
-	int family;
-	for(addrinfo* address = addresses; address != nullptr; address = address->ai_next) {
-		if((fd_ != -1) && (family != address->ai_family)) {
-			close(fd_);
-			fd_ = -1;
-		}
+net::socket::socket() : attemptTimerHandler_([this](std::uint32_t) {
+			if(!attemptTimer_ || (attemptTimer_->expirations() == 0)) return;
+			// Give up on waiting for the attempts under way, without abandoning them
+			if(!startAttempt()) attemptTimer_.reset();
+		}) {}
 
-		if(fd_ == -1) {
-			fd_ = ::socket(address->ai_family, address->ai_socktype | SOCK_NONBLOCK, address->ai_protocol);
-			if(fd_ == -1) {
-				freeaddrinfo(addresses);
-				throw std::system_error(errno, std::system_category(), "Failed to create socket");
-			}
-		}
+void net::socket::connect(const std::vector<address>& addresses, const std::uint16_t port, const epoll& epoll,
+		epoll::handler& handler) {
+	disconnect();
+	epoll_ = &epoll;
+	handler_ = &handler;
+	error_ = EDESTADDRREQ;
+
+	// Interleave the address families, starting with the preferred one
+	std::vector<address> preferred, other;
+	for(const address& address: addresses) {
+		(address.family() == preferredFamily_ ? preferred : other).push_back(address);
+		(address.family() == preferredFamily_ ? preferred : other).back().port(port);
+	}
+	candidates_.clear();
+	for(std::size_t i = 0; i < std::max(preferred.size(), other.size()); ++i) {
+		if(i < preferred.size()) candidates_.push_back(preferred[i]);
+		if(i < other.size()) candidates_.push_back(other[i]);
+	}
+	nextCandidate_ = 0;
+
+	connecting_ = true;
+	if(!startAttempt()) {
+		if(connected_) return;
+		connecting_ = false;
+		throw std::system_error(error_, std::system_category(), "Failed to connect");
+	}
+	armAttemptTimer();
+}
+
+void net::socket::armAttemptTimer() {
+	attemptTimer_.reset();
+	if(nextCandidate_ == candidates_.size()) return;
+	attemptTimer_.reset(new epoll::timer(attemptDelay));
+	epoll_->add(*attemptTimer_, attemptTimerHandler_, EPOLLIN);
+}
+
+bool net::socket::startAttempt() {
+	while(nextCandidate_ < candidates_.size()) {
+		const address& address = candidates_[nextCandidate_++];
+		const int fd = ::socket(address.family(), SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		if(fd == -1) throw std::system_error(errno, std::system_category(), "Failed to create socket");
+		auto spare = std::find_if(attempts_.begin(), attempts_.end(),
+				[](const std::unique_ptr<net::socket::attempt>& attempt) { return attempt->fd == -1; });
+		if(spare == attempts_.end()) spare = attempts_.emplace(spare, new attempt(*this));
+		attempt& attempt = **spare;
+		attempt.fd = fd;
+		attempt.family = address.family();
 
-		epoll += fd_;
-		rc = ::connect(fd_, address->ai_addr, address->ai_addrlen);
-		if(rc == 0) {
-			connecting_ = false;
-			connected_ = true;
-			break;
+		if(::connect(fd, reinterpret_cast<const sockaddr*>(&address.storage), address.length) == 0) {
+			epoll_->add(fd, attempt, EPOLLOUT);
+			win(attempt);
+			return false;
 		} else if(errno == EINPROGRESS) {
-			connecting_ = true;
-			connected_ = false;
-			break;
-		} else {
-			epoll -= fd_;
+			epoll_->add(fd, attempt, EPOLLOUT);
+			return true;
 		}
+		error_ = errno;
+		::close(attempt.fd);
+		attempt.fd = -1;
 	}
-	freeaddrinfo(addresses);
+	return false;
 }
 
-void net::socket::completeConnect() {
+void net::socket::attemptReady(attempt& attempt, std::uint32_t) {
+	if(attempt.fd == -1) return;
+
 	int value = 0;
-	socklen_t length = 0;
-	const int rc = getsockopt(fd_, SOL_SOCKET, SO_ERROR, &value, &length);
-	if(rc == -1) {
-		throw std::system_error(errno, std::system_category(), "Failed to get socket error code");
+	socklen_t length = sizeof(value);
+	if(getsockopt(attempt.fd, SOL_SOCKET, SO_ERROR, &value, &length) == -1) value = errno;
+	if(value == 0) {
+		// The event may have been meant for an earlier attempt that this one has replaced
+		sockaddr_storage peer;
+		socklen_t peerLength = sizeof(peer);
+		if(getpeername(attempt.fd, reinterpret_cast<sockaddr*>(&peer), &peerLength) == 0) win(attempt);
+		return;
 	}
 
-	if(value == 0) {
-		connecting_ = false;
-		connected_ = true;
-	} else {
-		throw std::system_error(value, std::system_category(), "Asynchronous connection failed");
+	// A failed attempt makes way for the next straight away
+	error_ = value;
+	::close(attempt.fd);
+	attempt.fd = -1;
+	if(startAttempt()) {
+		armAttemptTimer();
+		return;
+	} else if(connected_) {
+		return;
+	}
+	for(const std::unique_ptr<net::socket::attempt>& other: attempts_) {
+		if(other->fd != -1) return;
 	}
+
+	connecting_ = false;
+	attemptTimer_.reset();
+	handler_->ready(EPOLLERR);
+}
+
+void net::socket::win(attempt& attempt) {
+	fd_ = attempt.fd;
+	attempt.fd = -1;
+	preferredFamily_ = attempt.family;
+	abandonAttempts();
+	error_ = 0;
+	connecting_ = false;
+	connected_ = true;
+	// Modifying the registration re-arms it, so the handler hears that the socket is writable
+	epoll_->modify(fd_, *handler_, EPOLLIN | EPOLLOUT | EPOLLET);
+}
+
+void net::socket::abandonAttempts() noexcept {
+	for(const std::unique_ptr<attempt>& attempt: attempts_) {
+		if(attempt->fd != -1) ::close(attempt->fd);
+		attempt->fd = -1;
+	}
+	attemptTimer_.reset();
+}
+
+void net::socket::disconnect() noexcept {
+	abandonAttempts();
+	if(fd_ != -1) ::close(fd_);
+	fd_ = -1;
+	connected_ = connecting_ = readable_ = writable_ = false;
 }
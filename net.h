@@ -1,37 +1,112 @@
 // Copyright (C) 2015 Philip Cronje. All rights reserved.
 #pragma once
 
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <sys/socket.h>
 #include <unistd.h>
 
 #include "epoll.h"
 
 namespace net {
+	/* An IPv4 or IPv6 socket address. */
+	struct address {
+		sockaddr_storage storage {};
+		socklen_t length = 0;
+
+		int family() const noexcept { return storage.ss_family; }
+		void port(std::uint16_t port) noexcept;
+		std::string toString() const;
+
+		/* Parses a numeric IPv4 or IPv6 address, returning false if the text is not one. */
+		static bool parse(const std::string& text, address& address) noexcept;
+	};
+
+	/* A TCP connection, registered with epoll. Connecting races staggered attempts to the candidate addresses in the
+	 * manner of RFC 8305 ("Happy Eyeballs"): attempts alternate between address families, starting with the family
+	 * that won last time, a new attempt starts whenever the previous one fails or has not completed within
+	 * attemptDelay, and the first to complete is kept. */
 	class socket {
-		bool connected_ = false;
-		bool connecting_ = false;
-		bool readable_ = false;
-		bool writable_ = false;
-		int fd_ = -1;
+		public:
+			constexpr static std::chrono::milliseconds attemptDelay { 250 };
+
+		private:
+			struct attempt : public epoll::handler {
+				socket& owner;
+				int fd = -1;
+				int family = AF_UNSPEC;
+
+				explicit attempt(socket& owner) noexcept : owner(owner) {}
+				~attempt() noexcept { if(fd != -1) ::close(fd); }
+				void ready(const std::uint32_t events) override { owner.attemptReady(*this, events); }
+			};
+
+			bool connected_ = false;
+			bool connecting_ = false;
+			bool readable_ = false;
+			bool writable_ = false;
+			int fd_ = -1;
+			int error_ = 0;
+			int preferredFamily_ = AF_INET6;
+			const epoll* epoll_ = nullptr;
+			epoll::handler* handler_ = nullptr;
+
+			std::vector<address> candidates_;
+			std::size_t nextCandidate_ = 0;
+			/* Attempts are reused rather than released, as epoll may still hold events for those abandoned in the
+			 * middle of a batch. */
+			std::vector<std::unique_ptr<attempt>> attempts_;
+			std::unique_ptr<epoll::timer> attemptTimer_;
+			epoll::callback attemptTimerHandler_;
+
+			/* Starts connecting to the next candidate that can be tried, returning false if there is none left or
+			 * the connection was established at once. */
+			bool startAttempt();
+			void armAttemptTimer();
+			void attemptReady(attempt& attempt, std::uint32_t events);
+			void win(attempt& attempt);
+			void abandonAttempts() noexcept;
 
 		public:
-			socket() = default;
+			socket();
 			socket(const socket&) = delete;
-			~socket() noexcept { if(fd_ != -1) close(fd_); }
+			~socket() noexcept { if(fd_ != -1) ::close(fd_); }
 
 			operator int() const noexcept { return fd_; }
 			bool connected() const noexcept { return connected_; }
 			bool connecting() const noexcept { return connecting_; }
+			/* The error that made the last connection attempt fail, if it did. */
+			int error() const noexcept { return error_; }
+			int preferredFamily() const noexcept { return preferredFamily_; }
 
 			bool readable() const noexcept { return readable_; }
 			void readable(bool readable) noexcept { readable_ = readable; }
 			bool writable() const noexcept { return writable_; }
 			void writable(bool writable) noexcept { writable_ = writable; }
 
-			void connect(const char* hostName, const int port, const epoll& epoll);
-			void connect(const std::string& hostName, const int port, const epoll& epoll) {
-				connect(hostName.c_str(), port, epoll);
-			}
+			/* Starts connecting to the addresses, returning once the first attempt is under way. The handler is
+			 * told of EPOLLOUT once the connection is established, and then of the socket's readiness as usual,
+			 * or of EPOLLERR if every attempt fails. */
+			void connect(const std::vector<address>& addresses, const std::uint16_t port, const epoll& epoll,
+					epoll::handler& handler);
+
+			/* Closes the connection, or abandons connecting, leaving the socket free to connect again. The
+			 * connection is also removed from epoll. */
+			void disconnect() noexcept;
 
-			void completeConnect();
+			/* Takes ownership of a descriptor that is already connected and non-blocking, such as one end of a
+			 * socketpair(), and registers it with epoll like connect() does. */
+			void attach(const int fd, const epoll& epoll, epoll::handler& handler) {
+				epoll.add(fd, handler, EPOLLIN | EPOLLOUT | EPOLLET);
+				fd_ = fd;
+				epoll_ = &epoll;
+				handler_ = &handler;
+				connecting_ = false;
+				connected_ = true;
+			}
 	};
 }
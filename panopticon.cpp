@@ -1,41 +1,53 @@
 // Copyright (C) 2015 Philip Cronje. All rights reserved.
+#include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <csignal>
+#include <cstdint>
+#include <ctime>
 #include <cstdlib>
+#include <exception>
 #include <fstream>
 #include <iostream>
 #include <memory>
+#include <random>
+#include <stdexcept>
 #include <string>
+#include <system_error>
+#include <thread>
 #include <utility>
 #include <vector>
 
+#include <pthread.h>
+#include <sched.h>
 #include <unistd.h>
 
 #include "cloudwatch.h"
+#include "collector.h"
+#include "coroutine.h"
+#include "dns.h"
 #include "epoll.h"
+#include "http.h"
 #include "net.h"
+#include "publisher.h"
+#include "registry.h"
+#include "ring.h"
+#include "sigv4.h"
+#include "spool.h"
 #include "ssl.h"
 #include "stat.h"
+#include "stat-cgroup.h"
 #include "stat-cpu.h"
+#include "stat-disk.h"
+#include "stat-memory.h"
+#include "stat-net.h"
+#include "stat-process.h"
+#include "stream.h"
 
 namespace {
 	volatile std::sig_atomic_t signalStatus = 0;
 	void handleSignal(int signal) { signalStatus = signal; }
 
-	template<typename A>
-	void swapIn(std::pair<A, A>& pair, A&& value) {
-		pair.first = std::move(pair.second);
-		pair.second = std::move(value);
-	}
-
-	template<typename C, typename A>
-	constexpr bool countExceeded(const C count, const A& a) { return a.count >= count; }
-
-	template<typename C, typename A0, typename... AT>
-	constexpr bool countExceeded(const C count, const A0& a0, const AT... at) {
-		return countExceeded(count, a0) || countExceeded(count, at...);
-	}
-
 	template<typename T, typename V>
 	constexpr bool matchesAny(const T& value, const V& v) { return v == value; }
 
@@ -48,6 +60,58 @@ namespace {
 		constexpr static const char* envVarAccessKey = "AWS_ACCESS_KEY_ID";
 		std::string accessKey;
 
+		// Number of busiest cores to report, or all cores individually if perCore is set
+		unsigned int hottestCores = 0;
+		bool perCore = false;
+
+		// Publish the distribution of CPU usage, rather than only its statistics, so that percentiles are available
+		bool distributions = false;
+
+		// Glob patterns choosing the network interfaces to report, and those never to report
+		std::vector<std::string> interfaces;
+		constexpr static const char* defaultIgnoredInterfaces = "lo";
+		std::vector<std::string> ignoredInterfaces { defaultIgnoredInterfaces };
+		bool overrideIgnoredInterfaces = false;
+
+		// Report every cgroup in the cgroup v2 hierarchy
+		bool cgroups = false;
+
+		// Number of busiest and largest processes to report, and threads besides the collecting one reading them
+		unsigned int processes = 0;
+		unsigned int processWorkers = 0;
+
+		// Send request bodies gzip-compressed
+		bool gzip = false;
+
+		// Limits on a single PutMetricData request; a flush is packed into as few requests as these allow
+		constexpr static unsigned int defaultMaxDatums = 1000;
+		unsigned int maxDatums = defaultMaxDatums;
+		constexpr static std::size_t defaultMaxBytes = 1 << 20;
+		std::size_t maxBytes = defaultMaxBytes;
+
+		// How long before each flush to open the CloudWatch connection, if it is not already open
+		std::chrono::seconds prewarm { 0 };
+
+		// Where flushed metrics are kept until CloudWatch has accepted them, and how much of them to keep
+		constexpr static const char* defaultSpoolPath = "panopticon.spool";
+		std::string spoolPath = defaultSpoolPath;
+		constexpr static unsigned int defaultSpoolSize = 16;
+		std::size_t spoolSize = defaultSpoolSize << 20;
+
+		// Requests sent per second at most, which paces the replay of metrics spooled while CloudWatch was unreachable.
+		// It may be fractional, down to one request a minute.
+		constexpr static unsigned int defaultRate = 5;
+		constexpr static double minRate = 1.0 / 60;
+		double rate = defaultRate;
+
+		// CPUs to pin the collecting and shipping threads to, or -1 to leave them to the scheduler
+		int collectorCpu = -1;
+		int shipperCpu = -1;
+
+		// How long to wait, at most, before first sending requests after starting
+		constexpr static unsigned int defaultSpread = 30;
+		std::chrono::milliseconds spread = std::chrono::seconds(defaultSpread);
+
 		constexpr static const char* envVarHostName = "PANOPTICON_CLOUDWATCH_HOST";
 		constexpr static const char* defaultHostName = "monitoring.us-east-1.amazonaws.com";
 		std::string cloudWatchHostName = defaultHostName;
@@ -92,8 +156,34 @@ namespace {
 	void printHelp(const std::string& executable) {
 		std::cout << "Usage: " << executable << " [options]\n\n"
 			"Options:\n"
+			"-c --cores <n|all>\n\tReport the busy percentage of the n busiest cores, or of every core (default: 0)\n"
+			"-d --distributions\n\tPublish CPU usage as distributions, making percentiles available\n"
+			"-g --cgroups\n\tReport the CPU, memory and I/O use of every cgroup under /sys/fs/cgroup (cgroup v2 only)\n"
 			"-H --host <host>\n\tAWS CloudWatch hostname (default: " << arguments::defaultHostName << ")\n"
+			"-i --interfaces <pattern,...>\n\tReport only the network interfaces matching these glob patterns "
+				"(default: all)\n"
+			"-I --ignore-interfaces <pattern,...>\n\tNever report the network interfaces matching these glob patterns "
+				"(default: " << arguments::defaultIgnoredInterfaces << ")\n"
+			"-j --process-workers <n>\n\tRead the processes' statistics on n threads besides the sampling thread "
+				"(default: 0)\n"
+			"-m --max-datums <n>\n\tPut at most n datums in a request (default: " << arguments::defaultMaxDatums << ")\n"
+			"-M --max-bytes <n>\n\tKeep request bodies to at most n bytes before compression (default: "
+				<< arguments::defaultMaxBytes << ")\n"
+			"-n --processes <n>\n\tReport the CPU usage and resident size of the n busiest and largest processes, by name "
+				"(default: 0)\n"
+			"-p --collector-cpu <n>\n\tPin the thread that samples metrics to CPU n\n"
+			"-P --shipper-cpu <n>\n\tPin the thread that sends metrics to CPU n\n"
 			"-r --region <region>\n\tAWS region (default: " << arguments::defaultRegion << ")\n"
+			"-R --rate <n>\n\tSend at most n requests per second, which may be fractional, pacing catching up on "
+				"spooled metrics (default: " << arguments::defaultRate << ")\n"
+			"-s --spool <file>\n\tKeep metrics in this file until CloudWatch accepts them (default: "
+				<< arguments::defaultSpoolPath << ")\n"
+			"-S --spool-size <MiB>\n\tSize of a new spool file; the oldest metrics are dropped once it is full "
+				"(default: " << arguments::defaultSpoolSize << ")\n"
+			"-t --spread <seconds>\n\tWait up to this long, at random, before first sending, so that agents started "
+				"together do not send together (default: " << arguments::defaultSpread << ")\n"
+			"-w --prewarm <seconds>\n\tConnect to CloudWatch this long before each flush, rather than on it\n"
+			"-z --gzip\n\tCompress request bodies, trading CPU time for bytes sent\n"
 			"-h -? --help\n\tPrints this message" << std::endl;
 	}
 
@@ -135,12 +225,56 @@ namespace {
 		bool overrideCloudWatchHostName = false;
 		for(auto it = argv.cbegin(); it != argv.cend(); ++it) {
 			const std::string& argument = *it;
-			if(matchesAny(argument, "-H", "--host") && assertHasOption(argument, it, argv.cend())) {
+			if(matchesAny(argument, "-c", "--cores") && assertHasOption(argument, it, argv.cend())) {
+				if(*it == "all") {
+					arguments.perCore = true;
+				} else {
+					arguments.hottestCores = std::stoul(*it);
+				}
+			} else if(matchesAny(argument, "-d", "--distributions")) {
+				arguments.distributions = true;
+			} else if(matchesAny(argument, "-g", "--cgroups")) {
+				arguments.cgroups = true;
+			} else if(matchesAny(argument, "-H", "--host") && assertHasOption(argument, it, argv.cend())) {
 				arguments.cloudWatchHostName = *it;
 				overrideCloudWatchHostName = true;
+			} else if(matchesAny(argument, "-i", "--interfaces") && assertHasOption(argument, it, argv.cend())) {
+				for(const std::string& pattern: stat::interfacePatterns::split(*it)) {
+					arguments.interfaces.push_back(pattern);
+				}
+			} else if(matchesAny(argument, "-I", "--ignore-interfaces") && assertHasOption(argument, it, argv.cend())) {
+				if(!arguments.overrideIgnoredInterfaces) arguments.ignoredInterfaces.clear();
+				arguments.overrideIgnoredInterfaces = true;
+				for(const std::string& pattern: stat::interfacePatterns::split(*it)) {
+					arguments.ignoredInterfaces.push_back(pattern);
+				}
+			} else if(matchesAny(argument, "-m", "--max-datums") && assertHasOption(argument, it, argv.cend())) {
+				arguments.maxDatums = std::max(1UL, std::stoul(*it));
+			} else if(matchesAny(argument, "-M", "--max-bytes") && assertHasOption(argument, it, argv.cend())) {
+				arguments.maxBytes = std::stoul(*it);
+			} else if(matchesAny(argument, "-n", "--processes") && assertHasOption(argument, it, argv.cend())) {
+				arguments.processes = std::stoul(*it);
+			} else if(matchesAny(argument, "-j", "--process-workers") && assertHasOption(argument, it, argv.cend())) {
+				arguments.processWorkers = std::stoul(*it);
+			} else if(matchesAny(argument, "-p", "--collector-cpu") && assertHasOption(argument, it, argv.cend())) {
+				arguments.collectorCpu = std::stoi(*it);
+			} else if(matchesAny(argument, "-P", "--shipper-cpu") && assertHasOption(argument, it, argv.cend())) {
+				arguments.shipperCpu = std::stoi(*it);
 			} else if(matchesAny(argument, "-r", "--region") && assertHasOption(argument, it, argv.cend())) {
 				arguments.region = *it;
 				overrideRegion = true;
+			} else if(matchesAny(argument, "-R", "--rate") && assertHasOption(argument, it, argv.cend())) {
+				arguments.rate = std::max(arguments::minRate, std::stod(*it));
+			} else if(matchesAny(argument, "-s", "--spool") && assertHasOption(argument, it, argv.cend())) {
+				arguments.spoolPath = *it;
+			} else if(matchesAny(argument, "-S", "--spool-size") && assertHasOption(argument, it, argv.cend())) {
+				arguments.spoolSize = std::stoul(*it) << 20;
+			} else if(matchesAny(argument, "-t", "--spread") && assertHasOption(argument, it, argv.cend())) {
+				arguments.spread = std::chrono::seconds(std::stoul(*it));
+			} else if(matchesAny(argument, "-w", "--prewarm") && assertHasOption(argument, it, argv.cend())) {
+				arguments.prewarm = std::chrono::seconds(std::stoul(*it));
+			} else if(matchesAny(argument, "-z", "--gzip")) {
+				arguments.gzip = true;
 			} else if(matchesAny(argument, "-h", "-?", "--help")) {
 				printHelp(executable);
 				throw argumentsHelp();
@@ -180,92 +314,316 @@ namespace {
 		return localHostName;
 	}
 
+	/* Pins the calling thread to a CPU. */
+	void pinToCpu(const int cpu) {
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+		CPU_SET(cpu, &cpus);
+		const int error = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+		if(error != 0) {
+			throw std::system_error(error, std::system_category(), "Failed to pin thread to CPU " + std::to_string(cpu));
+		}
+	}
+
+	// The form body of a request packed on the collecting thread, for the shipping thread to spool and send
+	struct packedRequest {
+		util::buffer body;
+		std::uint32_t datums = 0;
+	};
+
+	/* What the collecting and shipping threads share. */
+	struct pipeline {
+		// Packed requests one way, and publish latencies the other; whatever is pushed onto a full ring is lost
+		util::ring<packedRequest, 64> requests;
+		util::ring<double, 256> latencies;
+		// Wakes the shipping thread when there are requests to spool, or the connection should be opened early
+		epoll::event ready;
+		std::atomic<bool> prewarmDue { false };
+		// Tells the collecting thread to stop, without waiting for its next tick
+		epoll::event stop;
+	};
+
+	/* The collecting thread: samples on every tick and packs each flush into requests for the shipping thread, until
+	 * told to stop. */
+	void collect(const arguments& arguments, const std::string& localHostName, aws::signer& signer,
+			pipeline& pipeline) {
+		epoll epoll;
+		// Only packs form bodies, which are signed as they are sent, so the signer is never used from this thread
+		aws::cloudwatch::requestBuilder packer(arguments.cloudWatchHostName, signer, "Panopticon");
+
+		// Time from sending a request until CloudWatch has answered it, as measured by the shipping thread
+		stat::eventCollector* publishLatency = new stat::eventCollector("PublishLatency", "Milliseconds",
+				std::chrono::seconds(60));
+		// How late each sampling tick is handled, which is the jitter in when samples are taken
+		stat::eventCollector* sampleLateness = new stat::eventCollector("SampleLateness", "Milliseconds",
+				std::chrono::seconds(60));
+
+		stat::registry registry(std::chrono::seconds(1), [&](const stat::registry::requestTemplates& templates) {
+			unsigned int requests = 0;
+			const unsigned int tooLarge = packer.pack(std::time(nullptr), templates.cbegin(), templates.cend(),
+					arguments.maxDatums, arguments.maxBytes, [&](const util::buffer& body, const std::uint32_t datums) {
+				packedRequest* request = pipeline.requests.claim();
+				if(request == nullptr) {
+					std::cerr << "Dropped " << datums << " datums while the shipping thread is behind" << std::endl;
+					return;
+				}
+				request->body.clear();
+				request->body.append(body.data(), body.size());
+				request->datums = datums;
+				pipeline.requests.publish();
+				++requests;
+			});
+			std::cout << "Flush packed into " << requests << " requests" << std::endl;
+			if(tooLarge != 0) std::cerr << "Dropped " << tooLarge << " datums too large for a request" << std::endl;
+			if(requests != 0) pipeline.ready.notify();
+		});
+		registry.add(std::unique_ptr<stat::collector>(new stat::cpuCollector(arguments.hottestCores, arguments.perCore,
+				arguments.distributions)), { { "Host", localHostName } });
+		registry.add(std::unique_ptr<stat::collector>(new stat::memoryCollector()), { { "Host", localHostName } });
+		registry.add(std::unique_ptr<stat::collector>(new stat::diskCollector()), { { "Host", localHostName } });
+		const stat::interfacePatterns interfaces(arguments.interfaces, arguments.ignoredInterfaces);
+		registry.add(std::unique_ptr<stat::collector>(new stat::interfaceCollector(interfaces)),
+				{ { "Host", localHostName } });
+		registry.add(std::unique_ptr<stat::collector>(new stat::tcpCollector()), { { "Host", localHostName } });
+		if(arguments.processes > 0) {
+			registry.add(std::unique_ptr<stat::collector>(new stat::processCollector(arguments.processes,
+					arguments.processWorkers)), { { "Host", localHostName } });
+		}
+		if(arguments.cgroups) {
+			registry.add(std::unique_ptr<stat::collector>(new stat::cgroupCollector()), { { "Host", localHostName } });
+		}
+		registry.add(std::unique_ptr<stat::collector>(publishLatency), { { "Host", localHostName } });
+		registry.add(std::unique_ptr<stat::collector>(sampleLateness), { { "Host", localHostName } });
+
+		// Agents started together, as a fleet often is, would otherwise flush together for as long as they run
+		std::mt19937 random(std::random_device {}());
+		const std::chrono::milliseconds phase(std::uniform_int_distribution<long>(0, 59999)(random));
+		epoll::timer sampleTimer(registry.tick(), phase);
+		epoll::callback sampleHandler([&](std::uint32_t) {
+			const unsigned long long expirations = sampleTimer.expirations();
+			if(expirations == 0) return;
+			sampleLateness->record(std::chrono::duration<double, std::milli>(sampleTimer.lateness()).count());
+			if(expirations > 1) {
+				std::cerr << "Missed " << (expirations - 1) << " sampling ticks (" << sampleTimer.missed()
+					<< " in total)" << std::endl;
+			}
+			for(double* latency = pipeline.latencies.front(); latency != nullptr; latency = pipeline.latencies.front()) {
+				publishLatency->record(*latency);
+				pipeline.latencies.pop();
+			}
+			registry.advance(expirations);
+			if((arguments.prewarm.count() != 0)
+					&& (registry.tick() * (registry.nextFlush() - registry.wheel().now()) <= arguments.prewarm)
+					&& !pipeline.prewarmDue.exchange(true)) {
+				pipeline.ready.notify();
+			}
+		});
+		epoll.add(sampleTimer, sampleHandler, EPOLLIN);
+
+		bool stopped = false;
+		epoll::callback stopHandler([&stopped](std::uint32_t) { stopped = true; });
+		epoll.add(pipeline.stop, stopHandler, EPOLLIN);
+
+		while(!stopped) epoll.dispatch();
+	}
+
+	/* Sampling and packing run on a collecting thread, and spooling, signing, TLS and socket I/O on the shipping
+	 * thread that main() becomes, so that a slow handshake or a backlog being signed never delays a sample. */
 	void main(const std::string& executable, const argumentsContainer& argv) {
 		const arguments arguments = parseArguments(executable, argv);
 
 		const std::string localHostName = getLocalHostName();
 
 		std::signal(SIGINT, handleSignal);
+		// A peer that has gone away shows up as EPIPE when writing, rather than as a fatal signal
+		std::signal(SIGPIPE, SIG_IGN);
+
+		if(arguments.shipperCpu != -1) pinToCpu(arguments.shipperCpu);
 
 		ssl::library sslLibrary;
 
 		epoll epoll;
 
-		auto cpu = std::make_pair(stat::cpu(), stat::cpu(std::ifstream("/proc/stat")));
-		using cpuAggregation = stat::aggregation<double>;
-		cpuAggregation user, system, ioWait;
-
 		const ssl::context sslContext;
 		sslContext.setDefaultVerifyPaths();
-		std::unique_ptr<ssl::connection> sslConnection;
-
-		util::buffer requestBuffer;
-
-		net::socket socket;
-		while(signalStatus == 0) {
-			using clock = std::chrono::steady_clock;
-			auto now = clock::now();
-			const auto then = now + std::chrono::seconds(1);
-
-			swapIn(cpu, stat::cpu(std::ifstream("/proc/stat")));
-			cpu.second.aggregate(cpu.first, user, system, ioWait);
-
-			if(countExceeded(60, user, system, ioWait)) {
-				requestBuffer = aws::cloudwatch::newPutMetricDataRequest(arguments.cloudWatchHostName,
-						arguments.region, arguments.accessKey, arguments.secretKey, "Panopticon",
-						{ { "Host", localHostName } },
-						{ { "UserCPU", user }, { "SystemCPU", system }, { "IOWaitCPU", ioWait } });
-				std::cout << "Request buffer is " << requestBuffer.size() << " bytes" << std::endl;
-				if(!(socket.connected() || socket.connecting())) {
-					socket.connect(arguments.cloudWatchHostName, 443, epoll);
-					sslConnection.reset(new ssl::connection(sslContext, socket));
-				}
-				user = system = ioWait = cpuAggregation();
-			}
 
-			while(((now = clock::now()) < then) && (signalStatus == 0)) {
-				epoll_event event { 0, nullptr };
-				if(!epoll.wait(event, then - now)
-						&& !socket.readable() && !socket.writable() && !requestBuffer) {
-					continue;
-				}
+		aws::signer signer(arguments.accessKey, arguments.secretKey, arguments.region, "monitoring");
+		aws::cloudwatch::requestBuilder requestBuilder(arguments.cloudWatchHostName, signer, "Panopticon",
+				arguments.gzip);
 
-				if((event.events & EPOLLOUT) != 0) socket.writable(true);
-				if((event.events & EPOLLIN) != 0) socket.readable(true);
+		http::client client;
 
-				std::cout << "SSL state: " << std::hex << SSL_get_state(*sslConnection.get()) << std::dec <<
-					" - Socket state (W/R): " << socket.writable() << "/" << socket.readable() <<
-					" - Request buffer state: " << static_cast<bool>(requestBuffer) << std::endl;
+		pipeline pipeline;
+		std::exception_ptr collectorError;
+		std::atomic<bool> collectorFailed { false };
 
-				if(socket.connecting() && socket.writable()) {
-					socket.completeConnect();
-				} else if(socket.connected()) {
-					if(socket.readable()) sslConnection->readFromSocket();
-					if(socket.writable()) sslConnection->writeToSocket();
+		// Flushed metrics stay in the spool until CloudWatch has accepted them, even across restarts
+		util::spool spool(arguments.spoolPath, arguments.spoolSize);
+		if(spool.records() != 0) {
+			std::cout << "Resuming with " << spool.records() << " spooled requests" << std::endl;
+		}
+		unsigned long long dropped = 0;
+
+		// Below one request a second, the bucket still holds a whole token, or nothing would ever be sent
+		const publisher::options publisherOptions { arguments.rate, std::max(1.0, arguments.rate), 4,
+			std::chrono::seconds(1), std::chrono::minutes(5), 8, arguments.spread };
+		publisher publisher(spool, client,
+			[&](const std::uint8_t* body, const std::size_t size) -> const util::buffer& {
+				return requestBuilder.build(std::time(nullptr), body, size);
+			}, [&](const publisher::outcome outcome, const std::uint32_t datums, const http::response& response,
+					const publisher::clock::duration latency) {
+				// Recorded on the collecting thread, which owns the collector; a full ring loses the latency
+				double* slot = (response.status != 0) ? pipeline.latencies.claim() : nullptr;
+				if(slot != nullptr) {
+					*slot = std::chrono::duration<double, std::milli>(latency).count();
+					pipeline.latencies.publish();
+				}
+				static const char* const outcomes[] = { "succeeded", "will be retried", "failed" };
+				const publisher::totals& totals = publisher.datums();
+				std::cout << "PutMetricData of " << datums << " datums " << outcomes[outcome] << " with status "
+					<< response.status << " (sent/retried/dropped in total: " << totals.sent << "/" << totals.retried
+					<< "/" << totals.dropped << ")" << std::endl;
+				if(!response.successful() && (response.status != 0)) std::cerr << response.body << std::endl;
+			}, publisherOptions, publisher::clock::now(), std::random_device()());
+		const auto backOff = [&] {
+			const auto delay = publisher.connectionFailed(publisher::clock::now());
+			std::cerr << "Backing off for " << std::chrono::duration_cast<std::chrono::milliseconds>(delay).count()
+				<< " ms" << std::endl;
+		};
+		dns::resolver resolver(epoll, dns::resolver::systemNameServer());
+		ssl::stream stream(epoll, sslContext);
+		// Whether a connection should be opened ahead of the next flush, with nothing yet to send
+		bool prewarm = false;
+		// Connects whenever there is something to send, and sends and receives until the connection is closed
+		const auto ship = [&]() -> co::task<void> {
+			for(;;) {
+				while(!client.outbound() && !prewarm) co_await stream.events();
+				prewarm = false;
+
+				try {
+					const std::vector<net::address> addresses =
+						co_await dns::resolution(resolver, arguments.cloudWatchHostName);
+					co_await stream.connect(addresses, 443);
+					co_await stream.handshake();
+				} catch(const std::runtime_error& e) {
+					// Requests are sent again once the backoff allows
+					std::cerr << "Failed to connect to " << arguments.cloudWatchHostName << ": " << e.what() << std::endl;
+					backOff();
+					stream.close();
+					client.disconnected();
+					continue;
 				}
 
-				if(sslConnection->inConnectInit()) {
-					if(!sslConnection->connect()) {
-						continue;
-					}
-
-					ssl::x509 certificate = sslConnection->peerCertificate();
-					if(!certificate) {
-						throw std::logic_error("No peer certificate presented");
-					} else {
-						sslConnection->verifyPeerCertificate();
-						if(!certificate.matchSan(arguments.cloudWatchHostName)) {
-							if(!certificate.matchCommonName(arguments.cloudWatchHostName)) {
-								throw std::logic_error("SAN/CN mismatch");
-							}
+				ssl::x509 certificate = stream.tls()->peerCertificate();
+				if(!certificate) throw std::logic_error("No peer certificate presented");
+				stream.tls()->verifyPeerCertificate();
+				if(!certificate.matchSan(arguments.cloudWatchHostName)
+						&& !certificate.matchCommonName(arguments.cloudWatchHostName)) {
+					throw std::logic_error("SAN/CN mismatch");
+				}
+				std::cout << "TLS handshake complete" << (stream.tls()->resumed() ? " (session resumed)" : "")
+					<< std::endl;
+
+				try {
+					while(stream.open() && !client.closing()) {
+						if(client.outbound()) {
+							co_await stream.writeAll(client.outbound());
+						} else if(client.inFlight() != 0) {
+							const bool received = co_await stream.readResponse(client);
+							if(!received) break;
+						} else {
+							// Idle, until there is more to send or the server closes the connection
+							co_await stream.events();
+							if(stream.socket().readable()) stream.tls()->readFromSocket();
+							stream.tls()->read([&](const char* data, const std::size_t size) {
+								client.receive(data, size);
+							});
 						}
 					}
-				} else if(sslConnection->initFinished()) {
-					if(requestBuffer) sslConnection->write(requestBuffer);
-					sslConnection->read();
+				} catch(const std::runtime_error& e) {
+					std::cerr << "Lost the connection to " << arguments.cloudWatchHostName << ": " << e.what()
+						<< std::endl;
+				}
+				stream.close();
+				client.disconnected();
+			}
+		};
+		// Sends spooled requests, oldest first, as far as the rate limit and any backoff allow
+		const auto drain = [&] {
+			if(publisher.drain(publisher::clock::now()) != 0) stream.wake();
+		};
+
+		epoll::callback requestsHandler([&](std::uint32_t) {
+			pipeline.ready.consume();
+			unsigned int spooled = 0;
+			for(packedRequest* request = pipeline.requests.front(); request != nullptr;
+					request = pipeline.requests.front()) {
+				if(publisher.enqueue(request->body, request->datums)) {
+					++spooled;
+				} else {
+					std::cerr << "Dropped " << request->datums << " datums in a request too large for the spool"
+						<< std::endl;
 				}
+				pipeline.requests.pop();
+			}
+			if(spooled != 0) {
+				std::cout << "Spooled " << spooled << " requests (" << spool.records() << " waiting)" << std::endl;
+			}
+			if(spool.dropped() != dropped) {
+				std::cerr << "Spool is full: dropped " << (spool.dropped() - dropped) << " of the oldest requests"
+					<< std::endl;
+				dropped = spool.dropped();
+			}
+			// A prewarm is a connection attempt like any other, so it waits out a backoff
+			if(pipeline.prewarmDue.exchange(false) && !stream.open()
+					&& (publisher.resumeAt() <= publisher::clock::now())) {
+				prewarm = true;
+				stream.wake();
+			}
+			drain();
+		});
+		epoll.add(pipeline.ready, requestsHandler, EPOLLIN);
+
+		// Paces sending from the spool, and retries once a backoff has passed
+		epoll::timer shipTimer(std::chrono::seconds(1));
+		epoll::callback shipHandler([&](std::uint32_t) {
+			shipTimer.expirations();
+			drain();
+			resolver.expire();
+		});
+		epoll.add(shipTimer, shipHandler, EPOLLIN);
+
+		// The collecting thread leaves SIGINT to this one, whose wait it interrupts
+		sigset_t interrupt, previous;
+		sigemptyset(&interrupt);
+		sigaddset(&interrupt, SIGINT);
+		pthread_sigmask(SIG_BLOCK, &interrupt, &previous);
+		std::thread collector([&] {
+			try {
+				if(arguments.collectorCpu != -1) pinToCpu(arguments.collectorCpu);
+				collect(arguments, localHostName, signer, pipeline);
+			} catch(...) {
+				collectorError = std::current_exception();
+				collectorFailed = true;
+				pipeline.ready.notify();
 			}
+		});
+		pthread_sigmask(SIG_SETMASK, &previous, nullptr);
+
+		co::task<void> shipping = ship();
+		try {
+			shipping.start();
+			while((signalStatus == 0) && !collectorFailed && !shipping.done()) epoll.dispatch();
+		} catch(...) {
+			pipeline.stop.notify();
+			collector.join();
+			throw;
 		}
+		pipeline.stop.notify();
+		collector.join();
+		if(collectorError) std::rethrow_exception(collectorError);
+		// The shipper only finishes by throwing
+		if(shipping.done()) shipping.result();
 	}
 }
 
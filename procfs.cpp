@@ -0,0 +1,64 @@
+// Copyright (C) 2015 Philip Cronje. All rights reserved.
+#include <charconv>
+#include <system_error>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "procfs.h"
+
+procfs::file::file(const char* path, const std::size_t capacity) : fd_(open(path, O_RDONLY | O_CLOEXEC)),
+		buffer_(new char[capacity + 1]), capacity_(capacity) {
+	if(fd_ == -1) throw std::system_error(errno, std::system_category(), std::string("Failed to open ") + path);
+	read();
+}
+
+procfs::file::~file() noexcept { close(fd_); }
+
+void procfs::file::read() {
+	size_ = 0;
+	for(;;) {
+		const ssize_t n = pread(fd_, buffer_.get() + size_, capacity_ - size_, size_);
+		if(n == -1) {
+			if(errno == EINTR) continue;
+			throw std::system_error(errno, std::system_category(), "Failed to read procfs file");
+		} else if(n == 0) {
+			break;
+		}
+
+		size_ += n;
+		if(size_ == capacity_) {
+			// The file has outgrown the buffer; double it and read the remainder
+			std::unique_ptr<char[]> buffer(new char[2 * capacity_ + 1]);
+			std::memcpy(buffer.get(), buffer_.get(), size_);
+			buffer_ = std::move(buffer);
+			capacity_ *= 2;
+		}
+	}
+	buffer_[size_] = '\0';
+}
+
+procfs::directory::directory(const std::string& path) : path_(path),
+		fd_(::open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC)) {
+	if(fd_ == -1) throw std::system_error(errno, std::system_category(), "Failed to open " + path);
+}
+
+procfs::directory::~directory() noexcept { close(fd_); }
+
+void procfs::directory::listNumbered(std::vector<int>& numbers) const {
+	DIR* listing = opendir(path_.c_str());
+	if(listing == nullptr) throw std::system_error(errno, std::system_category(), "Failed to list " + path_);
+	numbers.clear();
+	while(const dirent* entry = readdir(listing)) {
+		int number;
+		const char* end = entry->d_name + std::strlen(entry->d_name);
+		const std::from_chars_result result = std::from_chars(entry->d_name, end, number);
+		if((result.ec == std::errc()) && (result.ptr == end)) numbers.push_back(number);
+	}
+	closedir(listing);
+}
+
+int procfs::directory::open(const char* path) const noexcept {
+	return openat(fd_, path, O_RDONLY | O_CLOEXEC);
+}
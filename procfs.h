@@ -0,0 +1,114 @@
+// Copyright (C) 2015 Philip Cronje. All rights reserved.
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace procfs {
+	/* Scans numbers and fixed tokens out of procfs text. The scanned range must be followed by a NUL sentinel, which
+	 * lets the digit and whitespace loops run without bounds checks: the sentinel is neither a digit nor a space. */
+	class scanner {
+		const char* cursor_;
+		const char* end_;
+
+		public:
+			scanner(const char* begin, const char* end) noexcept : cursor_(begin), end_(end) {}
+			explicit scanner(const char* string) noexcept : scanner(string, string + std::strlen(string)) {}
+
+			bool atEnd() const noexcept { return cursor_ >= end_; }
+			char peek() const noexcept { return *cursor_; }
+
+			/* Consumes the token if the input continues with it. */
+			bool consume(const char* token, const std::size_t length) noexcept {
+				if((static_cast<std::size_t>(end_ - cursor_) < length) || (std::memcmp(cursor_, token, length) != 0)) {
+					return false;
+				}
+				cursor_ += length;
+				return true;
+			}
+
+			/* Skips spaces and reports whether a number follows on the current line. */
+			bool hasNumber() noexcept {
+				while(*cursor_ == ' ') ++cursor_;
+				return static_cast<unsigned char>(*cursor_ - '0') < 10;
+			}
+
+			/* Parses an unsigned decimal number, skipping any leading spaces. Yields 0 if no digits follow. */
+			unsigned long long number() noexcept {
+				while(*cursor_ == ' ') ++cursor_;
+				unsigned long long value = 0;
+				for(unsigned digit; (digit = static_cast<unsigned char>(*cursor_ - '0')) < 10; ++cursor_) {
+					value = value * 10 + digit;
+				}
+				return value;
+			}
+
+			/* Skips spaces and returns the word that follows, which is empty at the end of a line. */
+			std::string_view word() noexcept {
+				while(*cursor_ == ' ') ++cursor_;
+				const char* begin = cursor_;
+				while(static_cast<unsigned char>(*cursor_) > ' ') ++cursor_;
+				return std::string_view(begin, cursor_ - begin);
+			}
+
+			/* Skips spaces and returns the text before the delimiter, moving past it, if the delimiter comes before
+			 * the end of the line. Otherwise returns an empty string and moves nowhere. */
+			std::string_view label(const char delimiter) noexcept {
+				const char* begin = cursor_;
+				while(*begin == ' ') ++begin;
+				const char* end = begin;
+				while((*end != delimiter) && (*end != '\n') && (*end != '\0')) ++end;
+				if(*end != delimiter) return std::string_view();
+				cursor_ = end + 1;
+				return std::string_view(begin, end - begin);
+			}
+
+			/* Moves past the next newline, or to the end of the input if there is none. */
+			void skipLine() noexcept {
+				const void* newline = std::memchr(cursor_, '\n', end_ - cursor_);
+				cursor_ = (newline == nullptr) ? end_ : static_cast<const char*>(newline) + 1;
+			}
+	};
+
+	/* A procfs file that is opened once and re-read from the start with pread into a buffer that is reused across
+	 * reads, growing only if the file outgrows it. */
+	class file {
+		int fd_;
+		std::unique_ptr<char[]> buffer_;
+		std::size_t capacity_;
+		std::size_t size_ = 0;
+
+		public:
+			explicit file(const char* path, std::size_t capacity = 16384);
+			file(const file&) = delete;
+			~file() noexcept;
+
+			void read();
+
+			const char* data() const noexcept { return buffer_.get(); }
+			std::size_t size() const noexcept { return size_; }
+			scanner scan() const noexcept { return scanner(buffer_.get(), buffer_.get() + size_); }
+	};
+
+	/* A procfs directory that is held open, so that files below it are opened relative to it. Kept apart from the
+	 * stat collectors because <fcntl.h> declares struct stat, which clashes with their namespace. */
+	class directory {
+		const std::string path_;
+		int fd_;
+
+		public:
+			explicit directory(const std::string& path);
+			directory(const directory&) = delete;
+			~directory() noexcept;
+
+			/* Replaces the numbers with those of the entries named by a number, such as the PIDs in /proc. */
+			void listNumbered(std::vector<int>& numbers) const;
+
+			/* Opens a file below the directory for reading, returning the descriptor or -1. */
+			int open(const char* path) const noexcept;
+	};
+}
@@ -0,0 +1,120 @@
+// Copyright (C) 2015 Philip Cronje. All rights reserved.
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+
+#include "publisher.h"
+
+publisher::publisher(util::spool& spool, http::client& client, requestBuilder build, observer observe,
+		const options& options, const clock::time_point now, const std::uint32_t seed) : spool_(spool),
+		client_(client), build_(std::move(build)), observe_(std::move(observe)), options_(options),
+		bucket_(options.rate, options.burst, now), backoff_(options.baseDelay, options.maxDelay, seed) {
+	resumeAt_ = now + backoff_.jitter(options.spread);
+}
+
+bool publisher::retryable(const http::response& response) {
+	// CloudWatch reports throttling as a client error, with the error code in the body
+	return (response.status == 429) || (response.status >= 500)
+		|| ((response.status == 400) && (response.body.find("<Code>Throttling</Code>") != std::string::npos));
+}
+
+bool publisher::enqueue(const util::buffer& body, const std::uint32_t datums) {
+	// Each record is the number of datums in a request, followed by its form body
+	record_.clear();
+	record_.append(&datums, sizeof(datums));
+	record_.append(body.data(), body.size());
+	try {
+		spool_.append(record_.data(), record_.size());
+	} catch(const std::length_error&) {
+		totals_.dropped += datums;
+		return false;
+	}
+	return true;
+}
+
+unsigned int publisher::drain(const clock::time_point now) {
+	if(now < resumeAt_) return 0;
+
+	unsigned int queued = 0;
+	util::spool::record record;
+	while((client_.inFlight() < options_.maxInFlight) && (bucket_.tokens(now) >= 1) && spool_.next(record)) {
+		// After a rewind, requests that are still in flight or were already accepted come round again
+		if((sending_.count(record.offset) != 0) || (accepted_.count(record.offset) != 0)) continue;
+		bucket_.take(now);
+		sending_.insert(record.offset);
+		std::uint32_t datums;
+		std::memcpy(&datums, record.data, sizeof(datums));
+		client_.enqueue(build_(record.data + sizeof(datums), record.size - sizeof(datums)),
+				[this, record, datums, now](const http::response& response) {
+			respond(record, datums, now, response);
+		});
+		++queued;
+	}
+	return queued;
+}
+
+void publisher::respond(const util::spool::record& record, const std::uint32_t datums, const clock::time_point sent,
+		const http::response& response) {
+	const clock::time_point now = clock::now();
+	sending_.erase(record.offset);
+	if(response.status == 0) {
+		// The connection was lost; whatever was not answered is sent again on the next one
+		totals_.retried += datums;
+		spool_.rewind();
+		observe_(Retried, datums, response, now - sent);
+		return;
+	}
+
+	if(response.successful()) {
+		totals_.sent += datums;
+		if(record.offset == spool_.head()) backoff_.reset();
+		commit(record);
+		observe_(Sent, datums, response, now - sent);
+		return;
+	}
+
+	if(retryable(response)) {
+		// Only the request at the head of the spool uses up attempts, as those behind it are retried along with it
+		const bool head = record.offset == spool_.head();
+		if(head) {
+			attempts_ = (failedOffset_ == record.offset) ? attempts_ + 1 : 1;
+			failedOffset_ = record.offset;
+		}
+		if(!head || (attempts_ < options_.maxAttempts)) {
+			totals_.retried += datums;
+			spool_.rewind();
+			backOff(now);
+			observe_(Retried, datums, response, now - sent);
+			return;
+		}
+	}
+
+	// A request that was refused, or that has failed too often, would only fail again
+	totals_.dropped += datums;
+	commit(record);
+	observe_(Dropped, datums, response, now - sent);
+}
+
+void publisher::commit(const util::spool::record& record) {
+	if(record.offset != spool_.head()) {
+		// Following a request that is being retried, so it is committed once that one is
+		accepted_.emplace(record.offset, record.end);
+		return;
+	}
+	spool_.commit(record);
+	// Requests the spool dropped to make room can no longer be committed
+	while(!accepted_.empty() && (accepted_.begin()->first < spool_.head())) accepted_.erase(accepted_.begin());
+	while(!accepted_.empty() && (accepted_.begin()->first == spool_.head())) {
+		spool_.commit(util::spool::record { nullptr, 0, accepted_.begin()->first, accepted_.begin()->second });
+		accepted_.erase(accepted_.begin());
+	}
+}
+
+void publisher::backOff(const clock::time_point now) {
+	resumeAt_ = std::max(resumeAt_, now + backoff_.next());
+}
+
+publisher::clock::duration publisher::connectionFailed(const clock::time_point now) {
+	backOff(now);
+	return resumeAt_ - now;
+}
@@ -0,0 +1,168 @@
+// Copyright (C) 2015 Philip Cronje. All rights reserved.
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <random>
+#include <set>
+
+#include "http.h"
+#include "spool.h"
+#include "util.h"
+
+/* Token bucket, holding up to burst tokens and refilled at rate tokens per second. */
+class tokenBucket {
+	public:
+		typedef std::chrono::steady_clock clock;
+
+	private:
+		const double rate_;
+		const double burst_;
+		double tokens_;
+		clock::time_point refilled_;
+
+	public:
+		tokenBucket(const double rate, const double burst, const clock::time_point now) : rate_(rate), burst_(burst),
+				tokens_(burst), refilled_(now) {}
+
+		/* The tokens available now, which is fractional while the bucket refills. */
+		double tokens(const clock::time_point now) {
+			if(now > refilled_) {
+				tokens_ = std::min(burst_, tokens_ + std::chrono::duration<double>(now - refilled_).count() * rate_);
+				refilled_ = now;
+			}
+			return tokens_;
+		}
+
+		/* Takes a token if one is available now. */
+		bool take(const clock::time_point now) {
+			if(tokens(now) < 1) return false;
+			tokens_ -= 1;
+			return true;
+		}
+};
+
+/* Exponential backoff with full jitter: the nth consecutive delay is drawn uniformly from zero up to base * 2^(n - 1),
+ * or up to the cap once that is larger, so that clients failing together do not retry together. */
+class backoff {
+	const std::chrono::milliseconds base_;
+	const std::chrono::milliseconds cap_;
+	unsigned int failures_ = 0;
+	std::mt19937 random_;
+
+	public:
+		backoff(const std::chrono::milliseconds base, const std::chrono::milliseconds cap, const std::uint32_t seed)
+				: base_(base), cap_(cap), random_(seed) {}
+
+		unsigned int failures() const noexcept { return failures_; }
+
+		/* Counts a failure, returning how long to wait before trying again. */
+		std::chrono::milliseconds next() {
+			// Doubling stops once the cap is reached, before it can overflow
+			std::chrono::milliseconds ceiling = base_;
+			for(unsigned int i = 0; (i < failures_) && (ceiling < cap_); ++i) ceiling *= 2;
+			++failures_;
+			return jitter(std::min(ceiling, cap_));
+		}
+
+		/* A delay drawn uniformly from zero up to limit. */
+		std::chrono::milliseconds jitter(const std::chrono::milliseconds limit) {
+			return std::chrono::milliseconds(
+					std::uniform_int_distribution<std::chrono::milliseconds::rep>(0, limit.count())(random_));
+		}
+
+		void reset() noexcept { failures_ = 0; }
+};
+
+/* Sends the PutMetricData requests held in a spool over an HTTP client, oldest first and pipelined, within a rate
+ * limit. A request is committed once it has been answered, unless it was throttled or met a server error: those are
+ * retried after a jittered exponential backoff, until the request at the head of the spool has failed maxAttempts
+ * times and is given up on. Connection failures back off in the same way. A request is also sent again if its
+ * connection was lost before it was answered.
+ *
+ * The spool can only commit requests in order, so a request settled behind one that must be retried is held back
+ * until those before it are committed, and is skipped when the spool is read again; so is a request still in
+ * flight. CloudWatch adds up the statistics of every request it accepts, so none may be sent twice. */
+class publisher {
+	public:
+		typedef std::chrono::steady_clock clock;
+
+		enum outcome { Sent, Retried, Dropped };
+
+		/* Builds the request carrying a spooled form body. */
+		typedef std::function<const util::buffer&(const std::uint8_t* body, std::size_t size)> requestBuilder;
+		/* Told what became of each request, with the number of datums it carried and how long it took. */
+		typedef std::function<void(outcome outcome, std::uint32_t datums, const http::response& response,
+				clock::duration latency)> observer;
+
+		struct options {
+			// Requests per second, and how many may be sent at once after a quiet spell
+			double rate;
+			double burst;
+			std::size_t maxInFlight;
+			std::chrono::milliseconds baseDelay;
+			std::chrono::milliseconds maxDelay;
+			unsigned int maxAttempts;
+			// Sending starts after a random delay of up to this long, spreading out agents started together
+			std::chrono::milliseconds spread;
+		};
+
+		// Datums accounted for by what became of the requests carrying them
+		struct totals {
+			unsigned long long sent = 0;
+			unsigned long long retried = 0;
+			unsigned long long dropped = 0;
+		};
+
+	private:
+		util::spool& spool_;
+		http::client& client_;
+		const requestBuilder build_;
+		const observer observe_;
+		const options options_;
+		tokenBucket bucket_;
+		backoff backoff_;
+		clock::time_point resumeAt_;
+		// Failures of the request at the head of the spool
+		std::uint64_t failedOffset_ = ~0ULL;
+		unsigned int attempts_ = 0;
+		totals totals_;
+		util::buffer record_;
+		// Offsets of the requests awaiting an answer, and the offsets and ends of those settled out of order
+		std::set<std::uint64_t> sending_;
+		std::map<std::uint64_t, std::uint64_t> accepted_;
+
+		void respond(const util::spool::record& record, std::uint32_t datums, clock::time_point sent,
+				const http::response& response);
+		void backOff(clock::time_point now);
+		/* Commits a request that has been settled, and then those settled out of order that it was holding back,
+		 * or holds it back in turn if it is not at the head of the spool. */
+		void commit(const util::spool::record& record);
+
+	public:
+		publisher(util::spool& spool, http::client& client, requestBuilder build, observer observe,
+				const options& options, clock::time_point now, std::uint32_t seed);
+		publisher(const publisher&) = delete;
+
+		const totals& datums() const noexcept { return totals_; }
+		/* When sending may resume after a failure, or after starting. */
+		clock::time_point resumeAt() const noexcept { return resumeAt_; }
+
+		/* Whether a response asks for the request to be retried later: throttling, and server errors. */
+		static bool retryable(const http::response& response);
+
+		/* Spools the form body of a request carrying a number of datums, returning false if it was too large for
+		 * the spool and has been dropped. */
+		bool enqueue(const util::buffer& body, std::uint32_t datums);
+
+		/* Queues as many spooled requests on the client as the rate limit, backoff and pipeline depth allow,
+		 * returning how many were queued. */
+		unsigned int drain(clock::time_point now);
+
+		/* Backs off after failing to connect, returning how long until sending resumes. */
+		clock::duration connectionFailed(clock::time_point now);
+};
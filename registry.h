@@ -0,0 +1,121 @@
+// Copyright (C) 2015 Philip Cronje. All rights reserved.
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "cloudwatch.h"
+#include "collector.h"
+#include "timer-wheel.h"
+
+namespace stat {
+	/* Drives registered collectors from a timer wheel, each at its own sample interval and flush period. A request
+	 * template is compiled for every collector when it is registered. Collectors whose flush periods end on the same
+	 * tick are handed to the flush handler together, after every collector due to be sampled on that tick has been.
+	 * When the wheel is turned several ticks at once to catch up, a collector due more than once is sampled only once,
+	 * so that its sample covers the whole of the late interval rather than being followed by empty ones. A collector
+	 * whose metrics have changed has its template compiled again before it is flushed. */
+	class registry {
+		public:
+			typedef std::vector<const aws::cloudwatch::requestTemplate*> requestTemplates;
+			typedef std::function<void(const requestTemplates&)> flushHandler;
+
+		private:
+			struct entry {
+				const std::unique_ptr<collector> source;
+				const std::unordered_map<std::string, std::string> dimensions;
+				aws::cloudwatch::requestTemplate requestTemplate;
+				bool samplePending = false;
+				timerWheel::timer sample;
+				timerWheel::timer flush;
+
+				entry(std::unique_ptr<collector>&& source_,
+						const std::unordered_map<std::string, std::string>& dimensions, std::vector<entry*>& pending,
+						std::vector<entry*>& due)
+						: source(std::move(source_)), dimensions(dimensions),
+						requestTemplate(dimensions, source->metrics()),
+						sample([this, &pending] {
+							if(!samplePending) pending.push_back(this);
+							samplePending = true;
+						}),
+						flush([this, &due] { due.push_back(this); }) {}
+			};
+
+			const std::chrono::milliseconds tick_;
+			const flushHandler flush_;
+			timerWheel wheel_;
+			std::vector<std::unique_ptr<entry>> entries_;
+			std::vector<entry*> pending_;
+			std::vector<entry*> due_;
+			requestTemplates dueTemplates_;
+
+			/* Samples every collector that has come due since the last time this was called. */
+			void sample() {
+				for(entry* entry: pending_) {
+					entry->samplePending = false;
+					entry->source->sample();
+				}
+				pending_.clear();
+			}
+
+			/* Converts a duration to a whole number of ticks, rounding up, and at least one. */
+			unsigned long long ticks(const std::chrono::milliseconds duration) const noexcept {
+				const unsigned long long ticks = (duration + tick_ - std::chrono::milliseconds(1)) / tick_;
+				return (ticks != 0) ? ticks : 1;
+			}
+
+		public:
+			registry(const std::chrono::milliseconds tick, flushHandler flush) : tick_(tick),
+					flush_(std::move(flush)) {}
+
+			std::chrono::milliseconds tick() const noexcept { return tick_; }
+			timerWheel& wheel() noexcept { return wheel_; }
+
+			void add(std::unique_ptr<collector>&& source,
+					const std::unordered_map<std::string, std::string>& dimensions) {
+				entries_.emplace_back(new entry(std::move(source), dimensions, pending_, due_));
+				entry& entry = *entries_.back();
+				const unsigned long long interval = ticks(entry.source->interval());
+				const unsigned long long flushPeriod = ticks(entry.source->flushPeriod());
+				wheel_.schedule(entry.sample, interval, interval);
+				wheel_.schedule(entry.flush, flushPeriod, flushPeriod);
+				pending_.reserve(entries_.size());
+				due_.reserve(entries_.size());
+				dueTemplates_.reserve(entries_.size());
+			}
+
+			/* The tick on which the next collector is due to be flushed. */
+			unsigned long long nextFlush() const noexcept {
+				unsigned long long next = ~0ULL;
+				for(const std::unique_ptr<entry>& entry: entries_) next = std::min(next, entry->flush.expiry());
+				return next;
+			}
+
+			/* Turns the wheel tick by tick, sampling and flushing collectors as they come due. */
+			void advance(unsigned long long ticks) {
+				while(ticks-- != 0) {
+					wheel_.advance(1);
+					if(due_.empty()) continue;
+
+					sample();
+					dueTemplates_.clear();
+					for(entry* entry: due_) {
+						if(entry->source->metricsChanged()) {
+							entry->requestTemplate = aws::cloudwatch::requestTemplate(entry->dimensions,
+									entry->source->metrics());
+						}
+						dueTemplates_.push_back(&entry->requestTemplate);
+					}
+					flush_(dueTemplates_);
+					for(entry* entry: due_) entry->source->reset();
+					due_.clear();
+				}
+				sample();
+			}
+	};
+}
@@ -0,0 +1,61 @@
+// Copyright (C) 2015 Philip Cronje. All rights reserved.
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+namespace util {
+	/* Bounded queue from one producer thread to one consumer thread, without locks. Its slots are never constructed or
+	 * destroyed after the ring is: the producer claims a slot, fills it in place and publishes it, and the consumer
+	 * reads it at the front and pops it, so buffers held in slots keep their storage from one lap to the next.
+	 *
+	 * Each side keeps its position, and its last sight of the other's, on a cache line of its own, so that it only
+	 * reads the other side's line when the ring looks full or empty. */
+	template<typename T, std::size_t N>
+	class ring {
+		static_assert((N != 0) && ((N & (N - 1)) == 0), "Ring capacity must be a power of two");
+
+		constexpr static std::size_t cacheLine = 64;
+
+		// Positions count every slot ever published or popped, and are reduced modulo N to index a slot
+		alignas(cacheLine) std::atomic<std::size_t> tail_ { 0 };
+		std::size_t producerHead_ = 0;
+		alignas(cacheLine) std::atomic<std::size_t> head_ { 0 };
+		std::size_t consumerTail_ = 0;
+		alignas(cacheLine) std::array<T, N> slots_;
+
+		public:
+			ring() = default;
+			ring(const ring&) = delete;
+
+			constexpr static std::size_t capacity() noexcept { return N; }
+
+			/* Producer: the slot to fill next, or null if the ring is full. The slot holds whatever was last
+			 * published from it. */
+			T* claim() noexcept {
+				const std::size_t tail = tail_.load(std::memory_order_relaxed);
+				if(tail - producerHead_ == N) {
+					producerHead_ = head_.load(std::memory_order_acquire);
+					if(tail - producerHead_ == N) return nullptr;
+				}
+				return &slots_[tail & (N - 1)];
+			}
+
+			/* Producer: hands the claimed slot to the consumer. */
+			void publish() noexcept { tail_.store(tail_.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+
+			/* Consumer: the oldest published slot, or null if the ring is empty. */
+			T* front() noexcept {
+				const std::size_t head = head_.load(std::memory_order_relaxed);
+				if(head == consumerTail_) {
+					consumerTail_ = tail_.load(std::memory_order_acquire);
+					if(head == consumerTail_) return nullptr;
+				}
+				return &slots_[head & (N - 1)];
+			}
+
+			/* Consumer: gives the front slot back to the producer. */
+			void pop() noexcept { head_.store(head_.load(std::memory_order_relaxed) + 1, std::memory_order_release); }
+	};
+}
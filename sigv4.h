@@ -0,0 +1,71 @@
+// Copyright (C) 2015 Philip Cronje. All rights reserved.
+#pragma once
+
+#include <cstring>
+#include <string>
+
+#include "crypto.h"
+#include "util.h"
+
+namespace aws {
+	/* AWS Signature Version 4 signer for a single (region, service) pair. The signing key is derived from the secret
+	 * key once per UTC date and held in a keyed HMAC context, so signing a request costs a single HMAC. */
+	class signer {
+		const std::string accessKey_;
+		const std::string secretKey_;
+		const std::string region_;
+		const std::string service_;
+
+		char date_[9] = "";
+		std::string credentialScope_;
+		crypto::hmacContext signingKey_;
+		crypto::digestContext digestContext_;
+
+		void deriveSigningKey() {
+			uint8_t hmac1[256 / 8];
+			uint8_t hmac2[256 / 8];
+			crypto::hmac("AWS4" + secretKey_, date_, hmac1);
+			crypto::hmac(hmac1, sizeof(hmac1), region_, hmac2);
+			crypto::hmac(hmac2, sizeof(hmac2), service_, hmac1);
+			crypto::hmac(hmac1, sizeof(hmac1), "aws4_request", hmac2);
+			signingKey_.key(hmac2, sizeof(hmac2));
+			credentialScope_ = std::string(date_) + '/' + region_ + '/' + service_ + "/aws4_request";
+		}
+
+		public:
+			// Length of a hex-encoded SHA-256 hash or signature
+			constexpr static size_t hashSize = 2 * 256 / 8;
+
+			signer(const std::string& accessKey, const std::string& secretKey, const std::string& region,
+					const std::string& service) : accessKey_(accessKey), secretKey_(secretKey), region_(region),
+					service_(service), digestContext_(crypto::digestType::SHA256) {}
+
+			const std::string& accessKey() const noexcept { return accessKey_; }
+			const std::string& credentialScope() const noexcept { return credentialScope_; }
+
+			/* Sets the date of the requests about to be signed from an ISO 8601 basic timestamp
+			 * (YYYYMMDD'T'HHMMSS'Z'), deriving a new signing key only if the date has changed. */
+			void date(const char* amazonDate) {
+				if(std::strncmp(date_, amazonDate, sizeof(date_) - 1) != 0) {
+					std::memcpy(date_, amazonDate, sizeof(date_) - 1);
+					deriveSigningKey();
+				}
+			}
+
+			/* Writes the hex-encoded SHA-256 hash of the input to output, which must have room for hashSize
+			 * characters. */
+			void hash(const void* input, const size_t size, char* output) {
+				uint8_t rawHash[EVP_MAX_MD_SIZE];
+				const unsigned int rawHashSize = digestContext_.hash(input, size, rawHash);
+				util::hexEncode(rawHash, rawHashSize, output);
+			}
+
+			/* Writes the hex-encoded signature of the string to sign to output, which must have room for hashSize
+			 * characters. */
+			void sign(const void* stringToSign, const size_t size, char* output) {
+				uint8_t signature[256 / 8];
+				signingKey_.sign(stringToSign, size, signature);
+				util::hexEncode(signature, sizeof(signature), output);
+			}
+	};
+}
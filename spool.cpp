@@ -0,0 +1,185 @@
+// Copyright (C) 2015 Philip Cronje. All rights reserved.
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <stdexcept>
+#include <system_error>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "spool.h"
+
+namespace {
+	constexpr char magic[8] = { 'P', 'N', 'S', 'P', 'O', 'O', 'L', '\0' };
+	// Raised whenever the layout of the file or of its records changes, as when the publisher began storing the datum
+	// count of each request ahead of its body in version 2
+	constexpr std::uint32_t version = 2;
+
+	constexpr std::array<std::uint32_t, 256> crcTable = [] {
+		std::array<std::uint32_t, 256> table {};
+		for(std::uint32_t i = 0; i < 256; ++i) {
+			std::uint32_t crc = i;
+			for(int bit = 0; bit < 8; ++bit) crc = (crc >> 1) ^ (((crc & 1) != 0) ? 0xEDB88320 : 0);
+			table[i] = crc;
+		}
+		return table;
+	}();
+
+	/* CRC-32, as used by zlib, continued from a previous value. */
+	std::uint32_t crc32(std::uint32_t crc, const void* data, const std::size_t size) noexcept {
+		const std::uint8_t* bytes = static_cast<const std::uint8_t*>(data);
+		crc = ~crc;
+		for(std::size_t i = 0; i < size; ++i) crc = crcTable[(crc ^ bytes[i]) & 0xFF] ^ (crc >> 8);
+		return ~crc;
+	}
+
+	// The checksum also covers the offset, so that a record left over from an earlier lap is never taken as current
+	std::uint32_t checksum(const std::uint64_t offset, const void* data, const std::size_t size) noexcept {
+		return crc32(crc32(0, &offset, sizeof(offset)), data, size);
+	}
+
+	constexpr std::uint64_t align(const std::uint64_t size) noexcept { return (size + 7) & ~std::uint64_t(7); }
+}
+
+util::spool::spool(const std::string& path, std::size_t capacity) {
+	fd_ = open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+	if(fd_ == -1) throw std::system_error(errno, std::system_category(), "Failed to open spool " + path);
+	const auto fail = [this](const int error, const std::string& what) {
+		close(fd_);
+		if(error == 0) throw std::runtime_error(what);
+		throw std::system_error(error, std::system_category(), what);
+	};
+
+	struct stat status;
+	if(fstat(fd_, &status) == -1) fail(errno, "Failed to read the size of spool " + path);
+	const bool created = status.st_size == 0;
+	if(created) {
+		capacity_ = (capacity + headerSize - 1) / headerSize * headerSize;
+		if(ftruncate(fd_, headerSize + capacity_) == -1) fail(errno, "Failed to size spool " + path);
+	} else if(static_cast<std::size_t>(status.st_size) <= headerSize) {
+		fail(0, "Not a spool file: " + path);
+	} else {
+		capacity_ = status.st_size - headerSize;
+	}
+
+	void* map = mmap(nullptr, headerSize + capacity_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+	if(map == MAP_FAILED) fail(errno, "Failed to map spool " + path);
+	map_ = static_cast<std::uint8_t*>(map);
+	header_ = reinterpret_cast<fileHeader*>(map_);
+	data_ = map_ + headerSize;
+
+	if(created) {
+		std::memcpy(header_->magic, magic, sizeof(magic));
+		header_->version = version;
+		header_->capacity = capacity_;
+		header_->committed = 0;
+		sync(0, headerSize);
+	} else if((std::memcmp(header_->magic, magic, sizeof(magic)) != 0) || (header_->capacity != capacity_)) {
+		munmap(map_, headerSize + capacity_);
+		fail(0, "Not a spool file: " + path);
+	} else if(header_->version != version) {
+		const std::uint32_t found = header_->version;
+		munmap(map_, headerSize + capacity_);
+		fail(0, "Spool " + path + " has version " + std::to_string(found) + " rather than " + std::to_string(version)
+			+ "; remove it to start afresh");
+	}
+
+	// The records that follow the committed offset are those still to be delivered
+	tail_ = read_ = header_->committed;
+	for(record record; at(tail_, record); tail_ = record.end) ++records_;
+}
+
+util::spool::~spool() noexcept {
+	munmap(map_, headerSize + capacity_);
+	close(fd_);
+}
+
+bool util::spool::at(std::uint64_t offset, record& record) const noexcept {
+	record.offset = offset;
+	std::size_t position = offset % capacity_;
+	recordHeader header {};
+	for(int i = 0; i < 2; ++i) {
+		// A lap ends early if there is no room for a record header, or if it has been padded out
+		if(capacity_ - position >= sizeof(header)) {
+			std::memcpy(&header, data_ + position, sizeof(header));
+			if(header.offset != offset) return false;
+			if(header.size != padding) break;
+		}
+		offset += capacity_ - position;
+		position = 0;
+	}
+
+	if((header.size == padding) || (header.size > capacity_ - position - sizeof(header))) return false;
+	const std::uint8_t* data = data_ + position + sizeof(header);
+	if(checksum(offset, data, header.size) != header.checksum) return false;
+	record.data = data;
+	record.size = header.size;
+	record.end = offset + align(sizeof(header) + header.size);
+	return true;
+}
+
+void util::spool::dropOldest() {
+	record oldest;
+	if(!at(header_->committed, oldest)) throw std::logic_error("Spool is corrupt");
+	header_->committed = oldest.end;
+	if(read_ < oldest.end) read_ = oldest.end;
+	--records_;
+	++dropped_;
+}
+
+void util::spool::sync(const std::size_t position, const std::size_t size) const {
+	// msync() needs a page-aligned address, and the map is page-aligned
+	const std::size_t page = sysconf(_SC_PAGESIZE);
+	const std::size_t begin = position / page * page;
+	if(msync(map_ + begin, position + size - begin, MS_SYNC) == -1) {
+		throw std::system_error(errno, std::system_category(), "Failed to write the spool to disk");
+	}
+}
+
+void util::spool::append(const void* data, const std::size_t size) {
+	const std::uint64_t length = align(sizeof(recordHeader) + size);
+	if(length > capacity_ / 2) throw std::length_error("Record too large for the spool");
+
+	std::uint64_t offset = tail_;
+	std::size_t position = offset % capacity_;
+	const std::uint64_t skip = (capacity_ - position < length) ? capacity_ - position : 0;
+	if(capacity_ - (tail_ - header_->committed) < skip + length) {
+		while(capacity_ - (tail_ - header_->committed) < skip + length) dropOldest();
+		// The head must be moved on in the file before the records it pointed at are overwritten
+		sync(0, sizeof(fileHeader));
+	}
+
+	if(skip != 0) {
+		if(skip >= sizeof(recordHeader)) {
+			const recordHeader marker { padding, 0, offset };
+			std::memcpy(data_ + position, &marker, sizeof(marker));
+			sync(headerSize + position, sizeof(marker));
+		}
+		offset += skip;
+		position = 0;
+	}
+	const recordHeader header { static_cast<std::uint32_t>(size), checksum(offset, data, size), offset };
+	std::memcpy(data_ + position, &header, sizeof(header));
+	std::memcpy(data_ + position + sizeof(header), data, size);
+	sync(headerSize + position, sizeof(header) + size);
+	tail_ = offset + length;
+	++records_;
+}
+
+bool util::spool::next(record& record) {
+	if(read_ == tail_) return false;
+	if(!at(read_, record)) throw std::logic_error("Spool is corrupt");
+	read_ = record.end;
+	return true;
+}
+
+void util::spool::commit(const record& record) {
+	if(record.offset != header_->committed) return;
+	header_->committed = record.end;
+	--records_;
+	sync(0, sizeof(fileHeader));
+}
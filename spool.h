@@ -0,0 +1,92 @@
+// Copyright (C) 2015 Philip Cronje. All rights reserved.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace util {
+	/* Ring of records in a memory-mapped file, holding data that must survive until it has been delivered. Records
+	 * are appended at the tail and delivered from the head; the head only moves past a record once it has been
+	 * committed, and is kept in the file, so a restarted process resumes delivery from the first record that was not.
+	 * The file never grows: appending to a full spool drops the oldest records to make room.
+	 *
+	 * Records are addressed by offsets that keep increasing from one lap of the ring to the next. Each is stored with
+	 * its offset and a checksum, so that the records following the head can be recovered when the file is reopened
+	 * without trusting a tail pointer, and a record torn by a crash ends the spool rather than being delivered. */
+	class spool {
+		public:
+			struct record {
+				const std::uint8_t* data;
+				std::size_t size;
+				// The offset of the record and of the one that follows it
+				std::uint64_t offset;
+				std::uint64_t end;
+			};
+
+			constexpr static std::size_t headerSize = 4096;
+
+		private:
+			struct fileHeader {
+				char magic[8];
+				std::uint32_t version;
+				std::uint32_t reserved;
+				std::uint64_t capacity;
+				std::uint64_t committed;
+			};
+
+			struct recordHeader {
+				std::uint32_t size;
+				std::uint32_t checksum;
+				std::uint64_t offset;
+			};
+
+			// The size of a record header marking the rest of the lap as unused
+			constexpr static std::uint32_t padding = ~0U;
+
+			int fd_;
+			std::size_t capacity_;
+			std::uint8_t* map_;
+			fileHeader* header_;
+			std::uint8_t* data_;
+			std::uint64_t tail_;
+			std::uint64_t read_;
+			std::size_t records_ = 0;
+			unsigned long long dropped_ = 0;
+
+			/* Reads the record at an offset, returning false if there is no intact record there. */
+			bool at(std::uint64_t offset, record& record) const noexcept;
+			void dropOldest();
+			void sync(std::size_t position, std::size_t size) const;
+
+		public:
+			/* Opens the spool file at path, creating it with room for capacity bytes of records if it does not
+			 * exist. An existing spool keeps the capacity it was created with. */
+			spool(const std::string& path, std::size_t capacity);
+			spool(const spool&) = delete;
+			~spool() noexcept;
+
+			std::size_t capacity() const noexcept { return capacity_; }
+			/* Records that have not been committed. */
+			std::size_t records() const noexcept { return records_; }
+			/* The offset of the oldest record that has not been committed. */
+			std::uint64_t head() const noexcept { return header_->committed; }
+			/* Records dropped to make room for newer ones since the spool was opened. */
+			unsigned long long dropped() const noexcept { return dropped_; }
+
+			/* Appends a copy of a record, which may take up at most half of the capacity. */
+			void append(const void* data, std::size_t size);
+
+			/* Reads the next record that has not been read since the spool was opened or rewound. The record's data
+			 * stays valid until the next append. */
+			bool next(record& record);
+
+			/* Commits a record that has been delivered, so that it is never read again. Records must be committed
+			 * in order; committing one that has been dropped, or that follows one not yet committed, does
+			 * nothing. */
+			void commit(const record& record);
+
+			/* Reads the records that have not been committed again, from the oldest. */
+			void rewind() noexcept { read_ = header_->committed; }
+	};
+}
@@ -1,10 +1,10 @@
 // Copyright (C) 2015 Philip Cronje. All rights reserved.
-#include <iostream> // XXX Debugging
+#include <algorithm>
+#include <climits>
 
 #include <sys/socket.h>
+#include <sys/uio.h>
 
-#include <openssl/conf.h>
-#include <openssl/engine.h>
 #include <openssl/err.h>
 #include <openssl/x509.h>
 #include <openssl/x509v3.h>
@@ -26,22 +26,27 @@ namespace {
 }
 
 ssl::library::library() {
-	SSL_library_init();
-	SSL_load_error_strings();
-}
-
-ssl::library::~library() {
-	FIPS_mode_set(0);
-	ENGINE_cleanup();
-	CONF_modules_unload(1);
-	EVP_cleanup();
-	CRYPTO_cleanup_all_ex_data();
-	ERR_remove_state(0);
-	ERR_free_strings();
+	if(OPENSSL_init_ssl(OPENSSL_INIT_LOAD_SSL_STRINGS | OPENSSL_INIT_LOAD_CRYPTO_STRINGS, nullptr) == 0) {
+		throw std::system_error(ERR_get_error(), opensslCategory, "Failed to initialise OpenSSL");
+	}
 }
 
 ssl::context::context() : context_(SSL_CTX_new(SSLv23_client_method())) {
 	if(context_ == nullptr) throw std::system_error(ERR_get_error(), opensslCategory);
+	// Sessions are kept here rather than in OpenSSL's cache, which clients would have to look up themselves
+	SSL_CTX_set_session_cache_mode(context_, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+	SSL_CTX_set_app_data(context_, this);
+	SSL_CTX_sess_set_new_cb(context_, newSession);
+	// A write the engine could not finish is retried from wherever the outbound buffer has since been moved to
+	SSL_CTX_set_mode(context_, SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+}
+
+int ssl::context::newSession(SSL* ssl, SSL_SESSION* session) {
+	const context* self = static_cast<const context*>(SSL_CTX_get_app_data(SSL_get_SSL_CTX(ssl)));
+	if(self->session_ != nullptr) SSL_SESSION_free(self->session_);
+	self->session_ = session;
+	// Keep the reference OpenSSL handed over
+	return 1;
 }
 
 bool ssl::x509::matchSan(const std::string& value) const noexcept {
@@ -67,10 +72,8 @@ bool ssl::x509::matchSan(const std::string& value) const noexcept {
 		ASN1_STRING* dnsName = generalName->d.dNSName;
 		if((dnsName->data == nullptr) || (dnsName->length == 0)) continue;
 
-		int dnsNameLength;
 		char* dnsNameString;
-		dnsNameLength = ASN1_STRING_to_UTF8(reinterpret_cast<unsigned char**>(&dnsNameString), dnsName);
-		std::cout << "SAN: <" << dnsNameString << "> vs <" << value << ">" << std::endl;
+		if(ASN1_STRING_to_UTF8(reinterpret_cast<unsigned char**>(&dnsNameString), dnsName) < 0) continue;
 		const bool match = value == dnsNameString;
 		OPENSSL_free(dnsNameString);
 		if(match) {
@@ -98,7 +101,8 @@ ssl::connection::connection(const context& context, net::socket& socket) : conte
 		throw std::system_error(SSL_get_error(ssl_, rc), opensslCategory, "Failed to create TLS BIO pair");
 	}
 	SSL_set_bio(ssl_, internalBio_, internalBio_);
-		}
+	if(context_.session() != nullptr) SSL_set_session(ssl_, context_.session());
+}
 
 ssl::connection::~connection() {
 	SSL_free(ssl_);
@@ -119,8 +123,10 @@ void ssl::connection::verifyPeerCertificate() const {
 
 bool ssl::connection::connect() {
 	const int rc = SSL_connect(ssl_);
+	const int error = (rc <= 0) ? SSL_get_error(ssl_, rc) : SSL_ERROR_NONE;
+	// Each step of the handshake leaves records in the network BIO that nothing else would send
+	writeToSocket();
 	if(rc <= 0) {
-		const int error = SSL_get_error(ssl_, rc);
 		if((error == SSL_ERROR_WANT_READ) || (error == SSL_ERROR_WANT_WRITE)) {
 			return false;
 		} else {
@@ -130,85 +136,121 @@ bool ssl::connection::connect() {
 	return true;
 }
 
-void ssl::connection::readFromSocket() const {
-	constexpr size_t bufferSize = 4096;
-	uint8_t buffer[bufferSize];
-	const ssize_t n = recv(socket_, buffer, bufferSize, 0);
-	if(n == -1) {
-		if((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+bool ssl::connection::readFromSocket() {
+	bool progress = false;
+	for(;;) {
+		// Receive straight into the BIO's ring buffer
+		char* space;
+		const int capacity = BIO_nwrite0(networkBio_, &space);
+		if(capacity <= 0) return progress;
+
+		const ssize_t n = recv(socket_, space, capacity, 0);
+		if(n == -1) {
+			if((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+				socket_.readable(false);
+				return progress;
+			} else {
+				throw std::system_error(errno, std::system_category());
+			}
+		} else if(n == 0) {
 			socket_.readable(false);
-			return;
-		} else {
-			throw std::system_error(errno, std::system_category());
+			closed_ = true;
+			return progress;
 		}
-	} else if(n == 0) {
-		return;
-	}
 
-	const int rc = BIO_write(networkBio_, buffer, n);
-	if(rc == -2) {
-		throw std::runtime_error("BIO_write not implemented for network BIO");
-	} else if(rc <= 0) {
-		throw std::system_error(SSL_get_error(ssl_, rc), opensslCategory, "Failed to read from socket into BIO");
-	} else if(rc != n) {
-		throw std::logic_error("Buffer underflow when reading from socket into BIO");
+		if(BIO_nwrite(networkBio_, &space, n) != n) {
+			throw std::logic_error("Buffer underflow when reading from socket into BIO");
+		}
+		progress = true;
 	}
-	std::cout << "Read " << n << " bytes from socket into BIO" << std::endl;
 }
 
-void ssl::connection::writeToSocket() const {
-	if(BIO_ctrl_pending(networkBio_) <= 0) {
-		return;
-	}
-
-	constexpr size_t bufferSize = 4096;
-	uint8_t buffer[bufferSize];
-	const int rc = BIO_read(networkBio_, buffer, bufferSize);
-	if(rc == -2) {
-		throw std::runtime_error("BIO_read not implemented for network BIO");
-	} else if(rc <= 0) {
-		throw std::system_error(SSL_get_error(ssl_, rc), opensslCategory, "Failed to write to socket from BIO");
-	}
+bool ssl::connection::writeToSocket() {
+	for(;;) {
+		iovec segments[3];
+		int segmentCount = 0;
+		if(outbound_) segments[segmentCount++] = { static_cast<void*>(outbound_), outbound_.remaining() };
+		// The BIO's ring buffer holds at most two contiguous runs of data
+		while(segmentCount < 3) {
+			char* data;
+			const int n = BIO_nread(networkBio_, &data, INT_MAX);
+			if(n <= 0) break;
+			segments[segmentCount++] = { data, static_cast<size_t>(n) };
+		}
+		if(segmentCount == 0) return true;
 
-	const ssize_t n = send(socket_, buffer, rc, 0);
-	if(n == -1) {
-		if((errno == EAGAIN) || (errno == EWOULDBLOCK)) {
+		ssize_t n = writev(socket_, segments, segmentCount);
+		if(n == -1) {
+			if((errno != EAGAIN) && (errno != EWOULDBLOCK)) throw std::system_error(errno, std::system_category());
 			socket_.writable(false);
-			throw std::logic_error("Discarding data because socket would block");
-			return;
-		} else {
-			throw std::system_error(errno, std::system_category());
+			n = 0;
+		}
+
+		// Queue whatever was not sent; the BIO data is only valid until the TLS engine writes again
+		int segment = 0;
+		if(outbound_) {
+			const size_t sent = std::min<size_t>(n, outbound_.remaining());
+			outbound_.advance(sent);
+			n -= sent;
+			++segment;
+			if(!outbound_) outbound_.clear();
 		}
-	} else if(n != rc) {
-		throw std::logic_error("Buffer underflow when writing to socket from BIO");
+		for(; segment < segmentCount; ++segment) {
+			const size_t sent = std::min<size_t>(n, segments[segment].iov_len);
+			n -= sent;
+			if(sent < segments[segment].iov_len) {
+				outbound_.append(static_cast<uint8_t*>(segments[segment].iov_base) + sent,
+						segments[segment].iov_len - sent);
+			}
+		}
+		if(!socket_.writable()) return false;
 	}
-	std::cout << "Wrote " << n << " bytes to socket from BIO" << std::endl;
-}
-
-void ssl::connection::read() const {
-	char buffer[4096];
-	const int rc = SSL_read(ssl_, buffer, 4095);
-	buffer[4095] = '\0';
-	if(rc < 0) {
-		const int error = SSL_get_error(ssl_, rc);
-		if((error == SSL_ERROR_WANT_READ) || (error == SSL_ERROR_WANT_WRITE)) return;
-		throw std::system_error(error, opensslCategory, "Failed to read from TLS engine");
-	} else {
-		buffer[rc] = '\0';
-		std::cout << "Read " << rc << " bytes form TLS engine: <" << buffer << '>' << std::endl;
+}
+
+void ssl::connection::read(const std::function<void(const char*, std::size_t)>& sink) {
+	char buffer[16384];
+	for(;;) {
+		const int rc = SSL_read(ssl_, buffer, sizeof(buffer));
+		if(rc <= 0) {
+			const int error = SSL_get_error(ssl_, rc);
+			if(error == SSL_ERROR_WANT_READ) {
+				// Keep going while the socket has more to give, so that the readiness edge is fully consumed
+				if(socket_.readable() && readFromSocket()) continue;
+				return;
+			} else if(error == SSL_ERROR_WANT_WRITE) {
+				if(writeToSocket()) continue;
+				return;
+			} else if(error == SSL_ERROR_ZERO_RETURN) {
+				closed_ = true;
+				return;
+			}
+			throw std::system_error(error, opensslCategory, "Failed to read from TLS engine");
+		}
+		sink(buffer, rc);
 	}
 }
 
-void ssl::connection::write(util::buffer& buffer) const {
-	const int rc = SSL_write(ssl_, buffer, buffer.remaining());
-	if(rc <= 0) {
-		const int error = SSL_get_error(ssl_, rc);
-		if((error == SSL_ERROR_WANT_READ) || (error == SSL_ERROR_WANT_WRITE)) {
-			return;
+void ssl::connection::write(util::buffer& buffer) {
+	while(buffer) {
+		const int rc = SSL_write(ssl_, buffer, buffer.remaining());
+		if(rc <= 0) {
+			const int error = SSL_get_error(ssl_, rc);
+			// A full network BIO makes the engine ask for a write; retry once the socket has taken its content
+			if((error == SSL_ERROR_WANT_WRITE) && writeToSocket()) continue;
+			if((error == SSL_ERROR_WANT_READ) || (error == SSL_ERROR_WANT_WRITE)) return;
+			throw std::system_error(error, opensslCategory, "Failed to write to TLS engine");
 		}
-		throw std::system_error(error, opensslCategory, "Failed to write to TLS engine");
-	} else {
-		std::cout << "Wrote " << rc << " bytes to TLS engine" << std::endl;
 		buffer.advance(rc);
 	}
+	writeToSocket();
+}
+
+void ssl::connection::shutdown() {
+	if(!initFinished()) return;
+	SSL_shutdown(ssl_);
+	try {
+		writeToSocket();
+	} catch(const std::system_error&) {
+		// The peer may be gone already; the session is kept either way
+	}
 }
@@ -1,26 +1,40 @@
 // Copyright (C) 2015 Philip Cronje. All rights reserved.
 #pragma once
 
+#include <cstddef>
+#include <functional>
+
 #include <openssl/ssl.h>
 
 #include "net.h"
 #include "util.h"
 
 namespace ssl {
+	/* Loads OpenSSL's error strings up front; OpenSSL releases what it holds itself when the process exits. */
 	struct library {
 		library();
-		~library();
 	};
 
+	/* A client context that remembers the latest session any of its connections established, including TLS 1.3
+	 * session tickets, and offers it to the next connection for resumption. */
 	class context {
 		SSL_CTX* context_;
+		mutable SSL_SESSION* session_ = nullptr;
+
+		static int newSession(SSL* ssl, SSL_SESSION* session);
 
 		public:
 			context();
-			~context() noexcept { SSL_CTX_free(context_); }
+			context(const context&) = delete;
+			~context() noexcept {
+				if(session_ != nullptr) SSL_SESSION_free(session_);
+				SSL_CTX_free(context_);
+			}
 
 			operator SSL_CTX*() const noexcept { return context_; }
 
+			SSL_SESSION* session() const noexcept { return session_; }
+
 			void setDefaultVerifyPaths() const noexcept { SSL_CTX_set_default_verify_paths(context_); }
 	};
 
@@ -44,6 +58,9 @@ namespace ssl {
 		BIO* networkBio_;
 		net::socket& socket_;
 		SSL* ssl_;
+		// Bytes taken from the network BIO that the socket has not accepted yet
+		util::buffer outbound_;
+		bool closed_ = false;
 
 		public:
 			connection(const context& context, net::socket& socket);
@@ -52,6 +69,8 @@ namespace ssl {
 			operator SSL*() const noexcept { return ssl_; }
 
 			bool inConnectInit() const noexcept { return SSL_in_connect_init(ssl_); }
+			/* Whether the handshake resumed a previous session rather than performing a full key exchange. */
+			bool resumed() const noexcept { return SSL_session_reused(ssl_); }
 			bool initFinished() const noexcept { return SSL_is_init_finished(ssl_); }
 
 			x509 peerCertificate() const noexcept;
@@ -59,10 +78,22 @@ namespace ssl {
 
 			bool connect();
 
-			void readFromSocket() const;
-			void writeToSocket() const;
+			/* Moves data from the socket into the network BIO until the socket would block, the peer closes the
+			 * connection or the BIO is full. Returns whether anything was read. */
+			bool readFromSocket();
+			/* Sends the outbound queue and everything pending in the network BIO, gathering both into each send.
+			 * Whatever the socket does not accept stays queued. Returns whether everything was sent. */
+			bool writeToSocket();
+
+			/* Whether the peer has closed the connection, at either the TCP or the TLS level. */
+			bool closed() const noexcept { return closed_; }
+
+			/* Hands all application data the TLS engine can decrypt to sink. */
+			void read(const std::function<void(const char*, std::size_t)>& sink);
+			void write(util::buffer& buffer);
 
-			void read() const;
-			void write(util::buffer& buffer) const;
+			/* Sends close_notify. A connection dropped without one takes its session with it, as OpenSSL will
+			 * not resume a session that may have been truncated. */
+			void shutdown();
 	};
 }
@@ -0,0 +1,275 @@
+// Copyright (C) 2015 Philip Cronje. All rights reserved.
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <system_error>
+
+#include <dirent.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include "stat-cgroup.h"
+
+namespace {
+	constexpr std::uint32_t watchedEvents = IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_MODIFY
+		| IN_ONLYDIR;
+
+	// Interface files are small, bar io.stat on hosts with many devices, which grows its buffer as it needs to
+	constexpr std::size_t fileCapacity = 512;
+
+	/* Opens an interface file, or yields nothing if the cgroup does not have it, as when its controller is not
+	 * enabled. */
+	std::unique_ptr<procfs::file> openIfPresent(const std::string& path) {
+		try {
+			return std::make_unique<procfs::file>(path.c_str(), fileCapacity);
+		} catch(const std::system_error&) {
+			return nullptr;
+		}
+	}
+
+	std::string child(const std::string& parent, const char* name) {
+		return (parent == "/") ? parent + name : parent + "/" + name;
+	}
+}
+
+unsigned long long stat::cgroupValue(procfs::scanner scanner, const std::string_view key) noexcept {
+	while(!scanner.atEnd()) {
+		if(scanner.word() == key) return scanner.number();
+		scanner.skipLine();
+	}
+	return 0;
+}
+
+std::pair<unsigned long long, unsigned long long> stat::cgroupIoBytes(procfs::scanner scanner) noexcept {
+	std::pair<unsigned long long, unsigned long long> bytes { 0, 0 };
+	while(!scanner.atEnd()) {
+		// Each line is a device number followed by key=value pairs
+		scanner.word();
+		for(std::string_view field = scanner.word(); !field.empty(); field = scanner.word()) {
+			procfs::scanner value(field.data(), field.data() + field.size());
+			if(value.consume("rbytes=", 7)) {
+				bytes.first += value.number();
+			} else if(value.consume("wbytes=", 7)) {
+				bytes.second += value.number();
+			}
+		}
+		scanner.skipLine();
+	}
+	return bytes;
+}
+
+stat::cgroupCollector::cgroupCollector(const std::string& root, const std::chrono::milliseconds interval,
+		const std::chrono::milliseconds flushPeriod)
+		: collector(interval, flushPeriod), root_(root), inotify_(inotify_init1(IN_NONBLOCK | IN_CLOEXEC)),
+		sampledAt_(clock::now()) {
+	if(inotify_ == -1) throw std::system_error(errno, std::system_category(), "Failed to create inotify instance");
+	if(access(root.c_str(), F_OK) != 0) {
+		const int error = errno;
+		close(inotify_);
+		throw std::system_error(error, std::system_category(), "Failed to open " + root);
+	}
+	add("/");
+	sample();
+	reset();
+}
+
+stat::cgroupCollector::~cgroupCollector() noexcept {
+	close(inotify_);
+}
+
+void stat::cgroupCollector::add(const std::string& path) {
+	const std::string directory = root_ + path;
+	if(cgroups_.find(path) == cgroups_.end()) {
+		const int watch = inotify_add_watch(inotify_, directory.c_str(), watchedEvents);
+		// A cgroup that is already gone again is left to the event of its removal
+		if((watch == -1) && (errno == ENOENT)) return;
+
+		std::unique_ptr<cgroup> added = std::make_unique<cgroup>(path, watch);
+		added->cpuStat = openIfPresent(directory + "/cpu.stat");
+		added->memoryCurrent = openIfPresent(directory + "/memory.current");
+		added->ioStat = openIfPresent(directory + "/io.stat");
+		added->memoryEvents = openIfPresent(directory + "/memory.events");
+		added->events = openIfPresent(directory + "/cgroup.events");
+		if(added->memoryEvents != nullptr) added->oomKills = cgroupValue(added->memoryEvents->scan(), "oom_kill");
+		if(added->events != nullptr) added->populated = cgroupValue(added->events->scan(), "populated") != 0;
+		// Past the limit on watches, a cgroup is still collected, though its children are only found by a rescan
+		if(watch != -1) watches_[watch] = path;
+		cgroups_.emplace(path, std::move(added));
+		changed_ = true;
+	}
+
+	// Children made before the watch was in place raise no events of their own
+	DIR* listing = opendir(directory.c_str());
+	if(listing == nullptr) return;
+	while(const dirent* entry = readdir(listing)) {
+		if((entry->d_type != DT_DIR) || (std::strcmp(entry->d_name, ".") == 0)
+				|| (std::strcmp(entry->d_name, "..") == 0)) {
+			continue;
+		}
+		add(child(path, entry->d_name));
+	}
+	closedir(listing);
+}
+
+void stat::cgroupCollector::remove(const std::string& path) {
+	// Descendants follow the cgroup itself in path order, though not necessarily straight after it
+	for(auto entry = cgroups_.lower_bound(path);
+			(entry != cgroups_.end()) && (entry->first.compare(0, path.size(), path) == 0);) {
+		if((entry->first.size() != path.size()) && (entry->first[path.size()] != '/') && (path != "/")) {
+			++entry;
+			continue;
+		}
+		const int watch = entry->second->watch;
+		if(watch != -1) {
+			// The watch of a deleted directory is already gone, but not that of one moved away
+			inotify_rm_watch(inotify_, watch);
+			watches_.erase(watch);
+		}
+		entry = cgroups_.erase(entry);
+		changed_ = true;
+	}
+}
+
+void stat::cgroupCollector::rescan() {
+	add("/");
+	std::vector<std::string> removed;
+	for(const auto& entry: cgroups_) {
+		if(access((root_ + entry.first).c_str(), F_OK) != 0) removed.push_back(entry.first);
+	}
+	for(const std::string& path: removed) remove(path);
+}
+
+void stat::cgroupCollector::drain() {
+	alignas(inotify_event) char buffer[8192];
+	bool overflowed = false;
+	for(;;) {
+		const ssize_t size = ::read(inotify_, buffer, sizeof(buffer));
+		if(size == -1) {
+			if(errno == EINTR) continue;
+			if(errno == EAGAIN) break;
+			throw std::system_error(errno, std::system_category(), "Failed to read inotify events");
+		}
+		for(const char* next = buffer; next < buffer + size;) {
+			const inotify_event* event = reinterpret_cast<const inotify_event*>(next);
+			next += sizeof(inotify_event) + event->len;
+			if(event->mask & IN_Q_OVERFLOW) {
+				overflowed = true;
+				continue;
+			}
+			const auto watch = watches_.find(event->wd);
+			if(watch == watches_.end()) continue;
+			if(event->mask & IN_IGNORED) {
+				watches_.erase(watch);
+				continue;
+			}
+			if(event->len == 0) continue;
+
+			const std::string parent = watch->second;
+			if(event->mask & IN_ISDIR) {
+				if(event->mask & (IN_CREATE | IN_MOVED_TO)) {
+					add(child(parent, event->name));
+				} else if(event->mask & (IN_DELETE | IN_MOVED_FROM)) {
+					remove(child(parent, event->name));
+				}
+			} else if(event->mask & IN_MODIFY) {
+				const auto entry = cgroups_.find(parent);
+				if(entry == cgroups_.end()) continue;
+				cgroup& cgroup = *entry->second;
+				if(std::strcmp(event->name, "memory.events") == 0) {
+					cgroup.memoryEventsChanged = true;
+				} else if((std::strcmp(event->name, "cgroup.events") == 0) && (cgroup.events != nullptr)) {
+					try {
+						cgroup.events->read();
+						cgroup.populated = cgroupValue(cgroup.events->scan(), "populated") != 0;
+					} catch(const std::system_error&) {
+						// The cgroup is being removed, which its parent will hear of
+					}
+				}
+			}
+		}
+	}
+	if(overflowed) rescan();
+}
+
+void stat::cgroupCollector::read(cgroup& cgroup, const double seconds) {
+	// A cgroup whose last process was killed is no longer populated, but its kills still count
+	if(cgroup.memoryEvents != nullptr) {
+		unsigned long long oomKills = cgroup.oomKills;
+		if(std::exchange(cgroup.memoryEventsChanged, false)) {
+			cgroup.memoryEvents->read();
+			oomKills = cgroupValue(cgroup.memoryEvents->scan(), "oom_kill");
+		}
+		cgroup.kills += counterDelta(cgroup.oomKills, oomKills, 64);
+		cgroup.oomKills = oomKills;
+	}
+	if(!cgroup.populated) {
+		cgroup.primed = false;
+		return;
+	}
+
+	const bool primed = std::exchange(cgroup.primed, true) && (seconds > 0);
+	if(cgroup.cpuStat != nullptr) {
+		cgroup.cpuStat->read();
+		const unsigned long long cpuUsec = cgroupValue(cgroup.cpuStat->scan(), "usage_usec");
+		// As with processes, a percentage of one CPU
+		if(primed) cgroup.cpu += counterDelta(cgroup.cpuUsec, cpuUsec, 64) / 1e4 / seconds;
+		cgroup.cpuUsec = cpuUsec;
+	}
+	if(cgroup.memoryCurrent != nullptr) {
+		cgroup.memoryCurrent->read();
+		cgroup.memory += cgroup.memoryCurrent->scan().number();
+	}
+	if(cgroup.ioStat != nullptr) {
+		cgroup.ioStat->read();
+		const std::pair<unsigned long long, unsigned long long> bytes = cgroupIoBytes(cgroup.ioStat->scan());
+		if(primed) {
+			cgroup.reads += counterDelta(cgroup.readBytes, bytes.first, 64) / seconds;
+			cgroup.writes += counterDelta(cgroup.writeBytes, bytes.second, 64) / seconds;
+		}
+		cgroup.readBytes = bytes.first;
+		cgroup.writeBytes = bytes.second;
+	}
+}
+
+std::vector<stat::metric> stat::cgroupCollector::metrics() {
+	changed_ = false;
+	std::vector<metric> metrics;
+	metrics.reserve(5 * cgroups_.size());
+	const auto add = [&metrics](const std::string& name, const aggregation<double>& statistics,
+			const std::string& unit, const std::string& path) {
+		metrics.emplace_back(name, &statistics, unit);
+		metrics.back().dimensions = { { "CGroup", path } };
+	};
+	for(const auto& [path, cgroup]: cgroups_) {
+		if(cgroup->cpuStat != nullptr) add("CGroupCPU", cgroup->cpu, "Percent", path);
+		if(cgroup->memoryCurrent != nullptr) add("CGroupMemory", cgroup->memory, "Bytes", path);
+		if(cgroup->ioStat != nullptr) {
+			add("CGroupIORead", cgroup->reads, "Bytes/Second", path);
+			add("CGroupIOWrite", cgroup->writes, "Bytes/Second", path);
+		}
+		if(cgroup->memoryEvents != nullptr) add("CGroupOOMKills", cgroup->kills, "Count", path);
+	}
+	return metrics;
+}
+
+void stat::cgroupCollector::sample() {
+	drain();
+	const clock::time_point now = clock::now();
+	const double seconds = std::chrono::duration<double>(now - sampledAt_).count();
+	sampledAt_ = now;
+	for(const auto& entry: cgroups_) {
+		try {
+			read(*entry.second, seconds);
+		} catch(const std::system_error&) {
+			// A cgroup removed since the events were drained can no longer be read; its removal comes next sample
+			entry.second->primed = false;
+		}
+	}
+}
+
+void stat::cgroupCollector::reset() {
+	for(const auto& entry: cgroups_) {
+		cgroup& cgroup = *entry.second;
+		cgroup.cpu = cgroup.memory = cgroup.reads = cgroup.writes = cgroup.kills = aggregation<double>();
+	}
+}
@@ -0,0 +1,80 @@
+// Copyright (C) 2015 Philip Cronje. All rights reserved.
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "collector.h"
+#include "procfs.h"
+#include "stat.h"
+
+namespace stat {
+	/* Finds the value of a "key value" line, as in cpu.stat, memory.events and cgroup.events. Yields 0 if the key is
+	 * missing. */
+	unsigned long long cgroupValue(procfs::scanner scanner, std::string_view key) noexcept;
+
+	/* Sums the bytes read and written over the devices of an io.stat file. */
+	std::pair<unsigned long long, unsigned long long> cgroupIoBytes(procfs::scanner scanner) noexcept;
+
+	/* Collects the CPU usage, memory use, I/O throughput and OOM kills of every cgroup in a cgroup v2 hierarchy, each
+	 * published with the cgroup's path as a dimension.
+	 *
+	 * The hierarchy is walked once, and then followed through inotify watches on every cgroup directory, so that
+	 * cgroups created or removed between samples cost one event each rather than a walk. The interface files of each
+	 * cgroup are held open and re-read in place. Empty cgroups, and memory.events of those without new memory
+	 * events, are only read again when the kernel reports a change to cgroup.events or memory.events, so that the
+	 * cost of a sample follows the cgroups that are running something rather than every cgroup ever created. Should
+	 * the event queue overflow, the hierarchy is walked again. */
+	class cgroupCollector : public collector {
+		typedef std::chrono::steady_clock clock;
+
+		struct cgroup {
+			cgroup(const std::string& path, const int watch) : path(path), watch(watch) {}
+
+			// Relative to the root of the hierarchy, which is "/" itself
+			std::string path;
+			int watch;
+			std::unique_ptr<procfs::file> cpuStat, memoryCurrent, ioStat, memoryEvents, events;
+			bool populated = true;
+			bool memoryEventsChanged = false;
+			bool primed = false;
+			unsigned long long cpuUsec = 0, readBytes = 0, writeBytes = 0, oomKills = 0;
+			aggregation<double> cpu, memory, reads, writes, kills;
+		};
+
+		const std::string root_;
+		const int inotify_;
+		std::unordered_map<int, std::string> watches_;
+		// Sorted by path, with each cgroup's aggregations staying put until it is removed
+		std::map<std::string, std::unique_ptr<cgroup>> cgroups_;
+		clock::time_point sampledAt_;
+		bool changed_ = false;
+
+		void add(const std::string& path);
+		void remove(const std::string& path);
+		void rescan();
+		void drain();
+		void read(cgroup& cgroup, double seconds);
+
+		public:
+			explicit cgroupCollector(const std::string& root = "/sys/fs/cgroup",
+					std::chrono::milliseconds interval = std::chrono::seconds(1),
+					std::chrono::milliseconds flushPeriod = std::chrono::seconds(60));
+			cgroupCollector(const cgroupCollector&) = delete;
+			~cgroupCollector() noexcept;
+
+			std::size_t tracked() const noexcept { return cgroups_.size(); }
+
+			std::vector<metric> metrics() override;
+			bool metricsChanged() const override { return changed_; }
+			void sample() override;
+			void reset() override;
+	};
+}
@@ -1,6 +1,8 @@
 // Copyright (C) 2015 Philip Cronje. All rights reserved.
 #include <cstring>
 #include <numeric>
+#include <stdexcept>
+#include <string>
 #include <vector>
 
 #include "stat-cpu.h"
@@ -10,10 +12,48 @@ namespace {
 		User = 0,
 		UserNice = 1,
 		System = 2,
+		Idle = 3,
 		IoWait = 4
 	};
 
 	void skipLine(std::istream& stream) { while(!(stream.eof() || stream.bad()) && (stream.get() != '\n')); }
+
+	// /proc/stat currently reports ten counters per CPU; leave room for a few more
+	constexpr std::size_t maxValues = 16;
+
+	/* Reads the counters remaining on the current line, stopping at the first token that is not a number. */
+	std::size_t readValues(procfs::scanner& scanner, unsigned long long* values) {
+		std::size_t count = 0;
+		while((count < maxValues) && scanner.hasNumber()) values[count++] = scanner.number();
+		scanner.skipLine();
+		return count;
+	}
+
+	struct coreSample {
+		unsigned int core;
+		unsigned long long total, busy;
+	};
+
+	/* Reads the next cpuN line, skipping any others (including the combined "cpu " line). Returns false once the
+	 * input is exhausted. */
+	bool readCore(procfs::scanner& scanner, coreSample& sample) {
+		while(!scanner.atEnd()) {
+			if(!scanner.consume("cpu", 3) || (static_cast<unsigned char>(scanner.peek() - '0') >= 10)) {
+				scanner.skipLine();
+				continue;
+			}
+
+			sample.core = scanner.number();
+			unsigned long long values[maxValues];
+			const std::size_t count = readValues(scanner, values);
+			if(count <= IoWait) continue;
+
+			sample.total = std::accumulate(values, values + count, 0ULL);
+			sample.busy = sample.total - values[Idle] - values[IoWait];
+			return true;
+		}
+		return false;
+	}
 }
 
 stat::cpu::cpu(std::istream&& stream) {
@@ -44,3 +84,114 @@ stat::cpu::cpu(std::istream&& stream) {
 		break;
 	}
 }
+
+stat::cpu::cpu(procfs::scanner scanner) {
+	while(!scanner.atEnd()) {
+		// Find the line containing the combined CPU counters
+		if(!scanner.consume("cpu ", 4)) {
+			scanner.skipLine();
+			continue;
+		}
+
+		unsigned long long values[maxValues];
+		const std::size_t count = readValues(scanner, values);
+		if(count <= IoWait) throw std::runtime_error("Too few values in combined CPU counters");
+
+		total = std::accumulate(values, values + count, 0ULL);
+		user = values[User] + values[UserNice];
+		system = values[System];
+		ioWait = values[IoWait];
+		return;
+	}
+	throw std::runtime_error("No combined CPU counters found");
+}
+
+stat::cores::cores(procfs::scanner scanner) : count_(0) {
+	std::vector<coreSample> samples;
+	for(coreSample sample; readCore(scanner, sample);) {
+		samples.push_back(sample);
+		count_ = std::max<std::size_t>(count_, sample.core + 1);
+	}
+
+	counters_.resize(2 * CounterCount * count_);
+	busy_.resize(count_);
+	active_.resize(count_);
+	rank_.resize(count_);
+	for(const coreSample& sample: samples) {
+		counters(current_, Total)[sample.core] = sample.total;
+		counters(current_, Busy)[sample.core] = sample.busy;
+	}
+}
+
+void stat::cores::parse(procfs::scanner& scanner) {
+	unsigned long long* total = counters(current_, Total);
+	unsigned long long* busy = counters(current_, Busy);
+	for(coreSample sample; readCore(scanner, sample);) {
+		// Cores brought online after start-up are not tracked
+		if(sample.core >= count_) continue;
+		total[sample.core] = sample.total;
+		busy[sample.core] = sample.busy;
+	}
+}
+
+void stat::cores::update(procfs::scanner scanner) {
+	const unsigned previous = current_;
+	current_ ^= 1;
+	// Carry the previous counters over so that cores missing from this sample show no activity
+	std::copy_n(counters(previous, Total), CounterCount * count_, counters(current_, Total));
+	parse(scanner);
+
+	const unsigned long long* total = counters(current_, Total);
+	const unsigned long long* busy = counters(current_, Busy);
+	const unsigned long long* previousTotal = counters(previous, Total);
+	const unsigned long long* previousBusy = counters(previous, Busy);
+	for(std::size_t core = 0; core < count_; ++core) {
+		const unsigned long long dTotal = total[core] - previousTotal[core];
+		active_[core] = dTotal != 0;
+		busy_[core] = toPercent<double>(busy[core] - previousBusy[core], dTotal != 0 ? dTotal : 1);
+	}
+}
+
+stat::cpuCollector::cpuCollector(const unsigned int hottestCores, const bool perCore, const bool distributions,
+		const std::chrono::milliseconds interval, const std::chrono::milliseconds flushPeriod)
+		: collector(interval, flushPeriod), procStat_("/proc/stat"), cpu_(cpu(), cpu(procStat_.scan())),
+		cores_(procStat_.scan()), perCore_(perCore), distributions_(distributions),
+		coreAggregations_(perCore ? cores_.count() : hottestCores) {}
+
+std::vector<stat::metric> stat::cpuCollector::metrics() {
+	std::vector<metric> metrics;
+	if(distributions_) {
+		metrics = { { "UserCPU", &userDistribution_ }, { "SystemCPU", &systemDistribution_ },
+			{ "IOWaitCPU", &ioWaitDistribution_ } };
+	} else {
+		metrics = { { "UserCPU", &user_ }, { "SystemCPU", &system_ }, { "IOWaitCPU", &ioWait_ } };
+	}
+	for(std::size_t i = 0; i < coreAggregations_.size(); ++i) {
+		metrics.emplace_back(perCore_ ? "Core" + std::to_string(i) + "BusyCPU"
+				: "HottestCore" + std::to_string(i + 1) + "BusyCPU", &coreAggregations_[i]);
+	}
+	return metrics;
+}
+
+void stat::cpuCollector::sample() {
+	procStat_.read();
+	swapIn(cpu_, cpu(procStat_.scan()));
+	if(distributions_) {
+		cpu_.second.aggregate(cpu_.first, userDistribution_, systemDistribution_, ioWaitDistribution_);
+	} else {
+		cpu_.second.aggregate(cpu_.first, user_, system_, ioWait_);
+	}
+
+	cores_.update(procStat_.scan());
+	if(perCore_) {
+		cores_.aggregate(coreAggregations_.data());
+	} else {
+		cores_.aggregateHottest(coreAggregations_.data(), coreAggregations_.size());
+	}
+}
+
+void stat::cpuCollector::reset() {
+	user_ = system_ = ioWait_ = aggregation<double>();
+	userDistribution_ = systemDistribution_ = ioWaitDistribution_ = histogram<double>();
+	for(aggregation<double>& coreAggregation: coreAggregations_) coreAggregation = aggregation<double>();
+}
@@ -1,8 +1,15 @@
 // Copyright (C) 2015 Philip Cronje. All rights reserved.
 #pragma once
 
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
 #include <istream>
+#include <utility>
+#include <vector>
 
+#include "collector.h"
+#include "procfs.h"
 #include "stat.h"
 
 namespace stat {
@@ -12,14 +19,94 @@ namespace stat {
 
 		cpu() = default;
 		explicit cpu(std::istream&& stream);
+		explicit cpu(procfs::scanner scanner);
 
-		template<typename V, typename T>
-		void aggregate(const cpu& previous, aggregation<V, T>& user, aggregation<V, T>& system,
-				aggregation<V, T>& ioWait) {
+		/* Adds the percentages since the previous sample to any aggregation type accepting a double, such as
+		 * aggregation or histogram. */
+		template<typename A>
+		void aggregate(const cpu& previous, A& user, A& system, A& ioWait) {
 			const unsigned long long dTotal = total - previous.total;
-			user += toPercent<V>(this->user - previous.user, dTotal);
-			system += toPercent<V>(this->system - previous.system, dTotal);
-			ioWait += toPercent<V>(this->ioWait - previous.ioWait, dTotal);
+			user += toPercent<double>(this->user - previous.user, dTotal);
+			system += toPercent<double>(this->system - previous.system, dTotal);
+			ioWait += toPercent<double>(this->ioWait - previous.ioWait, dTotal);
 		}
 	};
+
+	/* Per-core counters from the cpuN lines of /proc/stat. Storage is laid out as a structure of arrays, sized once
+	 * from the number of cores present at construction, and holds both the previous and current snapshot so that
+	 * updating and aggregating never allocates. A core is busy for any time that is not accounted as idle or I/O
+	 * wait. */
+	class cores {
+		enum counter { Total = 0, Busy = 1, CounterCount = 2 };
+
+		std::size_t count_;
+		unsigned current_ = 0;
+		// Indexed as [snapshot][counter][core]
+		std::vector<unsigned long long> counters_;
+		std::vector<double> busy_;
+		// Cores that had no ticks in the last interval (e.g. offline) are excluded from aggregation
+		std::vector<unsigned char> active_;
+		std::vector<std::size_t> rank_;
+
+		unsigned long long* counters(const unsigned snapshot, const counter counter) noexcept {
+			return counters_.data() + (snapshot * CounterCount + counter) * count_;
+		}
+
+		void parse(procfs::scanner& scanner);
+
+		public:
+			explicit cores(procfs::scanner scanner);
+
+			std::size_t count() const noexcept { return count_; }
+			double busy(const std::size_t core) const noexcept { return busy_[core]; }
+
+			void update(procfs::scanner scanner);
+
+			/* Adds each core's busy percentage to the corresponding element of busy, which must hold count()
+			 * aggregations. */
+			template<typename V, typename T>
+			void aggregate(aggregation<V, T>* busy) const {
+				for(std::size_t core = 0; core < count_; ++core) {
+					if(active_[core]) busy[core] += busy_[core];
+				}
+			}
+
+			/* Adds the busy percentage of the n busiest cores to hottest, ordered from busiest to least busy, so
+			 * that hottest[0] tracks whichever core was hottest at each sample. */
+			template<typename V, typename T>
+			void aggregateHottest(aggregation<V, T>* hottest, std::size_t n) {
+				std::size_t active = 0;
+				for(std::size_t core = 0; core < count_; ++core) {
+					if(active_[core]) rank_[active++] = core;
+				}
+				if(n > active) n = active;
+				std::partial_sort(rank_.begin(), rank_.begin() + n, rank_.begin() + active,
+						[this](const std::size_t a, const std::size_t b) { return busy_[a] > busy_[b]; });
+				for(std::size_t i = 0; i < n; ++i) hottest[i] += busy_[rank_[i]];
+			}
+	};
+
+	/* Collects combined CPU usage from /proc/stat and, optionally, the busy percentage of the hottest or of every
+	 * core. Combined usage can be published as distributions rather than statistics, to make percentiles available.
+	 */
+	class cpuCollector : public collector {
+		procfs::file procStat_;
+		std::pair<cpu, cpu> cpu_;
+		cores cores_;
+		const bool perCore_;
+		const bool distributions_;
+
+		aggregation<double> user_, system_, ioWait_;
+		histogram<double> userDistribution_, systemDistribution_, ioWaitDistribution_;
+		std::vector<aggregation<double>> coreAggregations_;
+
+		public:
+			cpuCollector(const unsigned int hottestCores, const bool perCore, const bool distributions,
+					const std::chrono::milliseconds interval = std::chrono::seconds(1),
+					const std::chrono::milliseconds flushPeriod = std::chrono::seconds(60));
+
+			std::vector<metric> metrics() override;
+			void sample() override;
+			void reset() override;
+	};
 }
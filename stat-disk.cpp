@@ -0,0 +1,184 @@
+// Copyright (C) 2015 Philip Cronje. All rights reserved.
+#include <algorithm>
+#include <cstring>
+#include <unordered_map>
+#include <utility>
+
+#include <unistd.h>
+
+#include "stat-disk.h"
+
+namespace {
+	constexpr double sectorSize = 512;
+
+	/* Reads the counters following a device's name, which are ignored if the line has too few. */
+	bool readCounters(procfs::scanner& scanner, stat::diskCounters& counters) {
+		unsigned long long values[11];
+		std::size_t count = 0;
+		while((count < 11) && scanner.hasNumber()) values[count++] = scanner.number();
+		scanner.skipLine();
+		if(count < 11) return false;
+		counters.reads = values[0];
+		counters.readSectors = values[2];
+		counters.readTime = values[3];
+		counters.writes = values[4];
+		counters.writeSectors = values[6];
+		counters.writeTime = values[7];
+		counters.ioTime = values[9];
+		counters.weightedTime = values[10];
+		return true;
+	}
+
+	/* Moves past the major and minor numbers at the start of a line, returning the device name. */
+	std::string_view readName(procfs::scanner& scanner) {
+		scanner.number();
+		scanner.number();
+		return scanner.word();
+	}
+}
+
+stat::disks::disks(const procfs::scanner scanner, filter wanted) : wanted_(std::move(wanted)) {
+	rebuild(scanner);
+	update(scanner, std::chrono::duration<double>(0));
+}
+
+bool stat::disks::wholeDisk(const std::string& name) {
+	for(const char* prefix: { "loop", "ram", "zram" }) {
+		if(name.compare(0, std::strlen(prefix), prefix) == 0) return false;
+	}
+	// Names holding a slash, such as cciss/c0d0, have it replaced by a '!' in sysfs
+	std::string path = "/sys/block/" + name;
+	std::replace(path.begin() + 11, path.end(), '/', '!');
+	return (access(path.c_str(), F_OK) == 0) || (access("/sys/block", F_OK) != 0);
+}
+
+bool stat::disks::matches(procfs::scanner scanner) const {
+	for(const std::string& line: lines_) {
+		if(scanner.atEnd() || (readName(scanner) != line)) return false;
+		scanner.skipLine();
+	}
+	return scanner.atEnd();
+}
+
+void stat::disks::rebuild(procfs::scanner scanner) {
+	std::unordered_map<std::string, device> previous;
+	for(device& device: devices_) previous.emplace(device.name, std::move(device));
+
+	lines_.clear();
+	slots_.clear();
+	devices_.clear();
+	while(!scanner.atEnd()) {
+		const std::string name(readName(scanner));
+		scanner.skipLine();
+		lines_.push_back(name);
+		const auto remaining = previous.find(name);
+		if(remaining != previous.end()) {
+			slots_.push_back(devices_.size());
+			devices_.push_back(std::move(remaining->second));
+		} else if(!name.empty() && wanted_(name)) {
+			slots_.push_back(devices_.size());
+			devices_.push_back(device { name });
+		} else {
+			slots_.push_back(ignored);
+		}
+	}
+}
+
+bool stat::disks::update(procfs::scanner scanner, const std::chrono::duration<double> elapsed) {
+	const bool rebuilt = !matches(scanner);
+	if(rebuilt) rebuild(scanner);
+
+	for(const std::size_t slot: slots_) {
+		readName(scanner);
+		if(slot == ignored) {
+			scanner.skipLine();
+			continue;
+		}
+		device& device = devices_[slot];
+		device.measured = false;
+		diskCounters counters;
+		if(!readCounters(scanner, counters)) continue;
+
+		swapIn(device.counters, std::move(counters));
+		const bool primed = std::exchange(device.primed, true);
+		if(!primed || (elapsed.count() <= 0)) continue;
+
+		const diskCounters& previous = device.counters.first;
+		const diskCounters& current = device.counters.second;
+		const double seconds = elapsed.count();
+		device.measured = true;
+		// Counts are kept in longs, and times in milliseconds in 32-bit fields, which wrap after 49 days
+		device.operations = counterDelta(previous.reads, current.reads, longCounterWidth)
+			+ counterDelta(previous.writes, current.writes, longCounterWidth);
+		device.iops = device.operations / seconds;
+		device.throughput = (counterDelta(previous.readSectors, current.readSectors, longCounterWidth)
+			+ counterDelta(previous.writeSectors, current.writeSectors, longCounterWidth)) * sectorSize / seconds;
+		device.queueDepth = counterDelta(previous.weightedTime, current.weightedTime, 32) / (seconds * 1000);
+		device.latency = (device.operations == 0) ? 0
+			: static_cast<double>(counterDelta(previous.readTime, current.readTime, 32)
+				+ counterDelta(previous.writeTime, current.writeTime, 32)) / device.operations;
+	}
+	return rebuilt;
+}
+
+stat::diskCollector::diskCollector(const char* path, disks::filter wanted, const std::chrono::milliseconds interval,
+		const std::chrono::milliseconds flushPeriod) : collector(interval, flushPeriod), procDiskstats_(path),
+		disks_(procDiskstats_.scan(), std::move(wanted)), sampled_(clock::now()) {
+	rebuild();
+}
+
+void stat::diskCollector::rebuild() {
+	std::unordered_map<std::string, std::size_t> previous;
+	for(std::size_t i = 0; i < names_.size(); ++i) previous.emplace(names_[i], i);
+
+	std::vector<std::string> names;
+	std::vector<std::array<aggregation<double>, StatisticCount>> statistics(disks_.devices().size());
+	for(std::size_t i = 0; i < disks_.devices().size(); ++i) {
+		names.push_back(disks_.devices()[i].name);
+		const auto remaining = previous.find(names.back());
+		if(remaining != previous.end()) statistics[i] = statistics_[remaining->second];
+	}
+	names_ = std::move(names);
+	statistics_ = std::move(statistics);
+}
+
+std::vector<stat::metric> stat::diskCollector::metrics() {
+	changed_ = false;
+	std::vector<metric> metrics;
+	metrics.reserve(StatisticCount * names_.size());
+	for(std::size_t i = 0; i < names_.size(); ++i) {
+		metrics.emplace_back(names_[i] + "IOPS", &statistics_[i][Iops], "Count/Second");
+		metrics.emplace_back(names_[i] + "Throughput", &statistics_[i][Throughput], "Bytes/Second");
+		metrics.emplace_back(names_[i] + "QueueDepth", &statistics_[i][QueueDepth], "Count");
+		metrics.emplace_back(names_[i] + "Latency", &statistics_[i][Latency], "Milliseconds");
+	}
+	return metrics;
+}
+
+void stat::diskCollector::sample() {
+	procDiskstats_.read();
+	const clock::time_point now = clock::now();
+	if(disks_.update(procDiskstats_.scan(), now - sampled_)) {
+		rebuild();
+		changed_ = true;
+	}
+	sampled_ = now;
+
+	const std::vector<disks::device>& devices = disks_.devices();
+	for(std::size_t i = 0; i < devices.size(); ++i) {
+		const disks::device& device = devices[i];
+		if(!device.measured) continue;
+		std::array<aggregation<double>, StatisticCount>& statistics = statistics_[i];
+		statistics[Iops] += device.iops;
+		statistics[Throughput] += device.throughput;
+		statistics[QueueDepth] += device.queueDepth;
+		// An idle interval says nothing about how long operations take
+		if(device.operations != 0) statistics[Latency] += device.latency;
+	}
+}
+
+void stat::diskCollector::reset() {
+	for(std::array<aggregation<double>, StatisticCount>& statistics: statistics_) {
+		statistics.fill(aggregation<double>());
+	}
+}
@@ -0,0 +1,100 @@
+// Copyright (C) 2015 Philip Cronje. All rights reserved.
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "collector.h"
+#include "procfs.h"
+#include "stat.h"
+
+namespace stat {
+	/* The counters of one block device from a line of /proc/diskstats, with times in milliseconds. */
+	struct diskCounters {
+		unsigned long long reads = 0, readSectors = 0, readTime = 0;
+		unsigned long long writes = 0, writeSectors = 0, writeTime = 0;
+		unsigned long long ioTime = 0, weightedTime = 0;
+	};
+
+	/* Per-device rates from /proc/diskstats. Each wanted device has a fixed slot holding its previous and current
+	 * counters, and the devices are matched to the file's lines by name, in order, so that a sample is parsed straight
+	 * into the slots. The slots are only rebuilt when the file's list of devices changes, carrying the counters of
+	 * the devices that remain; whether a device is wanted is decided then too. */
+	class disks {
+		public:
+			/* Decides from its name whether a device is reported. */
+			typedef std::function<bool(const std::string& name)> filter;
+
+			struct device {
+				std::string name;
+				std::pair<diskCounters, diskCounters> counters {};
+				// Whether the device has been sampled before, and so whether the last sample's rates cover an interval
+				bool primed = false;
+				bool measured = false;
+				// Over the last interval: operations and bytes per second, the average number of requests in
+				// flight, and the average milliseconds each operation took, which is only meaningful if any completed
+				unsigned long long operations = 0;
+				double iops = 0, throughput = 0, queueDepth = 0, latency = 0;
+			};
+
+		private:
+			constexpr static std::size_t ignored = static_cast<std::size_t>(-1);
+
+			const filter wanted_;
+			// The device named on each line, and the slot it is parsed into, if it is wanted
+			std::vector<std::string> lines_;
+			std::vector<std::size_t> slots_;
+			std::vector<device> devices_;
+
+			bool matches(procfs::scanner scanner) const;
+			void rebuild(procfs::scanner scanner);
+
+		public:
+			disks(procfs::scanner scanner, filter wanted = wholeDisk);
+
+			/* Whether a device is a whole disk, rather than a partition, and not a loop or RAM device. Partitions are
+			 * told apart by having no directory under /sys/block. */
+			static bool wholeDisk(const std::string& name);
+
+			const std::vector<device>& devices() const noexcept { return devices_; }
+
+			/* Parses a new sample, taken the given time after the previous one, and works out each device's rates.
+			 * Returns true if the slots were rebuilt, which moves every device. */
+			bool update(procfs::scanner scanner, std::chrono::duration<double> elapsed);
+	};
+
+	/* Collects the IOPS, throughput, average queue depth and average latency of every whole disk from
+	 * /proc/diskstats. */
+	class diskCollector : public collector {
+		typedef std::chrono::steady_clock clock;
+
+		enum statistic { Iops = 0, Throughput, QueueDepth, Latency, StatisticCount };
+
+		procfs::file procDiskstats_;
+		disks disks_;
+		clock::time_point sampled_;
+		// Kept in step with the devices' slots
+		std::vector<std::string> names_;
+		std::vector<std::array<aggregation<double>, StatisticCount>> statistics_;
+		bool changed_ = false;
+
+		/* Moves the statistics of devices that remain into their new slots once the slots have been rebuilt. */
+		void rebuild();
+
+		public:
+			diskCollector(const char* path = "/proc/diskstats", disks::filter wanted = disks::wholeDisk,
+					const std::chrono::milliseconds interval = std::chrono::seconds(1),
+					const std::chrono::milliseconds flushPeriod = std::chrono::seconds(60));
+
+			std::vector<metric> metrics() override;
+			bool metricsChanged() const override { return changed_; }
+			void sample() override;
+			void reset() override;
+	};
+}
@@ -0,0 +1,104 @@
+// Copyright (C) 2015 Philip Cronje. All rights reserved.
+#include <cstring>
+#include <string>
+
+#include "stat-memory.h"
+
+namespace {
+	struct published {
+		const char* name;
+		const char* unit;
+		// From the value as reported to the unit it is published in
+		double scale;
+	};
+
+	const published publishedFields[stat::meminfo::FieldCount] = {
+		{ "MemoryAvailable", "Bytes", 1024 },
+		{ "MemoryCached", "Bytes", 1024 },
+		{ "MemoryDirty", "Bytes", 1024 },
+		{ "SwapTotal", "Bytes", 1024 },
+		{ "SwapFree", "Bytes", 1024 },
+		{ "SwapCached", "Bytes", 1024 },
+		{ "HugePagesTotal", "Count", 1 },
+		{ "HugePagesFree", "Count", 1 },
+		{ "HugePagesReserved", "Count", 1 },
+		{ "HugePagesSurplus", "Count", 1 },
+	};
+}
+
+const char* const stat::meminfo::keys[FieldCount] = { "MemAvailable", "Cached", "Dirty", "SwapTotal", "SwapFree",
+	"SwapCached", "HugePages_Total", "HugePages_Free", "HugePages_Rsvd", "HugePages_Surp" };
+
+stat::meminfo::meminfo(const char* data, const std::size_t size) {
+	index(data, size);
+	update(data, size);
+}
+
+void stat::meminfo::index(const char* data, const std::size_t size) {
+	offsets_.fill(missing);
+	for(std::size_t line = 0; line < size;) {
+		const char* colon = static_cast<const char*>(std::memchr(data + line, ':', size - line));
+		if(colon == nullptr) break;
+		const std::size_t length = colon - (data + line);
+		for(unsigned int field = 0; field < FieldCount; ++field) {
+			if((std::strlen(keys[field]) == length) && (std::memcmp(data + line, keys[field], length) == 0)) {
+				offsets_[field] = line;
+				break;
+			}
+		}
+		const void* newline = std::memchr(colon, '\n', size - (colon - data));
+		if(newline == nullptr) break;
+		line = static_cast<const char*>(newline) + 1 - data;
+	}
+}
+
+bool stat::meminfo::indexed(const char* data, const std::size_t size) const noexcept {
+	for(unsigned int field = 0; field < FieldCount; ++field) {
+		const std::size_t offset = offsets_[field];
+		if(offset == missing) continue;
+		const std::size_t length = std::strlen(keys[field]);
+		if((offset + length >= size) || ((offset != 0) && (data[offset - 1] != '\n'))
+				|| (std::memcmp(data + offset, keys[field], length) != 0) || (data[offset + length] != ':')) {
+			return false;
+		}
+	}
+	return true;
+}
+
+void stat::meminfo::update(const char* data, const std::size_t size) {
+	if(!indexed(data, size)) {
+		index(data, size);
+		++reindexed_;
+	}
+	for(unsigned int field = 0; field < FieldCount; ++field) {
+		const std::size_t offset = offsets_[field];
+		if(offset == missing) continue;
+		values_[field] = procfs::scanner(data + offset + std::strlen(keys[field]) + 1, data + size).number();
+	}
+}
+
+stat::memoryCollector::memoryCollector(const char* path, const std::chrono::milliseconds interval,
+		const std::chrono::milliseconds flushPeriod) : collector(interval, flushPeriod), procMeminfo_(path),
+		meminfo_(procMeminfo_.data(), procMeminfo_.size()) {}
+
+std::vector<stat::metric> stat::memoryCollector::metrics() {
+	std::vector<metric> metrics;
+	for(unsigned int field = 0; field < meminfo::FieldCount; ++field) {
+		if(!meminfo_.present(static_cast<meminfo::field>(field))) continue;
+		metrics.emplace_back(publishedFields[field].name, &fields_[field], publishedFields[field].unit);
+	}
+	return metrics;
+}
+
+void stat::memoryCollector::sample() {
+	procMeminfo_.read();
+	meminfo_.update(procMeminfo_.data(), procMeminfo_.size());
+	for(unsigned int field = 0; field < meminfo::FieldCount; ++field) {
+		const meminfo::field f = static_cast<meminfo::field>(field);
+		if(meminfo_.present(f)) fields_[field] += meminfo_.value(f) * publishedFields[field].scale;
+	}
+}
+
+void stat::memoryCollector::reset() {
+	fields_.fill(aggregation<double>());
+}
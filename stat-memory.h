@@ -0,0 +1,75 @@
+// Copyright (C) 2015 Philip Cronje. All rights reserved.
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <vector>
+
+#include "collector.h"
+#include "procfs.h"
+#include "stat.h"
+
+namespace stat {
+	/* Selected fields of /proc/meminfo. The line holding each field is found once, and its offset kept; later reads
+	 * only check that each offset still starts the same key before parsing the number after it, and search the whole
+	 * file again only if one does not. Fields the kernel does not report are left out. */
+	class meminfo {
+		public:
+			enum field {
+				MemAvailable = 0,
+				Cached,
+				Dirty,
+				SwapTotal,
+				SwapFree,
+				SwapCached,
+				HugePagesTotal,
+				HugePagesFree,
+				HugePagesReserved,
+				HugePagesSurplus,
+				FieldCount
+			};
+
+			// Keys as they appear in the file, without the colon
+			static const char* const keys[FieldCount];
+
+		private:
+			constexpr static std::size_t missing = static_cast<std::size_t>(-1);
+
+			std::array<std::size_t, FieldCount> offsets_;
+			std::array<unsigned long long, FieldCount> values_ {};
+			unsigned int reindexed_ = 0;
+
+			void index(const char* data, std::size_t size);
+			bool indexed(const char* data, std::size_t size) const noexcept;
+
+		public:
+			/* The data must be followed by a NUL, as procfs::file's is. */
+			meminfo(const char* data, std::size_t size);
+
+			void update(const char* data, std::size_t size);
+
+			bool present(const field field) const noexcept { return offsets_[field] != missing; }
+			/* The value as reported: kB for sizes, and a number of pages for the huge page counts. */
+			unsigned long long value(const field field) const noexcept { return values_[field]; }
+			/* How many times the offsets have had to be found again since construction. */
+			unsigned int reindexed() const noexcept { return reindexed_; }
+	};
+
+	/* Collects available, cached, dirty, swap and huge page memory from /proc/meminfo, in bytes or as a count of huge
+	 * pages. */
+	class memoryCollector : public collector {
+		procfs::file procMeminfo_;
+		meminfo meminfo_;
+		std::array<aggregation<double>, meminfo::FieldCount> fields_;
+
+		public:
+			memoryCollector(const char* path = "/proc/meminfo",
+					const std::chrono::milliseconds interval = std::chrono::seconds(1),
+					const std::chrono::milliseconds flushPeriod = std::chrono::seconds(60));
+
+			std::vector<metric> metrics() override;
+			void sample() override;
+			void reset() override;
+	};
+}
@@ -0,0 +1,280 @@
+// Copyright (C) 2015 Philip Cronje. All rights reserved.
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+
+#include <fnmatch.h>
+
+#include "stat-net.h"
+
+namespace {
+	// Columns of /proc/net/dev, after the interface name, for each counter
+	constexpr std::size_t netDevColumns[stat::interfaces::CounterCount] = { 0, 1, 2, 3, 8, 9, 10, 11 };
+	constexpr std::size_t netDevColumnCount = 16;
+
+	const char* const interfaceMetrics[stat::interfaces::CounterCount] = { "RxBytes", "RxPackets", "RxErrors",
+		"RxDrops", "TxBytes", "TxPackets", "TxErrors", "TxDrops" };
+
+	/* Finds the offset of the first line starting with the given prefix followed by a space, or size if there is
+	 * none. */
+	std::size_t findLine(const char* data, const std::size_t size, const std::string& prefix) {
+		for(std::size_t line = 0; line < size;) {
+			if((size - line > prefix.size()) && (std::memcmp(data + line, prefix.data(), prefix.size()) == 0)
+					&& (data[line + prefix.size()] == ' ')) {
+				return line;
+			}
+			const void* newline = std::memchr(data + line, '\n', size - line);
+			if(newline == nullptr) break;
+			line = static_cast<const char*>(newline) + 1 - data;
+		}
+		return size;
+	}
+
+	std::size_t lineLength(const char* data, const std::size_t size, const std::size_t line) {
+		const void* newline = std::memchr(data + line, '\n', size - line);
+		return (newline == nullptr) ? size - line : static_cast<const char*>(newline) - (data + line);
+	}
+}
+
+std::vector<std::string> stat::interfacePatterns::split(const std::string& patterns) {
+	std::vector<std::string> split;
+	for(std::size_t begin = 0; begin <= patterns.size();) {
+		std::size_t end = patterns.find(',', begin);
+		if(end == std::string::npos) end = patterns.size();
+		if(end != begin) split.push_back(patterns.substr(begin, end - begin));
+		begin = end + 1;
+	}
+	return split;
+}
+
+bool stat::interfacePatterns::operator()(const std::string& name) const {
+	bool allowed = allow_.empty();
+	for(const std::string& pattern: allow_) {
+		if(fnmatch(pattern.c_str(), name.c_str(), 0) == 0) allowed = true;
+	}
+	for(const std::string& pattern: deny_) {
+		if(fnmatch(pattern.c_str(), name.c_str(), 0) == 0) allowed = false;
+	}
+	return allowed;
+}
+
+stat::interfaces::interfaces(const procfs::scanner scanner, filter wanted) : wanted_(std::move(wanted)) {
+	rebuild(scanner);
+	update(scanner, std::chrono::duration<double>(0));
+}
+
+bool stat::interfaces::matches(procfs::scanner scanner) const {
+	for(const std::string& line: lines_) {
+		if(scanner.atEnd() || (scanner.label(':') != line)) return false;
+		scanner.skipLine();
+	}
+	return scanner.atEnd();
+}
+
+void stat::interfaces::rebuild(procfs::scanner scanner) {
+	std::unordered_map<std::string, interface> previous;
+	for(interface& interface: interfaces_) previous.emplace(interface.name, std::move(interface));
+
+	lines_.clear();
+	slots_.clear();
+	interfaces_.clear();
+	while(!scanner.atEnd()) {
+		// The header lines have no colon, and so no name
+		const std::string name(scanner.label(':'));
+		scanner.skipLine();
+		lines_.push_back(name);
+		const auto remaining = previous.find(name);
+		if(remaining != previous.end()) {
+			slots_.push_back(interfaces_.size());
+			interfaces_.push_back(std::move(remaining->second));
+		} else if(!name.empty() && wanted_(name)) {
+			slots_.push_back(interfaces_.size());
+			interfaces_.push_back(interface { name });
+		} else {
+			slots_.push_back(ignored);
+		}
+	}
+}
+
+bool stat::interfaces::update(procfs::scanner scanner, const std::chrono::duration<double> elapsed) {
+	const bool rebuilt = !matches(scanner);
+	if(rebuilt) rebuild(scanner);
+
+	for(const std::size_t slot: slots_) {
+		scanner.label(':');
+		if(slot == ignored) {
+			scanner.skipLine();
+			continue;
+		}
+		interface& interface = interfaces_[slot];
+		interface.measured = false;
+		unsigned long long columns[netDevColumnCount];
+		std::size_t count = 0;
+		while((count < netDevColumnCount) && scanner.hasNumber()) columns[count++] = scanner.number();
+		scanner.skipLine();
+		if(count < netDevColumnCount) continue;
+
+		values current;
+		for(std::size_t counter = 0; counter < CounterCount; ++counter) {
+			current[counter] = columns[netDevColumns[counter]];
+		}
+		swapIn(interface.counters, std::move(current));
+		const bool primed = std::exchange(interface.primed, true);
+		if(!primed || (elapsed.count() <= 0)) continue;
+
+		interface.measured = true;
+		for(std::size_t counter = 0; counter < CounterCount; ++counter) {
+			// The kernel reports every interface's statistics in 64 bits, even those a driver keeps in 32
+			interface.rates[counter] = counterDelta(interface.counters.first[counter],
+					interface.counters.second[counter], 64) / elapsed.count();
+		}
+	}
+	return rebuilt;
+}
+
+stat::snmpCounters::snmpCounters(std::string protocol, std::vector<std::string> names)
+		: protocol_(std::move(protocol)), names_(std::move(names)), columns_(names_.size(), missing),
+		values_(names_.size()) {}
+
+void stat::snmpCounters::update(const char* data, const std::size_t size) {
+	const std::size_t header = findLine(data, size, protocol_);
+	const std::string_view names(data + header, (header == size) ? 0 : lineLength(data, size, header));
+	if(names != header_) {
+		header_ = names;
+		std::fill(columns_.begin(), columns_.end(), missing);
+		procfs::scanner scanner(data + header, data + header + names.size());
+		scanner.label(':');
+		for(std::size_t column = 0;; ++column) {
+			const std::string_view name = scanner.word();
+			if(name.empty()) break;
+			for(std::size_t i = 0; i < names_.size(); ++i) {
+				if(name == names_[i]) columns_[i] = column;
+			}
+		}
+	}
+	if(header == size) return;
+
+	// The line of values follows the line of names
+	const std::size_t line = header + names.size() + 1;
+	if((line >= size) || (findLine(data + line, size - line, protocol_) != 0)) return;
+	procfs::scanner scanner(data + line, data + line + lineLength(data, size, line));
+	scanner.label(':');
+	for(std::size_t column = 0;; ++column) {
+		const std::string_view value = scanner.word();
+		if(value.empty()) break;
+		for(std::size_t i = 0; i < names_.size(); ++i) {
+			if(columns_[i] == column) std::from_chars(value.data(), value.data() + value.size(), values_[i]);
+		}
+	}
+}
+
+stat::interfaceCollector::interfaceCollector(interfaces::filter wanted, const char* path,
+		const std::chrono::milliseconds interval, const std::chrono::milliseconds flushPeriod)
+		: collector(interval, flushPeriod), procNetDev_(path), interfaces_(procNetDev_.scan(), std::move(wanted)),
+		sampled_(clock::now()) {
+	rebuild();
+}
+
+void stat::interfaceCollector::rebuild() {
+	std::unordered_map<std::string, std::size_t> previous;
+	for(std::size_t i = 0; i < names_.size(); ++i) previous.emplace(names_[i], i);
+
+	std::vector<std::string> names;
+	std::vector<std::array<aggregation<double>, interfaces::CounterCount>> statistics(interfaces_.list().size());
+	for(std::size_t i = 0; i < interfaces_.list().size(); ++i) {
+		names.push_back(interfaces_.list()[i].name);
+		const auto remaining = previous.find(names.back());
+		if(remaining != previous.end()) statistics[i] = statistics_[remaining->second];
+	}
+	names_ = std::move(names);
+	statistics_ = std::move(statistics);
+}
+
+std::vector<stat::metric> stat::interfaceCollector::metrics() {
+	changed_ = false;
+	std::vector<metric> metrics;
+	metrics.reserve(interfaces::CounterCount * names_.size());
+	for(std::size_t i = 0; i < names_.size(); ++i) {
+		for(std::size_t counter = 0; counter < interfaces::CounterCount; ++counter) {
+			const bool bytes = (counter == interfaces::RxBytes) || (counter == interfaces::TxBytes);
+			metrics.emplace_back(names_[i] + interfaceMetrics[counter], &statistics_[i][counter],
+					bytes ? "Bytes/Second" : "Count/Second");
+		}
+	}
+	return metrics;
+}
+
+void stat::interfaceCollector::sample() {
+	procNetDev_.read();
+	const clock::time_point now = clock::now();
+	if(interfaces_.update(procNetDev_.scan(), now - sampled_)) {
+		rebuild();
+		changed_ = true;
+	}
+	sampled_ = now;
+
+	for(std::size_t i = 0; i < interfaces_.list().size(); ++i) {
+		const interfaces::interface& interface = interfaces_.list()[i];
+		if(!interface.measured) continue;
+		for(std::size_t counter = 0; counter < interfaces::CounterCount; ++counter) {
+			statistics_[i][counter] += interface.rates[counter];
+		}
+	}
+}
+
+void stat::interfaceCollector::reset() {
+	for(std::array<aggregation<double>, interfaces::CounterCount>& statistics: statistics_) {
+		statistics.fill(aggregation<double>());
+	}
+}
+
+stat::tcpCollector::tcpCollector(const char* snmpPath, const char* netstatPath,
+		const std::chrono::milliseconds interval, const std::chrono::milliseconds flushPeriod)
+		: collector(interval, flushPeriod), procNetSnmp_(snmpPath), procNetNetstat_(netstatPath),
+		tcp_("Tcp:", { "RetransSegs" }), tcpExt_("TcpExt:", { "ListenOverflows", "ListenDrops" }),
+		sampled_(clock::now()) {
+	previous_ = read();
+}
+
+std::array<unsigned long long, stat::tcpCollector::RateCount> stat::tcpCollector::read() {
+	tcp_.update(procNetSnmp_.data(), procNetSnmp_.size());
+	tcpExt_.update(procNetNetstat_.data(), procNetNetstat_.size());
+	return { tcp_.value(0), tcpExt_.value(0), tcpExt_.value(1) };
+}
+
+bool stat::tcpCollector::present(const rate rate) const noexcept {
+	return (rate == Retransmits) ? tcp_.present(0) : tcpExt_.present(rate - ListenOverflows);
+}
+
+std::vector<stat::metric> stat::tcpCollector::metrics() {
+	static const char* const names[RateCount] = { "TcpRetransmits", "TcpListenOverflows", "TcpListenDrops" };
+	std::vector<metric> metrics;
+	for(unsigned int r = 0; r < RateCount; ++r) {
+		if(present(static_cast<rate>(r))) metrics.emplace_back(names[r], &rates_[r], "Count/Second");
+	}
+	return metrics;
+}
+
+void stat::tcpCollector::sample() {
+	procNetSnmp_.read();
+	procNetNetstat_.read();
+	const clock::time_point now = clock::now();
+	const std::array<unsigned long long, RateCount> current = read();
+	const double seconds = std::chrono::duration<double>(now - sampled_).count();
+	sampled_ = now;
+	if(seconds > 0) {
+		for(unsigned int r = 0; r < RateCount; ++r) {
+			if(present(static_cast<rate>(r))) {
+				rates_[r] += counterDelta(previous_[r], current[r], longCounterWidth) / seconds;
+			}
+		}
+	}
+	previous_ = current;
+}
+
+void stat::tcpCollector::reset() {
+	rates_.fill(aggregation<double>());
+}
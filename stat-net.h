@@ -0,0 +1,153 @@
+// Copyright (C) 2015 Philip Cronje. All rights reserved.
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "collector.h"
+#include "procfs.h"
+#include "stat.h"
+
+namespace stat {
+	/* Chooses interfaces by name from glob patterns: an interface is wanted if it matches any allowed pattern, or
+	 * there are none, and matches no denied pattern. */
+	class interfacePatterns {
+		std::vector<std::string> allow_;
+		std::vector<std::string> deny_;
+
+		public:
+			interfacePatterns(std::vector<std::string> allow, std::vector<std::string> deny)
+					: allow_(std::move(allow)), deny_(std::move(deny)) {}
+
+			/* Splits a comma-separated list of patterns. */
+			static std::vector<std::string> split(const std::string& patterns);
+
+			bool operator()(const std::string& name) const;
+	};
+
+	/* Per-interface rates from /proc/net/dev. As with stat::disks, each wanted interface has a fixed slot holding its
+	 * previous and current counters, matched to the file's lines by name and in order, and the slots are only rebuilt
+	 * when the list of interfaces changes. Whether an interface is wanted is decided when it appears, not on every
+	 * sample. */
+	class interfaces {
+		public:
+			typedef std::function<bool(const std::string& name)> filter;
+
+			enum counter {
+				RxBytes = 0, RxPackets, RxErrors, RxDrops,
+				TxBytes, TxPackets, TxErrors, TxDrops,
+				CounterCount
+			};
+			typedef std::array<unsigned long long, CounterCount> values;
+
+			struct interface {
+				std::string name;
+				std::pair<values, values> counters {};
+				bool primed = false;
+				// Whether the rates, per second, cover the last interval, which they do not on the first sample
+				bool measured = false;
+				std::array<double, CounterCount> rates {};
+			};
+
+		private:
+			constexpr static std::size_t ignored = static_cast<std::size_t>(-1);
+
+			const filter wanted_;
+			std::vector<std::string> lines_;
+			std::vector<std::size_t> slots_;
+			std::vector<interface> interfaces_;
+
+			bool matches(procfs::scanner scanner) const;
+			void rebuild(procfs::scanner scanner);
+
+		public:
+			interfaces(procfs::scanner scanner, filter wanted);
+
+			const std::vector<interface>& list() const noexcept { return interfaces_; }
+
+			/* Parses a new sample, taken the given time after the previous one. Returns true if the slots were
+			 * rebuilt. */
+			bool update(procfs::scanner scanner, std::chrono::duration<double> elapsed);
+	};
+
+	/* Named counters of one protocol from /proc/net/snmp or /proc/net/netstat, which give each protocol a line of
+	 * names followed by a line of values. The column of each name is found once, and found again only if the line of
+	 * names changes. A name the kernel does not report is left out. */
+	class snmpCounters {
+		constexpr static std::size_t missing = static_cast<std::size_t>(-1);
+
+		// The protocol's prefix, such as "Tcp:"
+		const std::string protocol_;
+		const std::vector<std::string> names_;
+		std::string header_;
+		std::vector<std::size_t> columns_;
+		std::vector<unsigned long long> values_;
+
+		public:
+			snmpCounters(std::string protocol, std::vector<std::string> names);
+
+			/* The data must be followed by a NUL, as procfs::file's is. */
+			void update(const char* data, std::size_t size);
+
+			bool present(const std::size_t name) const noexcept { return columns_[name] != missing; }
+			unsigned long long value(const std::size_t name) const noexcept { return values_[name]; }
+	};
+
+	/* Collects the receive and transmit rates of bytes, packets, errors and drops of every wanted interface from
+	 * /proc/net/dev. */
+	class interfaceCollector : public collector {
+		typedef std::chrono::steady_clock clock;
+
+		procfs::file procNetDev_;
+		interfaces interfaces_;
+		clock::time_point sampled_;
+		std::vector<std::string> names_;
+		std::vector<std::array<aggregation<double>, interfaces::CounterCount>> statistics_;
+		bool changed_ = false;
+
+		void rebuild();
+
+		public:
+			interfaceCollector(interfaces::filter wanted, const char* path = "/proc/net/dev",
+					const std::chrono::milliseconds interval = std::chrono::seconds(1),
+					const std::chrono::milliseconds flushPeriod = std::chrono::seconds(60));
+
+			std::vector<metric> metrics() override;
+			bool metricsChanged() const override { return changed_; }
+			void sample() override;
+			void reset() override;
+	};
+
+	/* Collects the rates of TCP retransmissions from /proc/net/snmp, and of listen queue overflows and drops from
+	 * /proc/net/netstat. */
+	class tcpCollector : public collector {
+		typedef std::chrono::steady_clock clock;
+
+		enum rate { Retransmits = 0, ListenOverflows, ListenDrops, RateCount };
+
+		procfs::file procNetSnmp_;
+		procfs::file procNetNetstat_;
+		snmpCounters tcp_;
+		snmpCounters tcpExt_;
+		clock::time_point sampled_;
+		std::array<unsigned long long, RateCount> previous_ {};
+		std::array<aggregation<double>, RateCount> rates_;
+
+		std::array<unsigned long long, RateCount> read();
+		bool present(rate rate) const noexcept;
+
+		public:
+			tcpCollector(const char* snmpPath = "/proc/net/snmp", const char* netstatPath = "/proc/net/netstat",
+					const std::chrono::milliseconds interval = std::chrono::seconds(1),
+					const std::chrono::milliseconds flushPeriod = std::chrono::seconds(60));
+
+			std::vector<metric> metrics() override;
+			void sample() override;
+			void reset() override;
+	};
+}
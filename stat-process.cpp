@@ -0,0 +1,310 @@
+// Copyright (C) 2015 Philip Cronje. All rights reserved.
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <string>
+
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include "procfs.h"
+#include "stat-process.h"
+
+namespace {
+	// Fields of /proc/[pid]/stat, counting from 1, after the name
+	constexpr unsigned int utimeField = 14;
+	constexpr unsigned int stimeField = 15;
+	constexpr unsigned int rssField = 24;
+
+	// Descriptors left for everything but the tracked processes' stat files
+	constexpr std::size_t reservedDescriptors = 256;
+
+	bool toNumber(const std::string_view word, unsigned long long& value) {
+		const std::from_chars_result result = std::from_chars(word.data(), word.data() + word.size(), value);
+		return (result.ec == std::errc()) && (result.ptr == word.data() + word.size());
+	}
+
+	/* Raises the soft limit on open descriptors to the hard limit, and returns how many of them the collector may
+	 * keep open. */
+	std::size_t descriptorBudget() {
+		rlimit limit;
+		if(getrlimit(RLIMIT_NOFILE, &limit) == -1) return 0;
+		if(limit.rlim_cur < limit.rlim_max) {
+			rlimit raised = limit;
+			raised.rlim_cur = limit.rlim_max;
+			if(setrlimit(RLIMIT_NOFILE, &raised) == 0) limit = raised;
+		}
+		return (limit.rlim_cur > 2 * reservedDescriptors) ? limit.rlim_cur - reservedDescriptors : limit.rlim_cur / 2;
+	}
+
+	struct ranked {
+		double value;
+		const std::string* name;
+
+		bool operator>(const ranked& other) const noexcept { return value > other.value; }
+	};
+}
+
+bool stat::processStat::parse(const char* text, const std::size_t size) {
+	// The name is whatever lies between the first opening and the last closing parenthesis
+	const char* open = static_cast<const char*>(std::memchr(text, '(', size));
+	if(open == nullptr) return false;
+	const char* close = open;
+	for(const char* c = text + size; c > open; --c) {
+		if(c[-1] == ')') {
+			close = c - 1;
+			break;
+		}
+	}
+	if(close == open) return false;
+	name = std::string_view(open + 1, close - open - 1);
+
+	procfs::scanner scanner(close + 1, text + size);
+	for(unsigned int field = 3; field <= rssField; ++field) {
+		const std::string_view word = scanner.word();
+		if(word.empty()) return false;
+		if(field == utimeField) {
+			if(!toNumber(word, ticks)) return false;
+		} else if(field == stimeField) {
+			unsigned long long stime;
+			if(!toNumber(word, stime)) return false;
+			ticks += stime;
+		} else if(field == rssField) {
+			if(!toNumber(word, rssPages)) return false;
+		}
+	}
+	return true;
+}
+
+stat::workerPool::workerPool(const unsigned int threads) {
+	for(unsigned int part = 1; part <= threads; ++part) {
+		threads_.emplace_back([this, part]() {
+			unsigned long long generation = 0;
+			std::unique_lock<std::mutex> lock(mutex_);
+			for(;;) {
+				started_.wait(lock, [this, &generation]() { return stopping_ || (generation_ != generation); });
+				if(stopping_) return;
+				generation = generation_;
+				const work& work = *work_;
+				const std::pair<std::size_t, std::size_t> range = slice(part);
+				lock.unlock();
+				work(range.first, range.second);
+				lock.lock();
+				if(--running_ == 0) finished_.notify_one();
+			}
+		});
+	}
+}
+
+stat::workerPool::~workerPool() noexcept {
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		stopping_ = true;
+	}
+	started_.notify_all();
+	for(std::thread& thread: threads_) thread.join();
+}
+
+std::pair<std::size_t, std::size_t> stat::workerPool::slice(const unsigned int part) const noexcept {
+	const std::size_t parts = threads_.size() + 1;
+	return { size_ * part / parts, size_ * (part + 1) / parts };
+}
+
+void stat::workerPool::run(const std::size_t size, const work& work) {
+	std::pair<std::size_t, std::size_t> range;
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		work_ = &work;
+		size_ = size;
+		running_ = threads_.size();
+		++generation_;
+		range = slice(0);
+	}
+	started_.notify_all();
+	work(range.first, range.second);
+
+	std::unique_lock<std::mutex> lock(mutex_);
+	finished_.wait(lock, [this]() { return running_ == 0; });
+}
+
+stat::processCollector::processCollector(const unsigned int topN, const unsigned int workers,
+		const unsigned int rescanEvery, const std::string& root, const std::chrono::milliseconds interval,
+		const std::chrono::milliseconds flushPeriod)
+		: collector(interval, flushPeriod), root_(root), topN_(topN), rescanEvery_(std::max(rescanEvery, 1U)),
+		ticksPerSecond_(sysconf(_SC_CLK_TCK)), pageSize_(sysconf(_SC_PAGESIZE)), maxOpen_(descriptorBudget()),
+		sampledAt_(clock::now()) {
+	if(workers > 0) pool_ = std::make_unique<workerPool>(workers);
+	// The first sample only primes each process's CPU time
+	samples_ = rescanEvery_ - 1;
+	sample();
+	reset();
+}
+
+stat::processCollector::~processCollector() noexcept {
+	for(process& process: processes_) close(process);
+}
+
+void stat::processCollector::close(process& process) noexcept {
+	if(process.fd == -1) return;
+	::close(process.fd);
+	process.fd = -1;
+	--open_;
+}
+
+void stat::processCollector::rescan() {
+	root_.listNumbered(listed_);
+	std::sort(listed_.begin(), listed_.end());
+
+	// Both lists are sorted, so one pass tells which processes are new and which have gone
+	merged_.clear();
+	auto tracked = processes_.begin();
+	for(const int pid: listed_) {
+		for(; (tracked != processes_.end()) && (tracked->pid < pid); ++tracked) close(*tracked);
+		if((tracked != processes_.end()) && (tracked->pid == pid) && tracked->alive) {
+			merged_.push_back(std::move(*tracked++));
+		} else {
+			// A PID whose process has exited may have been reused by now
+			if((tracked != processes_.end()) && (tracked->pid == pid)) close(*tracked++);
+			merged_.emplace_back(pid);
+		}
+		process& process = merged_.back();
+		if((process.fd == -1) && (open_ < maxOpen_)) {
+			char path[32];
+			std::snprintf(path, sizeof(path), "%d/stat", pid);
+			process.fd = root_.open(path);
+			if(process.fd != -1) ++open_;
+		}
+	}
+	for(; tracked != processes_.end(); ++tracked) close(*tracked);
+	processes_.swap(merged_);
+}
+
+void stat::processCollector::read(const std::size_t begin, const std::size_t end) {
+	char buffer[1024];
+	for(std::size_t i = begin; i < end; ++i) {
+		process& process = processes_[i];
+		if(!process.alive) continue;
+		int fd = process.fd;
+		if(fd == -1) {
+			char path[32];
+			std::snprintf(path, sizeof(path), "%d/stat", process.pid);
+			fd = root_.open(path);
+		}
+		ssize_t size = -1;
+		if(fd != -1) {
+			do {
+				size = pread(fd, buffer, sizeof(buffer) - 1, 0);
+			} while((size == -1) && (errno == EINTR));
+			if(process.fd == -1) ::close(fd);
+		}
+
+		processStat stat;
+		if(size > 0) buffer[size] = '\0';
+		// Reading the stat file of a process that has exited fails with ESRCH
+		if((size <= 0) || !stat.parse(buffer, size)) {
+			process.alive = false;
+			continue;
+		}
+		if(stat.name != process.name) {
+			process.name.assign(stat.name);
+			process.renamed = true;
+		}
+		process.readTicks = stat.ticks;
+		process.rssPages = stat.rssPages;
+	}
+}
+
+std::vector<stat::metric> stat::processCollector::metrics() {
+	std::vector<ranked> busiest, largest;
+	busiest.reserve(topN_ + 1);
+	largest.reserve(topN_ + 1);
+	const auto offer = [this](std::vector<ranked>& heap, const ranked candidate) {
+		if(heap.size() < topN_) {
+			heap.push_back(candidate);
+			std::push_heap(heap.begin(), heap.end(), std::greater<ranked>());
+		} else if(!heap.empty() && (candidate > heap.front())) {
+			std::pop_heap(heap.begin(), heap.end(), std::greater<ranked>());
+			heap.back() = candidate;
+			std::push_heap(heap.begin(), heap.end(), std::greater<ranked>());
+		}
+	};
+	for(const auto& [name, usage]: usages_) {
+		if(usage.cpu.count > 0) offer(busiest, { usage.cpu.sum / usage.cpu.count, &name });
+		if(usage.rss.count > 0) offer(largest, { usage.rss.max, &name });
+	}
+	std::sort_heap(busiest.begin(), busiest.end(), std::greater<ranked>());
+	std::sort_heap(largest.begin(), largest.end(), std::greater<ranked>());
+
+	std::vector<metric> metrics;
+	metrics.reserve(busiest.size() + largest.size());
+	for(const ranked& process: busiest) {
+		metrics.emplace_back("ProcessCPU", &usages_.at(*process.name).cpu);
+		metrics.back().dimensions = { { "Process", *process.name } };
+	}
+	for(const ranked& process: largest) {
+		metrics.emplace_back("ProcessRSS", &usages_.at(*process.name).rss, "Bytes");
+		metrics.back().dimensions = { { "Process", *process.name } };
+	}
+	return metrics;
+}
+
+void stat::processCollector::sample() {
+	if(++samples_ % rescanEvery_ == 0) rescan();
+	const clock::time_point now = clock::now();
+	const double seconds = std::chrono::duration<double>(now - sampledAt_).count();
+	sampledAt_ = now;
+
+	if(pool_ != nullptr) {
+		pool_->run(processes_.size(), [this](const std::size_t begin, const std::size_t end) { read(begin, end); });
+	} else {
+		read(0, processes_.size());
+	}
+
+	// The reads are folded into the usage of each name on the collecting thread alone
+	for(process& process: processes_) {
+		if(!process.alive) continue;
+		if(process.renamed || (process.totals == nullptr)) {
+			process.totals = &usages_[process.name];
+			process.renamed = false;
+		}
+		usage& usage = *process.totals;
+		if(!usage.sampled) {
+			usage.sampled = true;
+			sampled_.push_back(&usage);
+		}
+		usage.sampleRss += process.rssPages * pageSize_;
+		// A process's CPU time is a percentage of one CPU, as top reports it
+		if(process.primed && (seconds > 0) && (process.readTicks >= process.ticks)) {
+			usage.sampleCpu += (process.readTicks - process.ticks) / ticksPerSecond_ / seconds * 100;
+		}
+		process.ticks = process.readTicks;
+		process.primed = true;
+	}
+	for(usage* usage: sampled_) {
+		usage->cpu += usage->sampleCpu;
+		usage->rss += usage->sampleRss;
+		usage->sampleCpu = usage->sampleRss = 0;
+		usage->sampled = false;
+	}
+	sampled_.clear();
+}
+
+void stat::processCollector::reset() {
+	// Names no tracked process goes by any more are forgotten, since the metrics are compiled afresh for each flush
+	for(const process& process: processes_) {
+		if(process.totals != nullptr) process.totals->referenced = true;
+	}
+	for(auto entry = usages_.begin(); entry != usages_.end();) {
+		if(!entry->second.referenced) {
+			entry = usages_.erase(entry);
+			continue;
+		}
+		entry->second.cpu = aggregation<double>();
+		entry->second.rss = aggregation<double>();
+		entry->second.referenced = false;
+		++entry;
+	}
+}
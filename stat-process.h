@@ -0,0 +1,133 @@
+// Copyright (C) 2015 Philip Cronje. All rights reserved.
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "collector.h"
+#include "procfs.h"
+#include "stat.h"
+
+namespace stat {
+	/* The fields of a /proc/[pid]/stat line that the process collector uses. The name points into the scanned text. */
+	struct processStat {
+		std::string_view name;
+		// User and system time, in clock ticks
+		unsigned long long ticks = 0;
+		unsigned long long rssPages = 0;
+
+		/* Parses a stat line, whose name, in parentheses, may itself hold spaces and parentheses. The text must be
+		 * followed by a NUL. Returns false if the line is cut short. */
+		bool parse(const char* text, std::size_t size);
+	};
+
+	/* Threads that run a function over slices of a range of indices, alongside the calling thread, which waits for
+	 * every slice to be done. */
+	class workerPool {
+		typedef std::function<void(std::size_t begin, std::size_t end)> work;
+
+		std::vector<std::thread> threads_;
+		std::mutex mutex_;
+		std::condition_variable started_, finished_;
+		const work* work_ = nullptr;
+		std::size_t size_ = 0;
+		unsigned long long generation_ = 0;
+		unsigned int running_ = 0;
+		bool stopping_ = false;
+
+		std::pair<std::size_t, std::size_t> slice(unsigned int part) const noexcept;
+
+		public:
+			explicit workerPool(unsigned int threads);
+			workerPool(const workerPool&) = delete;
+			~workerPool() noexcept;
+
+			void run(std::size_t size, const work& work);
+	};
+
+	/* Collects the CPU usage and resident set size of the busiest and largest processes, each published with the
+	 * process name as a dimension. Processes of the same name are counted together.
+	 *
+	 * Scanning /proc on every sample does not scale to hosts running tens of thousands of processes, so the
+	 * collector keeps each tracked process's stat file open and re-reads it in place, and lists /proc only every
+	 * few samples, merging the sorted list of PIDs with the tracked ones to pick up new processes and let go of those
+	 * that have exited. Files are kept open as far as the descriptor limit allows; the rest are opened as they are
+	 * read. The stat files can be read by a pool of worker threads, each taking a slice of the tracked processes.
+	 *
+	 * The top processes are chosen afresh for each flush, with a bounded heap over every name seen since the last,
+	 * so the collector's metrics change with every flush. */
+	class processCollector : public collector {
+		typedef std::chrono::steady_clock clock;
+
+		struct usage {
+			aggregation<double> cpu, rss;
+			// Summed over the processes of this name during a sample
+			double sampleCpu = 0, sampleRss = 0;
+			bool sampled = false;
+			bool referenced = false;
+		};
+
+		struct process {
+			explicit process(const int pid) : pid(pid) {}
+
+			int pid;
+			// The open stat file, or -1 if it is opened as it is read
+			int fd = -1;
+			std::string name;
+			usage* totals = nullptr;
+			unsigned long long ticks = 0;
+			// Read by the worker threads, then folded in on the collecting thread
+			unsigned long long readTicks = 0, rssPages = 0;
+			bool renamed = false;
+			// Whether the last read succeeded; a process that has exited is let go of at the next listing
+			bool alive = true;
+			bool primed = false;
+		};
+
+		const procfs::directory root_;
+		const unsigned int topN_;
+		const unsigned int rescanEvery_;
+		const double ticksPerSecond_;
+		const double pageSize_;
+		std::size_t maxOpen_;
+		std::size_t open_ = 0;
+		// Sorted by PID, with the tracked processes merged into the scratch list on each listing
+		std::vector<process> processes_, merged_;
+		std::vector<int> listed_;
+		std::unique_ptr<workerPool> pool_;
+		std::unordered_map<std::string, usage> usages_;
+		std::vector<usage*> sampled_;
+		unsigned int samples_ = 0;
+		clock::time_point sampledAt_;
+
+		void rescan();
+		void close(process& process) noexcept;
+		void read(std::size_t begin, std::size_t end);
+
+		public:
+			/* Publishes the topN busiest and largest processes, listing the root directory every rescanEvery samples
+			 * and reading with the given number of worker threads besides the collecting thread. */
+			processCollector(unsigned int topN, unsigned int workers = 0, unsigned int rescanEvery = 5,
+					const std::string& root = "/proc", std::chrono::milliseconds interval = std::chrono::seconds(1),
+					std::chrono::milliseconds flushPeriod = std::chrono::seconds(60));
+			~processCollector() noexcept;
+
+			std::size_t tracked() const noexcept { return processes_.size(); }
+			std::size_t open() const noexcept { return open_; }
+
+			std::vector<metric> metrics() override;
+			bool metricsChanged() const override { return true; }
+			void sample() override;
+			void reset() override;
+	};
+}
@@ -1,7 +1,13 @@
 // Copyright (C) 2015 Philip Cronje. All rights reserved.
 #pragma once
 
+#include <array>
+#include <cmath>
+#include <cstddef>
 #include <limits>
+#include <string>
+#include <utility>
+#include <vector>
 
 namespace stat {
 	template<typename V, typename T = unsigned int>
@@ -29,6 +35,88 @@ namespace stat {
 			}
 	};
 
+	/* Log-linear histogram in the style of HdrHistogram. Every power of two from 2^minExponent up to 2^maxExponent is
+	 * split into subBuckets linear buckets, so a value is recorded with a relative error of at most 1/(2 *
+	 * subBuckets). Values below the smallest bucket, including zero and negative values, share bucket 0 and values
+	 * beyond the largest are clamped into the last bucket. Recording is O(1), and histograms merge bucket by bucket. */
+	template<typename V, typename T = unsigned int>
+	struct histogram {
+		constexpr static int minExponent = -10;
+		constexpr static int maxExponent = 40;
+		constexpr static std::size_t subBuckets = 16;
+		constexpr static std::size_t bucketCount = 1 + (maxExponent - minExponent) * subBuckets;
+
+		std::array<T, bucketCount> buckets {};
+		T count = 0;
+
+		histogram& operator+=(const V value) {
+			++buckets[bucket(value)];
+			++count;
+			return *this;
+		}
+
+		histogram& operator+=(const histogram& other) {
+			for(std::size_t i = 0; i < bucketCount; ++i) buckets[i] += other.buckets[i];
+			count += other.count;
+			return *this;
+		}
+
+		static std::size_t bucket(const V value) {
+			if(!(value >= std::ldexp(V(1), minExponent))) return 0;
+			int exponent;
+			// value = mantissa * 2^exponent, with mantissa in [0.5, 1)
+			const V mantissa = std::frexp(value, &exponent);
+			if(exponent > maxExponent) return bucketCount - 1;
+			return 1 + (exponent - 1 - minExponent) * subBuckets
+				+ static_cast<std::size_t>((mantissa - V(0.5)) * (2 * subBuckets));
+		}
+
+		/* The value representing a bucket: the midpoint of the range of values it holds. */
+		static V value(const std::size_t bucket) {
+			if(bucket == 0) return 0;
+			const int exponent = (bucket - 1) / subBuckets + minExponent;
+			const std::size_t subBucket = (bucket - 1) % subBuckets;
+			return std::ldexp(1 + (subBucket + V(0.5)) / subBuckets, exponent);
+		}
+	};
+
+	/* A metric to publish: its name, the CloudWatch unit of its values, and either the aggregation holding its
+	 * statistics or the histogram of its values, which must outlive any use of the metric. Dimensions of its own are
+	 * published after those its collector was registered with. */
+	struct metric {
+		std::string name;
+		std::string unit;
+		const aggregation<double>* statistics;
+		const histogram<double>* distribution;
+		std::vector<std::pair<std::string, std::string>> dimensions;
+
+		metric(const std::string& name, const aggregation<double>* statistics, const std::string& unit = "Percent")
+				: name(name), unit(unit), statistics(statistics), distribution(nullptr) {}
+		metric(const std::string& name, const histogram<double>* distribution, const std::string& unit = "Percent")
+				: name(name), unit(unit), statistics(nullptr), distribution(distribution) {}
+	};
+
+	/* Replaces the previous value of a (previous, current) pair of snapshots with the current value, and the current
+	 * value with a new one. */
+	template<typename A>
+	void swapIn(std::pair<A, A>& pair, A&& value) {
+		pair.first = std::move(pair.second);
+		pair.second = std::move(value);
+	}
+
+	/* How far a counter kept in a field of the given width, in bits, has advanced from one sample to the next. A
+	 * narrower counter that has gone backwards has wrapped; a 64-bit one will not wrap in the life of a host, so it has
+	 * been reset, as when its interface or device is recreated, and counts as not having advanced at all. */
+	constexpr unsigned long long counterDelta(const unsigned long long previous, const unsigned long long current,
+			const unsigned int width) {
+		if(current >= previous) return current - previous;
+		if((width >= 64) || ((previous >> width) != 0)) return 0;
+		return current + ((1ULL << width) - previous);
+	}
+
+	// The width of the counters the kernel keeps in longs, as for /proc/net/snmp and the counts of /proc/diskstats
+	constexpr unsigned int longCounterWidth = std::numeric_limits<unsigned long>::digits;
+
 	template<typename T, typename V>
 	constexpr T toPercent(const V value, const V total) {
 		return static_cast<double>(value) / static_cast<double>(total) * 100.0;
@@ -0,0 +1,81 @@
+// Copyright (C) 2015 Philip Cronje. All rights reserved.
+#include <stdexcept>
+#include <system_error>
+#include <utility>
+
+#include "stream.h"
+
+void ssl::stream::ready(const std::uint32_t events) {
+	if((events & EPOLLOUT) != 0) socket_.writable(true);
+	// An error or hangup on an open connection is found by reading from it
+	if((events & EPOLLIN) != 0) socket_.readable(true);
+	if(socket_.connected() && ((events & (EPOLLERR | EPOLLHUP)) != 0)) socket_.readable(true);
+	wake();
+}
+
+void ssl::stream::wake() {
+	pending_ = true;
+	if(waiting_) std::exchange(waiting_, nullptr).resume();
+}
+
+co::task<void> ssl::stream::connect(const std::vector<net::address> addresses, const std::uint16_t port) {
+	close();
+	socket_.connect(addresses, port, epoll_, *this);
+	while(!socket_.connected()) {
+		if(!socket_.connecting()) throw std::system_error(socket_.error(), std::system_category(), "Failed to connect");
+		co_await events();
+	}
+	connection_.reset(new connection(context_, socket_));
+}
+
+void ssl::stream::attach(const int fd) {
+	close();
+	socket_.attach(fd, epoll_, *this);
+	connection_.reset(new connection(context_, socket_));
+}
+
+co::task<bool> ssl::stream::receive() {
+	for(;;) {
+		if(socket_.writable()) connection_->writeToSocket();
+		if(socket_.readable() && connection_->readFromSocket()) co_return true;
+		if(connection_->closed()) co_return false;
+		co_await events();
+	}
+}
+
+co::task<void> ssl::stream::handshake() {
+	while(!connection_->connect()) {
+		// Awaited outside the condition, as GCC 12 skips the whole coroutine body when co_await is used in one
+		const bool received = co_await receive();
+		if(!received) throw std::runtime_error("Connection closed during the TLS handshake");
+	}
+}
+
+co::task<void> ssl::stream::writeAll(util::buffer& buffer) {
+	for(;;) {
+		connection_->write(buffer);
+		if(!buffer && connection_->writeToSocket()) co_return;
+		if(connection_->closed()) throw std::runtime_error("Connection closed while writing");
+		co_await events();
+		// The engine may be waiting on a record from the peer before it will write more
+		if(socket_.readable()) connection_->readFromSocket();
+	}
+}
+
+co::task<bool> ssl::stream::readResponse(http::client& client) {
+	const std::size_t inFlight = client.inFlight();
+	for(;;) {
+		connection_->read([&client](const char* data, const std::size_t size) { client.receive(data, size); });
+		if(client.inFlight() < inFlight) co_return true;
+		const bool received = co_await receive();
+		if(!received) co_return false;
+	}
+}
+
+void ssl::stream::close() noexcept {
+	if(connection_) {
+		connection_->shutdown();
+		connection_.reset();
+	}
+	socket_.disconnect();
+}
@@ -0,0 +1,74 @@
+// Copyright (C) 2015 Philip Cronje. All rights reserved.
+#pragma once
+
+#include <coroutine>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "coroutine.h"
+#include "epoll.h"
+#include "http.h"
+#include "net.h"
+#include "ssl.h"
+#include "util.h"
+
+namespace ssl {
+	/* A TLS connection driven by a coroutine rather than by a handler's state machine: connecting, handshaking,
+	 * writing and reading are each awaited in turn, and the coroutine is resumed from the reactor whenever the socket
+	 * reports readiness. A stream is served by one coroutine at a time, which costs its frame and nothing more. */
+	class stream : public epoll::handler {
+		const epoll& epoll_;
+		const context& context_;
+		net::socket socket_;
+		std::unique_ptr<connection> connection_;
+		std::coroutine_handle<> waiting_;
+		// Whether anything has happened since the waiting coroutine last looked
+		bool pending_ = false;
+
+		/* Waits until the socket has given the TLS engine something new, flushing whatever is queued for the socket
+		 * meanwhile. Returns false if the connection was closed first. */
+		co::task<bool> receive();
+
+		public:
+			/* Resumes the coroutine waiting on the stream once the socket has reported readiness, or the stream has
+			 * been woken, since it last looked. */
+			struct awaiter {
+				stream& owner;
+
+				bool await_ready() const noexcept { return owner.pending_; }
+				void await_suspend(const std::coroutine_handle<> waiting) const noexcept { owner.waiting_ = waiting; }
+				void await_resume() const noexcept { owner.pending_ = false; }
+			};
+
+			stream(const epoll& epoll, const context& context) : epoll_(epoll), context_(context) {}
+			stream(const stream&) = delete;
+
+			net::socket& socket() noexcept { return socket_; }
+			/* The TLS connection, which exists from connecting until closing. */
+			connection* tls() const noexcept { return connection_.get(); }
+			bool open() const noexcept { return connection_ && !connection_->closed(); }
+
+			void ready(std::uint32_t events) override;
+
+			awaiter events() noexcept { return awaiter { *this }; }
+			/* Resumes the waiting coroutine, so that it can look at something other than the socket. */
+			void wake();
+
+			/* Connects to the first of the addresses to answer, throwing if none does. Like every argument to a
+			 * coroutine that may be started after the call returns, the addresses are taken by value. */
+			co::task<void> connect(std::vector<net::address> addresses, std::uint16_t port);
+			/* Takes over a descriptor that is already connected and non-blocking, such as one end of a
+			 * socketpair(). */
+			void attach(int fd);
+			co::task<void> handshake();
+			/* Writes the whole buffer through the TLS engine, returning once the socket has taken all of it. */
+			co::task<void> writeAll(util::buffer& buffer);
+			/* Reads until the client has been handed at least one more response, returning false if the connection
+			 * was closed first. */
+			co::task<bool> readResponse(http::client& client);
+
+			/* Sends close_notify if the connection is still open, and closes the socket. */
+			void close() noexcept;
+	};
+}
@@ -0,0 +1,267 @@
+// Copyright (C) 2015 Philip Cronje. All rights reserved.
+#include <cmath>
+#include <cstddef>
+#include <cstdlib>
+#include <iterator>
+#include <new>
+#include <string>
+#include <vector>
+
+#include <zlib.h>
+
+#include "test-framework.h"
+
+#include "cloudwatch.h"
+
+namespace {
+	std::size_t allocations = 0;
+
+	void* allocate(const std::size_t size, const std::size_t alignment = alignof(std::max_align_t)) {
+		++allocations;
+		// aligned_alloc takes only sizes that are a multiple of the alignment
+		const std::size_t bytes = (size != 0) ? size : 1;
+		void* p = (alignment <= alignof(std::max_align_t)) ? std::malloc(bytes)
+			: std::aligned_alloc(alignment, (bytes + alignment - 1) / alignment * alignment);
+		if(p == nullptr) throw std::bad_alloc();
+		return p;
+	}
+}
+
+// Every form is replaced, so that whichever new an allocation comes from, the delete that frees it matches
+void* operator new(std::size_t size) { return allocate(size); }
+void* operator new[](std::size_t size) { return allocate(size); }
+void* operator new(std::size_t size, std::align_val_t alignment) {
+	return allocate(size, static_cast<std::size_t>(alignment));
+}
+void* operator new[](std::size_t size, std::align_val_t alignment) {
+	return allocate(size, static_cast<std::size_t>(alignment));
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete[](void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t) noexcept { std::free(p); }
+void operator delete(void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept { std::free(p); }
+void operator delete[](void* p, std::size_t, std::align_val_t) noexcept { std::free(p); }
+
+namespace {
+	// 2015-08-30T12:36:00Z
+	constexpr std::time_t now = 1440938160;
+
+	struct fixture {
+		aws::signer signer { "AKIDEXAMPLE", "wJalrXUtnFEMI/K7MDENG+bPxRfiCYEXAMPLEKEY", "us-east-1", "monitoring" };
+		aws::cloudwatch::requestBuilder builder { "monitoring.us-east-1.amazonaws.com", signer, "Panopticon" };
+		stat::aggregation<double> user, system, empty;
+		const aws::cloudwatch::requestTemplate requestTemplate { { { "Host", "test host/1" } }, metrics() };
+
+		std::vector<aws::cloudwatch::metric> metrics() {
+			std::vector<aws::cloudwatch::metric> metrics { { "UserCPU", &user }, { "EmptyCPU", &empty },
+				{ "SystemCPU", &system } };
+			metrics[2].dimensions = { { "Process", "make" } };
+			return metrics;
+		}
+
+		fixture() {
+			user += 12.5; user += 50;
+			system += 0.1; system += 0.2;
+		}
+
+		std::string build() {
+			const util::buffer& request = builder.build(now, requestTemplate);
+			return std::string(reinterpret_cast<const char*>(request.data()), request.size());
+		}
+	};
+
+	std::string gunzip(const std::string& compressed) {
+		z_stream stream {};
+		inflateInit2(&stream, 15 + 16);
+		std::string output(64 * 1024, '\0');
+		stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(compressed.data()));
+		stream.avail_in = compressed.size();
+		stream.next_out = reinterpret_cast<Bytef*>(&output[0]);
+		stream.avail_out = output.size();
+		const int rc = inflate(&stream, Z_FINISH);
+		output.resize((rc == Z_STREAM_END) ? stream.total_out : 0);
+		inflateEnd(&stream);
+		return output;
+	}
+
+	bool buildRequest() {
+		fixture fixture;
+		const std::string request = fixture.build();
+		std::cout << "# " << request.substr(0, request.find("\r\n")) << std::endl;
+
+		const std::string::size_type headersEnd = request.find("\r\n\r\n");
+		const std::string body = request.substr(headersEnd + 4);
+		const std::string contentLength = "\r\ncontent-length: " + std::to_string(body.size()) + "\r\n";
+		return (request.compare(0, 17, "POST / HTTP/1.1\r\n") == 0)
+			&& (request.find(contentLength) < headersEnd)
+			&& (request.find("Credential=AKIDEXAMPLE/20150830/us-east-1/monitoring/aws4_request") < headersEnd)
+			&& (body.compare(0, 20, "Action=PutMetricData") == 0)
+			&& (body.find("&MetricData.member.1.StatisticValues.Maximum=50") != std::string::npos)
+			&& (body.find("&MetricData.member.2.MetricName=SystemCPU") != std::string::npos)
+			&& (body.find("&MetricData.member.2.StatisticValues.Sum=0.30000000000000004") != std::string::npos)
+			&& (body.find("&MetricData.member.2.StatisticValues.SampleCount=2") != std::string::npos)
+			&& (body.find("&MetricData.member.2.Dimensions.member.1.Value=test%20host%2F1") != std::string::npos)
+			&& (body.find("&MetricData.member.2.Dimensions.member.2.Value=make") != std::string::npos)
+			&& (body.find("&MetricData.member.1.Dimensions.member.2.") == std::string::npos)
+			&& (body.find("&MetricData.member.2.Timestamp=2015-08-30T12%3A36%3A00Z") != std::string::npos)
+			&& (body.find("EmptyCPU") == std::string::npos);
+	}
+
+	bool buildDistributionRequest() {
+		fixture fixture;
+		aws::cloudwatch::distribution narrow, wide;
+		narrow += 10; narrow += 10; narrow += 90;
+		bool accurate = true;
+		for(int i = 0; i < 200; ++i) {
+			const double value = std::ldexp(1 + (i % 16 + 0.25) / 16, i / 16);
+			const double recorded = aws::cloudwatch::distribution::value(aws::cloudwatch::distribution::bucket(value));
+			accurate = accurate && (std::fabs(recorded - value) <= value / 32);
+			wide += value;
+		}
+		const aws::cloudwatch::requestTemplate requestTemplate { { },
+			{ { "Narrow", &narrow }, { "Empty", &fixture.empty }, { "Wide", &wide, "Milliseconds" } } };
+
+		const util::buffer& request = fixture.builder.build(now, requestTemplate);
+		const std::string body = std::string(reinterpret_cast<const char*>(request.data()), request.size());
+		std::cout << "# " << body.substr(body.find("\r\n\r\n") + 4, 240) << "..." << std::endl;
+		return accurate
+			&& (body.find("&MetricData.member.1.Counts.member.1=2") != std::string::npos)
+			&& (body.find("&MetricData.member.1.Counts.member.2=1") != std::string::npos)
+			&& (body.find("&MetricData.member.1.Values.member.3=") == std::string::npos)
+			&& (body.find("&MetricData.member.2.MetricName=Wide") != std::string::npos)
+			&& (body.find("&MetricData.member.1.Unit=Percent") != std::string::npos)
+			&& (body.find("&MetricData.member.3.Unit=Milliseconds") != std::string::npos)
+			&& (body.find("&MetricData.member.2.Values.member.150=") != std::string::npos)
+			&& (body.find("&MetricData.member.2.Values.member.151=") == std::string::npos)
+			&& (body.find("&MetricData.member.3.MetricName=Wide") != std::string::npos)
+			&& (body.find("&MetricData.member.3.Counts.member.50=1") != std::string::npos)
+			&& (body.find("&MetricData.member.3.Values.member.51=") == std::string::npos)
+			&& (body.find("&MetricData.member.4.") == std::string::npos)
+			&& (body.find("StatisticValues") == std::string::npos);
+	}
+
+	bool rebuildRequest() {
+		fixture fixture;
+		const std::string first = fixture.build();
+		return fixture.build() == first;
+	}
+
+	bool buildFromPayload() {
+		fixture fixture;
+		const std::string direct = fixture.build();
+		const aws::cloudwatch::requestTemplate* requestTemplates[] = { &fixture.requestTemplate };
+		const util::buffer& payload = fixture.builder.payload(now - 120, std::begin(requestTemplates),
+				std::end(requestTemplates));
+		const std::string body(reinterpret_cast<const char*>(payload.data()), payload.size());
+		// Signed two minutes after it was written, but still timestamped when it was
+		const util::buffer& request = fixture.builder.build(now, body.data(), body.size());
+		const std::string late(reinterpret_cast<const char*>(request.data()), request.size());
+		return (late.substr(late.find("\r\n\r\n") + 4) == body)
+			&& (body.find("&MetricData.member.1.Timestamp=2015-08-30T12%3A34%3A00Z") != std::string::npos)
+			&& (late.find("x-amz-date: 20150830T123600Z") != std::string::npos)
+			&& (late.substr(0, late.find("\r\n\r\n")).size() == direct.substr(0, direct.find("\r\n\r\n")).size());
+	}
+
+	bool buildCompressedRequest() {
+		fixture fixture;
+		const std::string plain = fixture.build();
+		aws::cloudwatch::requestBuilder builder { "monitoring.us-east-1.amazonaws.com", fixture.signer, "Panopticon",
+			true };
+		const util::buffer& request = builder.build(now, fixture.requestTemplate);
+		const std::string compressed(reinterpret_cast<const char*>(request.data()), request.size());
+		const std::string::size_type headersEnd = compressed.find("\r\n\r\n");
+		const std::string headers = compressed.substr(0, headersEnd);
+		const std::string body = compressed.substr(headersEnd + 4);
+		std::cout << "# " << plain.size() - plain.find("\r\n\r\n") - 4 << " bytes compressed to " << body.size()
+			<< std::endl;
+		return (gunzip(body) == plain.substr(plain.find("\r\n\r\n") + 4))
+			&& (headers.find("\r\ncontent-encoding: gzip\r\n") != std::string::npos)
+			&& (headers.find("\r\ncontent-length: " + std::to_string(body.size()) + "\r\n") != std::string::npos)
+			&& (headers.find("SignedHeaders=content-encoding;content-length;") != std::string::npos);
+	}
+
+	struct packed {
+		std::vector<std::string> bodies;
+		std::vector<unsigned int> datums;
+		unsigned int dropped;
+	};
+
+	packed pack(fixture& fixture, const std::vector<const aws::cloudwatch::requestTemplate*>& templates,
+			const unsigned int maxDatums, const std::size_t maxBytes) {
+		packed packed;
+		packed.dropped = fixture.builder.pack(now, templates.cbegin(), templates.cend(), maxDatums, maxBytes,
+				[&packed](const util::buffer& body, const unsigned int datums) {
+			packed.bodies.emplace_back(reinterpret_cast<const char*>(body.data()), body.size());
+			packed.datums.push_back(datums);
+		});
+		return packed;
+	}
+
+	bool packRequests() {
+		fixture fixture;
+		aws::cloudwatch::distribution wide;
+		for(int i = 0; i < 200; ++i) wide += std::ldexp(1 + (i % 16 + 0.25) / 16, i / 16);
+		const aws::cloudwatch::requestTemplate distributions { { }, { { "Wide", &wide } } };
+		const std::vector<const aws::cloudwatch::requestTemplate*> templates {
+			&fixture.requestTemplate, &distributions, &fixture.requestTemplate };
+
+		// Two statistic sets, then a distribution split over two datums, then two more statistic sets
+		const packed whole = pack(fixture, templates, 1000, 1 << 20);
+		const packed byCount = pack(fixture, templates, 4, 1 << 20);
+
+		// Bodies of exactly two statistic sets, then of one, then too small for any
+		const std::vector<const aws::cloudwatch::requestTemplate*> statistics(3, &fixture.requestTemplate);
+		const std::size_t pairSize = fixture.build().size() - fixture.build().find("\r\n\r\n") - 4;
+		const packed pairs = pack(fixture, statistics, 1000, pairSize);
+		const packed singles = pack(fixture, statistics, 1000, pairSize - 1);
+		const packed none = pack(fixture, statistics, 1000, 100);
+		std::cout << "# " << whole.bodies[0].size() << " bytes packed into " << byCount.bodies.size()
+			<< " requests of at most 4 datums" << std::endl;
+
+		bool withinLimit = true;
+		for(const std::string& body: singles.bodies) withinLimit = withinLimit && (body.size() < pairSize);
+		return (whole.datums == std::vector<unsigned int> { 6 }) && (whole.dropped == 0)
+			&& (byCount.datums == std::vector<unsigned int> { 4, 2 })
+			&& (byCount.bodies[0].find("&MetricData.member.4.Counts.member.50=1") != std::string::npos)
+			&& (byCount.bodies[1].find("&MetricData.member.1.StatisticValues.Maximum=50") != std::string::npos)
+			&& (byCount.bodies[1].find("&MetricData.member.3.") == std::string::npos)
+			&& (pairs.datums == std::vector<unsigned int> { 2, 2, 2 }) && (pairs.bodies[0].size() == pairSize)
+			&& (singles.datums == std::vector<unsigned int>(6, 1)) && withinLimit
+			&& (singles.bodies[1].find("&MetricData.member.1.MetricName=SystemCPU") != std::string::npos)
+			&& none.bodies.empty() && (none.dropped == 6);
+	}
+
+	bool rebuildWithoutAllocating() {
+		fixture fixture;
+		fixture.builder.build(now, fixture.requestTemplate);
+
+		aws::cloudwatch::requestBuilder compressing { "monitoring.us-east-1.amazonaws.com", fixture.signer,
+			"Panopticon", true };
+		compressing.build(now, fixture.requestTemplate);
+
+		// New statistics of the same length as before, since a larger body may still have to grow the buffers
+		const std::size_t before = allocations;
+		fixture.user += 25;
+		fixture.builder.build(now, fixture.requestTemplate);
+		compressing.build(now, fixture.requestTemplate);
+		const std::size_t after = allocations;
+		std::cout << "# Allocations while rebuilding: " << (after - before) << std::endl;
+		return after == before;
+	}
+}
+
+int main(int argc, char** argv) {
+	return test::suite {
+		{ "request building", buildRequest },
+		{ "distribution request building", buildDistributionRequest },
+		{ "identical rebuild", rebuildRequest },
+		{ "request from a spooled payload", buildFromPayload },
+		{ "gzip-compressed request", buildCompressedRequest },
+		{ "request packing", packRequests },
+		{ "allocation-free rebuild", rebuildWithoutAllocating },
+	}.run();
+}
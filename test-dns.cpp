@@ -0,0 +1,274 @@
+// Copyright (C) 2015 Philip Cronje. All rights reserved.
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include "test-framework.h"
+
+#include "coroutine.h"
+#include "dns.h"
+
+namespace {
+	/* A name server on the loopback interface serving a fixed zone, answering only when asked to. */
+	class stubServer {
+		int fd_;
+		net::address address_;
+
+		struct record {
+			const char* name;
+			std::uint16_t type;
+			std::uint32_t ttl;
+			std::string data;
+		};
+		std::vector<record> zone_;
+
+		static std::string ipv4(const char* text) {
+			in_addr address;
+			inet_pton(AF_INET, text, &address);
+			return std::string(reinterpret_cast<const char*>(&address), sizeof(address));
+		}
+
+		static std::string ipv6(const char* text) {
+			in6_addr address;
+			inet_pton(AF_INET6, text, &address);
+			return std::string(reinterpret_cast<const char*>(&address), sizeof(address));
+		}
+
+		static void append16(std::string& message, const std::uint16_t value) {
+			message += static_cast<char>(value >> 8);
+			message += static_cast<char>(value);
+		}
+
+		static void append32(std::string& message, const std::uint32_t value) {
+			append16(message, value >> 16);
+			append16(message, value);
+		}
+
+		public:
+			unsigned int queries = 0;
+
+			stubServer() : fd_(::socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) {
+				net::address::parse("127.0.0.1", address_);
+				bind(fd_, reinterpret_cast<const sockaddr*>(&address_.storage), address_.length);
+				getsockname(fd_, reinterpret_cast<sockaddr*>(&address_.storage), &address_.length);
+
+				zone_ = {
+					{ "a.test", 1, 300, ipv4("192.0.2.1") },
+					{ "a.test", 28, 300, ipv6("2001:db8::1") },
+					{ "v4only.test", 1, 300, ipv4("192.0.2.3") },
+					{ "short.test", 1, 1, ipv4("192.0.2.4") },
+					// The target is sent uncompressed, followed by its address under a pointer to it
+					{ "alias.test", 5, 300, std::string("\x01" "b" "\x04" "test", 8) },
+				};
+			}
+			~stubServer() { close(fd_); }
+
+			const net::address& address() const noexcept { return address_; }
+
+			/* Answers every query waiting to be read. */
+			void serve() {
+				char query[512];
+				sockaddr_storage client;
+				socklen_t clientLength = sizeof(client);
+				ssize_t size;
+				while((size = recvfrom(fd_, query, sizeof(query), 0, reinterpret_cast<sockaddr*>(&client),
+						&clientLength)) > 12) {
+					++queries;
+					std::string name;
+					std::size_t p = 12;
+					while((p < static_cast<std::size_t>(size)) && (query[p] != 0)) {
+						if(!name.empty()) name += '.';
+						name.append(query + p + 1, query[p]);
+						p += 1 + query[p];
+					}
+					const std::size_t questionEnd = p + 5;
+					const std::uint16_t type = (static_cast<std::uint8_t>(query[p + 1]) << 8)
+						| static_cast<std::uint8_t>(query[p + 2]);
+					if(name == "silent.test") continue;
+
+					std::vector<const record*> answers;
+					bool exists = false;
+					for(const record& record: zone_) {
+						if(name != record.name) continue;
+						exists = true;
+						if((record.type == type) || (record.type == 5)) answers.push_back(&record);
+					}
+
+					std::string response(query, 2);
+					append16(response, exists ? 0x8180 : 0x8183);
+					append16(response, 1);
+					append16(response, answers.size() + ((name == "alias.test") ? 1 : 0));
+					append16(response, exists ? 0 : 1);
+					append16(response, 0);
+					response.append(query + 12, questionEnd - 12);
+					std::size_t aliasTarget = 0;
+					for(const record* record: answers) {
+						append16(response, 0xC00C);
+						append16(response, record->type);
+						append16(response, 1);
+						append32(response, record->ttl);
+						append16(response, record->data.size());
+						if(record->type == 5) aliasTarget = response.size();
+						response += record->data;
+					}
+					if(aliasTarget != 0) {
+						append16(response, 0xC000 | aliasTarget);
+						append16(response, type);
+						append16(response, 1);
+						append32(response, 300);
+						const std::string address = (type == 1) ? ipv4("192.0.2.5") : ipv6("2001:db8::5");
+						append16(response, address.size());
+						response += address;
+					}
+					if(!exists) {
+						// SOA with a TTL of an hour but a negative caching TTL of one second
+						response += std::string("\x04" "test" "\x00", 6);
+						append16(response, 6);
+						append16(response, 1);
+						append32(response, 3600);
+						const std::string names("\x02" "ns" "\xC0\x0C" "\x05" "admin" "\xC0\x0C", 13);
+						append16(response, names.size() + 20);
+						response += names;
+						for(const std::uint32_t field: { 1, 3600, 600, 86400, 1 }) append32(response, field);
+					}
+					sendto(fd_, response.data(), response.size(), 0, reinterpret_cast<const sockaddr*>(&client),
+							clientLength);
+				}
+			}
+	};
+
+	struct result {
+		bool completed = false;
+		std::vector<std::string> addresses;
+		std::error_code error;
+	};
+
+	struct fixture {
+		::epoll reactor;
+		stubServer server;
+		dns::resolver resolver { reactor, server.address(), std::chrono::milliseconds(20) };
+
+		/* Resolves host, serving queries and retrying until the resolver gives an answer. */
+		result resolve(const std::string& host) {
+			result result;
+			resolver.resolve(host, [&result](const std::vector<net::address>& addresses, const std::error_code error) {
+				result.completed = true;
+				for(const net::address& address: addresses) result.addresses.push_back(address.toString());
+				result.error = error;
+			});
+			for(int i = 0; (i < 100) && !result.completed; ++i) {
+				server.serve();
+				reactor.dispatch(std::chrono::milliseconds(5));
+				resolver.expire();
+			}
+			return result;
+		}
+	};
+
+	bool resolveHost() {
+		fixture fixture;
+		const result first = fixture.resolve("a.test");
+		const unsigned int queries = fixture.server.queries;
+		const result cached = fixture.resolve("a.test");
+		return first.completed && !first.error
+			&& (first.addresses == std::vector<std::string> { "192.0.2.1", "2001:db8::1" })
+			&& (queries == 2) && (fixture.server.queries == 2) && (cached.addresses == first.addresses);
+	}
+
+	bool resolvePartially() {
+		fixture fixture;
+		const result v4only = fixture.resolve("v4only.test");
+		const result alias = fixture.resolve("alias.test");
+		const result numeric = fixture.resolve("2001:db8::7");
+		return (v4only.addresses == std::vector<std::string> { "192.0.2.3" })
+			&& (alias.addresses == std::vector<std::string> { "192.0.2.5", "2001:db8::5" })
+			&& (numeric.addresses == std::vector<std::string> { "2001:db8::7" }) && (fixture.server.queries == 4);
+	}
+
+	bool expireAnswers() {
+		fixture fixture;
+		const result missing = fixture.resolve("missing.test");
+		fixture.resolve("short.test");
+		fixture.resolve("missing.test");
+		fixture.resolve("short.test");
+		const bool cached = fixture.server.queries == 4;
+		// Both the negative answer and the address are cached for one second
+		std::this_thread::sleep_for(std::chrono::milliseconds(1100));
+		const result expired = fixture.resolve("short.test");
+		fixture.resolve("missing.test");
+		return (missing.error == dns::error::NameError) && missing.addresses.empty() && cached
+			&& (expired.addresses == std::vector<std::string> { "192.0.2.4" }) && (fixture.server.queries == 8);
+	}
+
+	bool timeOut() {
+		fixture fixture;
+		const result silent = fixture.resolve("silent.test");
+		const unsigned int queries = fixture.server.queries;
+		fixture.resolve("silent.test");
+		std::cout << "# " << silent.error.message() << std::endl;
+		// Three attempts each for A and AAAA, and no caching of the failure
+		return (silent.error == dns::error::Timeout) && (queries == 2 * dns::resolver::maxAttempts)
+			&& (fixture.server.queries == 4 * dns::resolver::maxAttempts);
+	}
+
+	bool coalesceLookups() {
+		fixture fixture;
+		unsigned int completions = 0;
+		for(int i = 0; i < 3; ++i) {
+			fixture.resolver.resolve("a.test", [&](const std::vector<net::address>&, std::error_code) { ++completions; });
+		}
+		const std::size_t pending = fixture.resolver.pending();
+		fixture.resolve("a.test");
+		return (pending == 1) && (completions == 3) && (fixture.server.queries == 2);
+	}
+
+	co::task<std::vector<net::address>> lookUp(dns::resolver& resolver, const std::string host) {
+		co_return co_await dns::resolution(resolver, host);
+	}
+
+	bool awaitResolution() {
+		fixture fixture;
+		co::task<std::vector<net::address>> numeric = lookUp(fixture.resolver, "192.0.2.9");
+		numeric.start();
+		const bool immediate = numeric.done() && (numeric.result().front().toString() == "192.0.2.9");
+
+		co::task<std::vector<net::address>> named = lookUp(fixture.resolver, "a.test");
+		named.start();
+		const bool suspended = !named.done();
+		for(int i = 0; (i < 100) && !named.done(); ++i) {
+			fixture.server.serve();
+			fixture.reactor.dispatch(std::chrono::milliseconds(5));
+		}
+		const bool resolved = named.done() && (named.result().size() == 2);
+
+		co::task<std::vector<net::address>> missing = lookUp(fixture.resolver, "missing.test");
+		missing.start();
+		for(int i = 0; (i < 100) && !missing.done(); ++i) {
+			fixture.server.serve();
+			fixture.reactor.dispatch(std::chrono::milliseconds(5));
+		}
+		bool failed = false;
+		try {
+			missing.result();
+		} catch(const std::system_error& e) {
+			failed = e.code() == dns::error::NameError;
+		}
+		return immediate && suspended && resolved && failed;
+	}
+}
+
+int main(int argc, char** argv) {
+	return test::suite {
+		{ "host resolution and caching", resolveHost },
+		{ "partial, aliased and numeric answers", resolvePartially },
+		{ "TTL and negative caching", expireAnswers },
+		{ "timeouts", timeOut },
+		{ "concurrent lookups", coalesceLookups },
+		{ "awaiting from a coroutine", awaitResolution },
+	}.run();
+}
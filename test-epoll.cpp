@@ -0,0 +1,110 @@
+// Copyright (C) 2015 Philip Cronje. All rights reserved.
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "test-framework.h"
+
+#include "epoll.h"
+
+namespace {
+	bool countMissedExpiries() {
+		epoll::timer timer(std::chrono::milliseconds(10));
+		const bool early = timer.expirations() == 0;
+		std::this_thread::sleep_for(std::chrono::milliseconds(55));
+		const unsigned long long expirations = timer.expirations();
+		std::cout << "# Expirations after 55 ms: " << expirations << std::endl;
+		return early && (expirations >= 5) && (expirations <= 6) && (timer.missed() == expirations - 1);
+	}
+
+	bool measureLateness() {
+		epoll::timer timer(std::chrono::milliseconds(10));
+		const bool unread = timer.lateness() == std::chrono::nanoseconds::zero();
+		std::this_thread::sleep_for(std::chrono::milliseconds(35));
+		timer.expirations();
+		const std::chrono::nanoseconds lateness = timer.lateness();
+		std::cout << "# Lateness 35 ms after arming a 10 ms timer: " << lateness.count() << " ns" << std::endl;
+		// Measured from the latest deadline that has passed, not the first
+		return unread && (lateness > std::chrono::nanoseconds::zero()) && (lateness < std::chrono::milliseconds(10));
+	}
+
+	bool waitForTimer() {
+		epoll epoll;
+		epoll::timer timer(std::chrono::milliseconds(10));
+		unsigned long long expirations = 0;
+		epoll::callback handler([&](std::uint32_t) { expirations += timer.expirations(); });
+		epoll.add(timer, handler, EPOLLIN);
+
+		const auto start = std::chrono::steady_clock::now();
+		while(expirations < 10) epoll.dispatch();
+		// Ten periods after the timer was armed, independent of how long each wake-up took to handle
+		const auto elapsed = std::chrono::steady_clock::now() - start;
+		return (elapsed >= std::chrono::milliseconds(99)) && (elapsed < std::chrono::milliseconds(150))
+			&& (expirations == 10);
+	}
+
+	bool wakeFromThread() {
+		epoll epoll;
+		epoll::event event;
+		unsigned long long notifications = 0;
+		epoll::callback handler([&](std::uint32_t) { notifications += event.consume(); });
+		epoll.add(event, handler, EPOLLIN);
+
+		std::thread notifier([&event] {
+			for(int i = 0; i < 3; ++i) event.notify();
+		});
+		notifier.join();
+		const unsigned int dispatched = epoll.dispatch(std::chrono::milliseconds(100));
+		// Notifications are counted together, and reading them rearms the event
+		const unsigned int after = epoll.dispatch(std::chrono::milliseconds(0));
+		return (dispatched == 1) && (notifications == 3) && (after == 0) && (event.consume() == 0);
+	}
+
+	bool dispatchBatch() {
+		epoll epoll;
+		int pipes[3][2];
+		for(int (&pipe)[2]: pipes) {
+			if(::pipe2(pipe, O_NONBLOCK | O_CLOEXEC) == -1) return false;
+		}
+
+		std::vector<int> dispatched;
+		epoll::callback first([&](std::uint32_t) { dispatched.push_back(0); });
+		epoll::callback second([&](std::uint32_t) { dispatched.push_back(1); });
+		epoll::callback third([&](const std::uint32_t events) { if((events & EPOLLOUT) != 0) dispatched.push_back(2); });
+		epoll.add(pipes[0][0], first, EPOLLIN);
+		epoll.add(pipes[1][0], second, EPOLLIN);
+		epoll.add(pipes[2][1], third, EPOLLIN);
+		// Re-arm the write end of the third pipe for writability
+		epoll.modify(pipes[2][1], third, EPOLLOUT);
+		for(int (&pipe)[2]: pipes) {
+			if(write(pipe[1], "x", 1) != 1) return false;
+		}
+
+		const unsigned int count = epoll.dispatch(std::chrono::milliseconds(100));
+		std::sort(dispatched.begin(), dispatched.end());
+		const bool all = dispatched == std::vector<int> { 0, 1, 2 };
+		// Level-triggered registrations report again; the removed one does not
+		epoll.remove(pipes[0][0]);
+		const unsigned int after = epoll.dispatch(std::chrono::milliseconds(0));
+		for(int (&pipe)[2]: pipes) {
+			close(pipe[0]);
+			close(pipe[1]);
+		}
+		return (count == 3) && all && (after == 2);
+	}
+}
+
+int main(int argc, char** argv) {
+	return test::suite {
+		{ "missed expiry counting", countMissedExpiries },
+		{ "timer lateness", measureLateness },
+		{ "timer events", waitForTimer },
+		{ "batched dispatch", dispatchBatch },
+		{ "waking from another thread", wakeFromThread },
+	}.run();
+}
@@ -0,0 +1,123 @@
+// Copyright (C) 2015 Philip Cronje. All rights reserved.
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "test-framework.h"
+
+#include "http.h"
+
+namespace {
+	std::vector<http::response> parse(const std::string& input, const std::size_t split) {
+		http::responseParser parser;
+		std::vector<http::response> responses;
+		const http::responseParser::responseHandler handler = [&](http::response& response) {
+			responses.push_back(response);
+		};
+		for(std::size_t i = 0; i < input.size(); i += split) {
+			parser.feed(input.data() + i, std::min(split, input.size() - i), handler);
+		}
+		parser.close(handler);
+		return responses;
+	}
+
+	/* Every response must come out the same however the input is split. */
+	template<typename P>
+	bool parseSplits(const std::string& input, const P& predicate) {
+		for(const std::size_t split: { input.size(), std::size_t(1), std::size_t(7) }) {
+			if(!predicate(parse(input, split))) {
+				std::cout << "# Failed with input split every " << split << " bytes" << std::endl;
+				return false;
+			}
+		}
+		return true;
+	}
+
+	bool parseContentLength() {
+		return parseSplits("HTTP/1.1 200 OK\r\nContent-Length: 5\r\nContent-Type: text/xml\r\n\r\nhello",
+				[](const std::vector<http::response>& responses) {
+					return (responses.size() == 1) && (responses[0].status == 200) && responses[0].keepAlive
+						&& (responses[0].body == "hello");
+				});
+	}
+
+	bool parseChunked() {
+		return parseSplits("HTTP/1.1 400 Bad Request\r\ntransfer-encoding: chunked\r\n\r\n"
+				"4;ext=1\r\nWiki\r\n5\r\npedia\r\n0\r\nX-Trailer: 1\r\n\r\n",
+				[](const std::vector<http::response>& responses) {
+					return (responses.size() == 1) && (responses[0].status == 400) && !responses[0].successful()
+						&& (responses[0].body == "Wikipedia");
+				});
+	}
+
+	bool parsePipelined() {
+		return parseSplits("HTTP/1.1 100 Continue\r\n\r\n"
+				"HTTP/1.1 200 OK\r\nContent-Length: 0\r\n\r\n"
+				"HTTP/1.1 204 No Content\r\n\r\n"
+				"HTTP/1.1 503 Service Unavailable\r\nConnection: close\r\nContent-Length: 4\r\n\r\nbusy",
+				[](const std::vector<http::response>& responses) {
+					return (responses.size() == 3) && (responses[0].status == 200) && (responses[1].status == 204)
+						&& (responses[2].status == 503) && !responses[2].keepAlive && (responses[2].body == "busy");
+				});
+	}
+
+	bool parseUntilClose() {
+		return parseSplits("HTTP/1.0 200 OK\r\n\r\nuntil the end",
+				[](const std::vector<http::response>& responses) {
+					return (responses.size() == 1) && !responses[0].keepAlive && (responses[0].body == "until the end");
+				});
+	}
+
+	bool rejectMalformed() {
+		try {
+			parse("HTTP/1.1 200 OK\r\nContent-Length: x\r\n\r\n", 64);
+		} catch(const std::runtime_error&) {
+			return true;
+		}
+		return false;
+	}
+
+	util::buffer request(const char* text) {
+		const std::size_t size = std::strlen(text);
+		std::unique_ptr<uint8_t[]> data(new uint8_t[size]);
+		std::memcpy(data.get(), text, size);
+		return util::buffer(std::move(data), size);
+	}
+
+	bool pipelineRequests() {
+		http::client client;
+		std::vector<unsigned int> statuses;
+		const auto record = [&](const http::response& response) { statuses.push_back(response.status); };
+		client.enqueue(request("GET /1 HTTP/1.1\r\n\r\n"), record);
+		client.enqueue(request("GET /2 HTTP/1.1\r\n\r\n"), record);
+		const std::string outbound(reinterpret_cast<const char*>(static_cast<void*>(client.outbound())),
+				client.outbound().remaining());
+		client.outbound().advance(client.outbound().remaining());
+		client.enqueue(request("GET /3 HTTP/1.1\r\n\r\n"), record);
+
+		const std::string responses = "HTTP/1.1 200 OK\r\nContent-Length: 0\r\n\r\nHTTP/1.1 500 Oops\r\nContent-Length: 0";
+		client.receive(responses.data(), responses.size());
+		const bool pipelined = (outbound == "GET /1 HTTP/1.1\r\n\r\nGET /2 HTTP/1.1\r\n\r\n")
+			&& (client.outbound().remaining() == 19) && (statuses == std::vector<unsigned int> { 200 });
+		client.receive("\r\n\r\n", 4);
+		const bool completed = (statuses == std::vector<unsigned int> { 200, 500 }) && (client.inFlight() == 1)
+			&& !client.closing();
+
+		// The connection drops with the last request unanswered
+		client.disconnected();
+		return pipelined && completed && (statuses == std::vector<unsigned int> { 200, 500, 0 })
+			&& (client.inFlight() == 0) && !client.outbound();
+	}
+}
+
+int main(int argc, char** argv) {
+	return test::suite {
+		{ "content-length response", parseContentLength },
+		{ "chunked response", parseChunked },
+		{ "pipelined responses", parsePipelined },
+		{ "response delimited by close", parseUntilClose },
+		{ "malformed response", rejectMalformed },
+		{ "pipelined requests", pipelineRequests },
+	}.run();
+}
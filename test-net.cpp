@@ -0,0 +1,143 @@
+// Copyright (C) 2015 Philip Cronje. All rights reserved.
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <netinet/in.h>
+
+#include "test-framework.h"
+
+#include "net.h"
+
+namespace {
+	typedef std::chrono::steady_clock clock;
+
+	/* Listeners on several loopback addresses sharing a port: 127.0.0.1 accepts connections, 127.0.0.2 never
+	 * completes them, as its accept queue is full, and nothing listens on 127.0.0.3 or 127.0.0.4. */
+	class listeners {
+		// Declared first, as the listeners are bound to it as they are initialised
+		std::uint16_t port_ = 0;
+		int good_;
+		int stuck_;
+		std::vector<int> backlog_;
+
+		int listen(const char* host, const int queue) {
+			const int fd = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+			net::address address;
+			net::address::parse(host, address);
+			address.port(port_);
+			bind(fd, reinterpret_cast<const sockaddr*>(&address.storage), address.length);
+			::listen(fd, queue);
+			getsockname(fd, reinterpret_cast<sockaddr*>(&address.storage), &address.length);
+			port_ = ntohs(reinterpret_cast<const sockaddr_in&>(address.storage).sin_port);
+			return fd;
+		}
+
+		public:
+			listeners() : good_(listen("127.0.0.1", 8)), stuck_(listen("127.0.0.2", 0)) {
+				// Fill the accept queue, after which the listener drops further SYNs
+				net::address stuck = address("127.0.0.2");
+				stuck.port(port_);
+				for(int i = 0; i < 3; ++i) {
+					backlog_.push_back(::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0));
+					::connect(backlog_.back(), reinterpret_cast<const sockaddr*>(&stuck.storage), stuck.length);
+				}
+				std::this_thread::sleep_for(std::chrono::milliseconds(50));
+			}
+			~listeners() {
+				close(good_);
+				close(stuck_);
+				for(const int fd: backlog_) close(fd);
+			}
+
+			std::uint16_t port() const noexcept { return port_; }
+
+			static net::address address(const char* host) {
+				net::address address;
+				net::address::parse(host, address);
+				return address;
+			}
+	};
+
+	struct result {
+		bool connected = false;
+		bool failed = false;
+		std::string peer;
+		std::chrono::milliseconds elapsed;
+	};
+
+	/* Connects to the addresses, waiting up to a second for the outcome. */
+	result connect(net::socket& socket, const std::vector<const char*>& hosts, const std::uint16_t port) {
+		epoll reactor;
+		result result;
+		epoll::callback handler([&](const std::uint32_t events) {
+			if((events & EPOLLERR) != 0) result.failed = true;
+			else if(((events & EPOLLOUT) != 0) && socket.connected()) result.connected = true;
+		});
+		std::vector<net::address> addresses;
+		for(const char* host: hosts) addresses.push_back(listeners::address(host));
+
+		const clock::time_point start = clock::now();
+		socket.connect(addresses, port, reactor, handler);
+		while(!result.connected && !result.failed && (clock::now() - start < std::chrono::seconds(1))) {
+			reactor.dispatch(std::chrono::milliseconds(10));
+		}
+		result.elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(clock::now() - start);
+		if(result.connected) {
+			net::address peer;
+			peer.length = sizeof(peer.storage);
+			getpeername(socket, reinterpret_cast<sockaddr*>(&peer.storage), &peer.length);
+			result.peer = peer.toString();
+		}
+		std::cout << "# " << result.elapsed.count() << " ms" << std::endl;
+		return result;
+	}
+
+	bool fallBackAfterDelay() {
+		listeners listeners;
+		net::socket socket;
+		const result result = connect(socket, { "127.0.0.2", "127.0.0.1" }, listeners.port());
+		// The stalled attempt is given attemptDelay before the next is started alongside it
+		return result.connected && (result.peer == "127.0.0.1") && (result.elapsed >= net::socket::attemptDelay)
+			&& (result.elapsed < 4 * net::socket::attemptDelay) && (socket.preferredFamily() == AF_INET);
+	}
+
+	bool fallBackOnFailure() {
+		listeners listeners;
+		net::socket socket;
+		const result result = connect(socket, { "127.0.0.3", "127.0.0.2", "127.0.0.1" }, listeners.port());
+		// The refused attempt makes way at once, but the stalled one still holds up the last
+		return result.connected && (result.peer == "127.0.0.1") && (result.elapsed >= net::socket::attemptDelay)
+			&& (result.elapsed < 4 * net::socket::attemptDelay);
+	}
+
+	bool failAll() {
+		listeners listeners;
+		net::socket socket;
+		const result result = connect(socket, { "127.0.0.3", "127.0.0.4" }, listeners.port());
+		return result.failed && !socket.connected() && !socket.connecting() && (socket.error() == ECONNREFUSED)
+			&& (result.elapsed < net::socket::attemptDelay);
+	}
+
+	bool reconnect() {
+		listeners listeners;
+		net::socket socket;
+		const result refused = connect(socket, { "127.0.0.3", "127.0.0.1" }, listeners.port());
+		socket.disconnect();
+		const result again = connect(socket, { "127.0.0.1" }, listeners.port());
+		return refused.connected && (refused.elapsed < net::socket::attemptDelay) && again.connected
+			&& (again.peer == "127.0.0.1") && (socket.error() == 0);
+	}
+}
+
+int main(int argc, char** argv) {
+	return test::suite {
+		{ "fall back from a stalled attempt", fallBackAfterDelay },
+		{ "fall back from a failed attempt", fallBackOnFailure },
+		{ "report failure once every attempt fails", failAll },
+		{ "connect again after disconnecting", reconnect },
+	}.run();
+}
@@ -0,0 +1,210 @@
+// Copyright (C) 2015 Philip Cronje. All rights reserved.
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "test-framework.h"
+#include "test-temporary.h"
+
+#include "publisher.h"
+
+namespace {
+	std::string response(const std::string& status, const std::string& body = "") {
+		return "HTTP/1.1 " + status + "\r\nContent-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body;
+	}
+
+	const std::string ok = response("200 OK");
+	const std::string throttled = response("400 Bad Request",
+			"<ErrorResponse><Error><Code>Throttling</Code></Error></ErrorResponse>");
+	const std::string unavailable = response("503 Service Unavailable");
+	const std::string invalid = response("400 Bad Request",
+			"<ErrorResponse><Error><Code>InvalidParameterValue</Code></Error></ErrorResponse>");
+
+	/* A publisher sending from a spool in a new temporary file, with requests that are just their bodies. */
+	struct fixture : test::temporaryFile {
+		std::unique_ptr<util::spool> spool;
+		http::client client;
+		util::buffer request;
+		std::vector<publisher::outcome> outcomes;
+		const publisher::clock::time_point start = publisher::clock::now();
+		std::unique_ptr<publisher> sender;
+
+		explicit fixture(const publisher::options& options) : temporaryFile("test-publisher") {
+			spool.reset(new util::spool(path, 65536));
+			sender.reset(new publisher(*spool, client, [this](const std::uint8_t* body, const std::size_t size)
+					-> const util::buffer& {
+				request.clear();
+				request.append(body, size);
+				return request;
+			}, [this](const publisher::outcome outcome, std::uint32_t, const http::response&,
+					publisher::clock::duration) {
+				outcomes.push_back(outcome);
+			}, options, start, 1));
+		}
+
+		void enqueue(const std::string& body, const std::uint32_t datums) {
+			util::buffer buffer;
+			buffer.append(body.data(), body.size());
+			sender->enqueue(buffer, datums);
+		}
+
+		/* Takes the request bytes queued on the client. */
+		std::string sent() {
+			const std::string bytes(reinterpret_cast<const char*>(client.outbound().data()), client.outbound().size());
+			client.outbound().clear();
+			return bytes;
+		}
+
+		void respond(const std::string& response) { client.receive(response.data(), response.size()); }
+	};
+
+	publisher::options options(const double rate = 100, const unsigned int maxAttempts = 3) {
+		return { rate, rate, 4, std::chrono::milliseconds(100), std::chrono::seconds(10), maxAttempts,
+			std::chrono::milliseconds(0) };
+	}
+
+	bool deliverInOrder() {
+		fixture fixture(options());
+		fixture.enqueue("one", 2);
+		fixture.enqueue("two", 3);
+		const unsigned int queued = fixture.sender->drain(fixture.start);
+		const std::string sent = fixture.sent();
+		fixture.respond(ok + ok);
+		return (queued == 2) && (sent == "onetwo") && (fixture.spool->records() == 0)
+			&& (fixture.outcomes == std::vector<publisher::outcome> { publisher::Sent, publisher::Sent })
+			&& (fixture.sender->datums().sent == 5);
+	}
+
+	bool retryThrottled() {
+		fixture fixture(options());
+		fixture.enqueue("one", 2);
+		fixture.enqueue("two", 3);
+		fixture.sender->drain(fixture.start);
+		fixture.sent();
+		// The second request succeeds, and is committed along with the first once that is, rather than sent again
+		fixture.respond(throttled + ok);
+		const publisher::clock::time_point resumeAt = fixture.sender->resumeAt();
+		const bool backedOff = (fixture.sender->drain(resumeAt - std::chrono::milliseconds(1)) == 0)
+			&& (resumeAt <= publisher::clock::now() + std::chrono::milliseconds(100));
+		const bool heldBack = fixture.spool->records() == 2;
+		const unsigned int queued = fixture.sender->drain(resumeAt);
+		const std::string sent = fixture.sent();
+		fixture.respond(ok);
+		return backedOff && heldBack && (queued == 1) && (sent == "one") && (fixture.spool->records() == 0)
+			&& (fixture.sender->datums().retried == 2) && (fixture.sender->datums().sent == 5);
+	}
+
+	bool skipInFlight() {
+		fixture fixture(options());
+		fixture.enqueue("one", 2);
+		fixture.enqueue("two", 3);
+		fixture.enqueue("three", 4);
+		fixture.sender->drain(fixture.start);
+		fixture.sent();
+		// The head is throttled while the requests behind it are still awaiting their answers
+		fixture.respond(throttled);
+		const unsigned int queued = fixture.sender->drain(fixture.sender->resumeAt());
+		const std::string resent = fixture.sent();
+		fixture.respond(ok + ok + ok);
+		const unsigned int after = fixture.sender->drain(fixture.sender->resumeAt());
+		return (queued == 1) && (resent == "one") && (after == 0) && fixture.sent().empty()
+			&& (fixture.spool->records() == 0) && (fixture.sender->datums().sent == 9)
+			&& (fixture.sender->datums().retried == 2);
+	}
+
+	bool giveUpAfterAttempts() {
+		fixture fixture(options(100, 3));
+		fixture.enqueue("one", 2);
+		fixture.enqueue("two", 3);
+		for(int i = 0; i < 3; ++i) {
+			fixture.sender->drain(fixture.sender->resumeAt());
+			fixture.sent();
+			fixture.respond(unavailable + unavailable);
+		}
+		const std::vector<publisher::outcome> expected { publisher::Retried, publisher::Retried, publisher::Retried,
+			publisher::Retried, publisher::Dropped, publisher::Retried };
+		// The first request has been given up on, and the second is still waiting to be sent
+		fixture.sender->drain(fixture.sender->resumeAt());
+		return (fixture.outcomes == expected) && (fixture.sent() == "two") && (fixture.spool->records() == 1)
+			&& (fixture.sender->datums().dropped == 2);
+	}
+
+	bool dropRefused() {
+		fixture fixture(options());
+		fixture.enqueue("one", 2);
+		fixture.sender->drain(fixture.start);
+		fixture.respond(invalid);
+		return !publisher::retryable(http::response { 400, true, "<Code>InvalidParameterValue</Code>" })
+			&& (fixture.outcomes == std::vector<publisher::outcome> { publisher::Dropped })
+			&& (fixture.spool->records() == 0) && (fixture.sender->resumeAt() == fixture.start);
+	}
+
+	bool resendAfterDisconnect() {
+		fixture fixture(options());
+		fixture.enqueue("one", 2);
+		fixture.enqueue("two", 3);
+		fixture.sender->drain(fixture.start);
+		fixture.sent();
+		fixture.respond(ok);
+		fixture.client.disconnected();
+		fixture.sender->drain(fixture.start);
+		return (fixture.sent() == "two") && (fixture.sender->datums().sent == 2)
+			&& (fixture.sender->datums().retried == 3);
+	}
+
+	bool limitRate() {
+		// Two requests a second, with no more than two at once
+		fixture fixture(options(2));
+		for(int i = 0; i < 6; ++i) fixture.enqueue(std::string(1, '0' + i), 1);
+		const unsigned int burst = fixture.sender->drain(fixture.start);
+		fixture.respond(ok + ok);
+		const unsigned int early = fixture.sender->drain(fixture.start + std::chrono::milliseconds(400));
+		const unsigned int later = fixture.sender->drain(fixture.start + std::chrono::milliseconds(500));
+		fixture.respond(ok);
+		const unsigned int rested = fixture.sender->drain(fixture.start + std::chrono::seconds(10));
+		return (burst == 2) && (early == 0) && (later == 1) && (rested == 2) && (fixture.sent() == "01234");
+	}
+
+	bool jitterBackoff() {
+		backoff backoff(std::chrono::milliseconds(100), std::chrono::milliseconds(1000), 1);
+		bool bounded = true;
+		for(const long ceiling: { 100, 200, 400, 800, 1000, 1000 }) {
+			// Each draw is uniform from zero up to the ceiling, so sample the same ceiling repeatedly
+			for(int i = 0; i < 50; ++i) {
+				backoff.reset();
+				for(long c = 100; c < ceiling; c *= 2) backoff.next();
+				if(backoff.next() > std::chrono::milliseconds(ceiling)) bounded = false;
+			}
+		}
+		const unsigned int failures = backoff.failures();
+		backoff.reset();
+		// Draws are spread out rather than all at the ceiling
+		std::chrono::milliseconds smallest = std::chrono::milliseconds::max();
+		for(int i = 0; i < 50; ++i) smallest = std::min(smallest, backoff.jitter(std::chrono::milliseconds(1000)));
+		return bounded && (failures == 5) && (backoff.failures() == 0) && (smallest < std::chrono::milliseconds(500));
+	}
+
+	bool refillTokens() {
+		const tokenBucket::clock::time_point start = tokenBucket::clock::now();
+		tokenBucket bucket(4, 2, start);
+		const bool burst = bucket.take(start) && bucket.take(start) && !bucket.take(start);
+		const bool refilled = !bucket.take(start + std::chrono::milliseconds(200))
+			&& bucket.take(start + std::chrono::milliseconds(500));
+		return burst && refilled && (bucket.tokens(start + std::chrono::seconds(10)) == 2);
+	}
+}
+
+int main(int argc, char** argv) {
+	return test::suite {
+		{ "delivering in order", deliverInOrder },
+		{ "retrying throttled requests", retryThrottled },
+		{ "skipping requests in flight", skipInFlight },
+		{ "giving up after too many attempts", giveUpAfterAttempts },
+		{ "dropping refused requests", dropRefused },
+		{ "resending after a disconnect", resendAfterDisconnect },
+		{ "limiting the request rate", limitRate },
+		{ "jittered exponential backoff", jitterBackoff },
+		{ "refilling the token bucket", refillTokens },
+	}.run();
+}
@@ -0,0 +1,141 @@
+// Copyright (C) 2015 Philip Cronje. All rights reserved.
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "test-framework.h"
+
+#include "registry.h"
+#include "timer-wheel.h"
+
+namespace {
+	bool fireTimers() {
+		timerWheel wheel;
+		std::vector<unsigned long long> fired;
+		timerWheel::timer soon([&] { fired.push_back(wheel.now()); });
+		timerWheel::timer cascaded([&] { fired.push_back(wheel.now()); });
+		timerWheel::timer cancelled([&] { fired.push_back(0); });
+		wheel.schedule(soon, 3);
+		// Far enough ahead to be cascaded down twice before it fires
+		wheel.schedule(cascaded, 64 * 64 + 5);
+		wheel.schedule(cancelled, 10);
+		wheel.cancel(cancelled);
+		wheel.advance(64 * 64 * 2);
+		return (fired == std::vector<unsigned long long> { 3, 64 * 64 + 5 }) && !soon.scheduled()
+			&& !cascaded.scheduled();
+	}
+
+	bool firePeriodicTimers() {
+		timerWheel wheel;
+		std::vector<unsigned long long> fired;
+		timerWheel::timer periodic([&] { fired.push_back(wheel.now()); });
+		wheel.schedule(periodic, 1, 60);
+		wheel.advance(200);
+		return (fired == std::vector<unsigned long long> { 1, 61, 121, 181 }) && periodic.scheduled()
+			&& (periodic.expiry() == 241);
+	}
+
+	class countingCollector : public stat::collector {
+		stat::aggregation<double> samples_;
+
+		public:
+			unsigned int resets = 0;
+
+			countingCollector(const std::chrono::milliseconds interval, const std::chrono::milliseconds flushPeriod)
+					: collector(interval, flushPeriod) {}
+
+			std::vector<stat::metric> metrics() override { return { { "Samples", &samples_ } }; }
+			void sample() override { samples_ += 1; }
+			void reset() override { ++resets; samples_ = stat::aggregation<double>(); }
+			unsigned int samples() const noexcept { return samples_.count; }
+	};
+
+	bool flushCollectors() {
+		std::vector<std::pair<unsigned long long, std::size_t>> flushes;
+		std::vector<unsigned int> samplesAtFlush;
+		countingCollector* fast = new countingCollector(std::chrono::seconds(1), std::chrono::seconds(10));
+		countingCollector* slow = new countingCollector(std::chrono::seconds(5), std::chrono::seconds(20));
+		stat::registry registry(std::chrono::seconds(1), [&](const stat::registry::requestTemplates& templates) {
+			flushes.emplace_back(registry.wheel().now(), templates.size());
+			samplesAtFlush.push_back(fast->samples());
+		});
+		registry.add(std::unique_ptr<stat::collector>(fast), { });
+		registry.add(std::unique_ptr<stat::collector>(slow), { { "Host", "test" } });
+		for(int tick = 0; tick < 40; ++tick) registry.advance(1);
+
+		const std::vector<std::pair<unsigned long long, std::size_t>> expected {
+			{ 10, 1 }, { 20, 2 }, { 30, 1 }, { 40, 2 } };
+		return (flushes == expected) && (samplesAtFlush == std::vector<unsigned int> { 10, 10, 10, 10 })
+			&& (fast->resets == 4) && (slow->resets == 2) && (fast->samples() == 0);
+	}
+
+	bool catchUpCollectors() {
+		std::vector<unsigned int> samplesAtFlush;
+		countingCollector* collector = new countingCollector(std::chrono::seconds(1), std::chrono::seconds(10));
+		stat::registry registry(std::chrono::seconds(1), [&](const stat::registry::requestTemplates&) {
+			samplesAtFlush.push_back(collector->samples());
+		});
+		registry.add(std::unique_ptr<stat::collector>(collector), { });
+		// Ticks missed together are sampled once, covering the whole late interval, before anything is flushed
+		registry.advance(3);
+		registry.advance(4);
+		registry.advance(6);
+		return (samplesAtFlush == std::vector<unsigned int> { 3 }) && (collector->samples() == 1)
+			&& (registry.wheel().now() == 13);
+	}
+
+	/* Publishes one more metric each time it is sampled, as a collector of devices might as they appear. */
+	class growingCollector : public stat::collector {
+		std::vector<stat::aggregation<double>> metrics_;
+		bool changed_ = false;
+
+		public:
+			growingCollector() : collector(std::chrono::seconds(1), std::chrono::seconds(2)) { metrics_.reserve(16); }
+
+			std::vector<stat::metric> metrics() override {
+				changed_ = false;
+				std::vector<stat::metric> metrics;
+				for(std::size_t i = 0; i < metrics_.size(); ++i) {
+					metrics.emplace_back("M" + std::to_string(i), &metrics_[i]);
+				}
+				return metrics;
+			}
+			bool metricsChanged() const override { return changed_; }
+			void sample() override {
+				metrics_.emplace_back();
+				for(stat::aggregation<double>& metric: metrics_) metric += 1;
+				changed_ = true;
+			}
+			void reset() override {
+				for(stat::aggregation<double>& metric: metrics_) metric = stat::aggregation<double>();
+			}
+	};
+
+	bool recompileChangedMetrics() {
+		std::vector<std::string> payloads;
+		stat::registry registry(std::chrono::seconds(1), [&](const stat::registry::requestTemplates& templates) {
+			util::buffer payload;
+			unsigned int index = 0;
+			for(const aws::cloudwatch::requestTemplate* requestTemplate: templates) {
+				requestTemplate->write(payload, index, "T");
+			}
+			payloads.emplace_back(reinterpret_cast<const char*>(payload.data()), payload.size());
+		});
+		registry.add(std::unique_ptr<stat::collector>(new growingCollector()), { });
+		for(int tick = 0; tick < 4; ++tick) registry.advance(1);
+		return (payloads.size() == 2) && (payloads[0].find("MetricName=M1") != std::string::npos)
+			&& (payloads[0].find("MetricName=M2") == std::string::npos)
+			&& (payloads[1].find("MetricName=M3") != std::string::npos);
+	}
+}
+
+int main(int argc, char** argv) {
+	return test::suite {
+		{ "timer firing", fireTimers },
+		{ "periodic timer firing", firePeriodicTimers },
+		{ "collector flushing", flushCollectors },
+		{ "collector catch-up", catchUpCollectors },
+		{ "recompiling changed metrics", recompileChangedMetrics },
+	}.run();
+}
@@ -0,0 +1,76 @@
+// Copyright (C) 2015 Philip Cronje. All rights reserved.
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "test-framework.h"
+
+#include "ring.h"
+
+namespace {
+	bool fillAndEmpty() {
+		util::ring<int, 4> ring;
+		const bool empty = ring.front() == nullptr;
+		for(int i = 0; i < 4; ++i) {
+			*ring.claim() = i;
+			ring.publish();
+		}
+		const bool full = ring.claim() == nullptr;
+		std::vector<int> popped;
+		for(int* slot = ring.front(); slot != nullptr; slot = ring.front()) {
+			popped.push_back(*slot);
+			ring.pop();
+		}
+		return empty && full && (popped == std::vector<int> { 0, 1, 2, 3 }) && (ring.claim() != nullptr);
+	}
+
+	bool reuseSlots() {
+		// A slot comes round again holding what was last published from it, with its storage
+		util::ring<std::string, 2> ring;
+		for(int lap = 0; lap < 3; ++lap) {
+			for(int i = 0; i < 2; ++i) {
+				std::string* slot = ring.claim();
+				if((lap != 0) && (slot->capacity() < 100)) return false;
+				slot->assign(100, 'a' + lap);
+				ring.publish();
+			}
+			for(int i = 0; i < 2; ++i) {
+				if(*ring.front() != std::string(100, 'a' + lap)) return false;
+				ring.pop();
+			}
+		}
+		return true;
+	}
+
+	bool acrossThreads() {
+		constexpr std::uint64_t count = 1000000;
+		util::ring<std::uint64_t, 64> ring;
+		std::thread producer([&ring] {
+			for(std::uint64_t i = 0; i < count; ++i) {
+				std::uint64_t* slot;
+				while((slot = ring.claim()) == nullptr) std::this_thread::yield();
+				*slot = i;
+				ring.publish();
+			}
+		});
+
+		bool ordered = true;
+		for(std::uint64_t expected = 0; expected < count; ++expected) {
+			std::uint64_t* slot;
+			while((slot = ring.front()) == nullptr) std::this_thread::yield();
+			if(*slot != expected) ordered = false;
+			ring.pop();
+		}
+		producer.join();
+		return ordered && (ring.front() == nullptr);
+	}
+}
+
+int main(int argc, char** argv) {
+	return test::suite {
+		{ "filling and emptying", fillAndEmpty },
+		{ "reusing slots", reuseSlots },
+		{ "passing values between threads", acrossThreads },
+	}.run();
+}
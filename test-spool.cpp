@@ -0,0 +1,134 @@
+// Copyright (C) 2015 Philip Cronje. All rights reserved.
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "test-framework.h"
+#include "test-temporary.h"
+
+#include "spool.h"
+
+namespace {
+	/* A spool in a new temporary file, which is removed afterwards. */
+	struct fixture : test::temporaryFile {
+		std::unique_ptr<util::spool> spool;
+
+		explicit fixture(const std::size_t capacity = 65536) : temporaryFile("test-spool") { reopen(capacity); }
+
+		void reopen(const std::size_t capacity = 65536) {
+			spool.reset();
+			spool.reset(new util::spool(path, capacity));
+		}
+
+		void append(const std::string& text) { spool->append(text.data(), text.size()); }
+
+		/* Reads every record that has not been read yet. */
+		std::vector<std::string> read() {
+			std::vector<std::string> texts;
+			util::spool::record record;
+			while(spool->next(record)) texts.emplace_back(reinterpret_cast<const char*>(record.data), record.size);
+			return texts;
+		}
+
+		util::spool::record next() {
+			util::spool::record record {};
+			spool->next(record);
+			return record;
+		}
+	};
+
+	bool commitRecords() {
+		fixture fixture;
+		fixture.append("one");
+		fixture.append("two");
+		fixture.append("three");
+		const util::spool::record one = fixture.next();
+		const util::spool::record two = fixture.next();
+		// Out of order, so ignored
+		fixture.spool->commit(two);
+		const std::size_t uncommitted = fixture.spool->records();
+		fixture.spool->commit(one);
+		fixture.spool->commit(two);
+		const std::vector<std::string> rest = fixture.read();
+		fixture.spool->rewind();
+		const std::vector<std::string> again = fixture.read();
+		return (uncommitted == 3) && (rest == std::vector<std::string> { "three" }) && (again == rest)
+			&& (fixture.spool->records() == 1);
+	}
+
+	bool resumeAfterReopening() {
+		fixture fixture;
+		fixture.append("one");
+		fixture.append("two");
+		fixture.append(std::string(1000, 'x'));
+		fixture.spool->commit(fixture.next());
+		fixture.next();
+		fixture.reopen();
+		const std::size_t records = fixture.spool->records();
+		return (records == 2) && (fixture.read() == std::vector<std::string> { "two", std::string(1000, 'x') });
+	}
+
+	bool dropOldest() {
+		fixture fixture(4096);
+		// Three records fill most of a lap, so the ring is padded out at the end of each
+		for(int i = 0; i < 10; ++i) fixture.append(std::string(1200, '0' + i));
+		const std::size_t records = fixture.spool->records();
+		std::vector<std::string> expected;
+		for(std::size_t i = 10 - records; i < 10; ++i) expected.emplace_back(1200, '0' + i);
+		const bool kept = (records >= 2) && (fixture.spool->dropped() == 10 - records) && (fixture.read() == expected);
+		fixture.reopen(4096);
+		bool tooLarge = false;
+		try {
+			fixture.append(std::string(3000, 'x'));
+		} catch(const std::length_error&) {
+			tooLarge = true;
+		}
+		return kept && (fixture.spool->capacity() == 4096) && (fixture.read() == expected) && tooLarge;
+	}
+
+	bool stopAtTornRecord() {
+		fixture fixture;
+		fixture.append("one");
+		fixture.append("two");
+		fixture.append("three");
+		fixture.spool.reset();
+		// Corrupt the last byte of the second record, as if the process had died while writing it
+		const int fd = open(fixture.path.c_str(), O_WRONLY);
+		pwrite(fd, "X", 1, util::spool::headerSize + 24 + 16 + 2);
+		close(fd);
+		fixture.reopen();
+		return (fixture.spool->records() == 1) && (fixture.read() == std::vector<std::string> { "one" });
+	}
+
+	bool rejectOtherVersions() {
+		fixture fixture;
+		fixture.append("one");
+		fixture.spool.reset();
+		// Records written by an older version may not be laid out as they are now
+		const std::uint32_t version = 1;
+		const int fd = open(fixture.path.c_str(), O_WRONLY);
+		pwrite(fd, &version, sizeof(version), 8);
+		close(fd);
+		try {
+			fixture.reopen();
+		} catch(const std::runtime_error&) {
+			return true;
+		}
+		return false;
+	}
+}
+
+int main(int argc, char** argv) {
+	return test::suite {
+		{ "ordered commits and rewinding", commitRecords },
+		{ "resuming after reopening", resumeAfterReopening },
+		{ "dropping the oldest records when full", dropOldest },
+		{ "stopping at a torn record", stopAtTornRecord },
+		{ "rejecting other versions", rejectOtherVersions },
+	}.run();
+}
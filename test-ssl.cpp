@@ -0,0 +1,136 @@
+// Copyright (C) 2015 Philip Cronje. All rights reserved.
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/socket.h>
+
+#include "test-framework.h"
+#include "test-tls.h"
+
+#include "epoll.h"
+#include "net.h"
+#include "ssl.h"
+
+namespace {
+	class server : public test::tlsServer {
+		public:
+			/* Accepts a connection on fd and reads until the client closes it, returning what was read. */
+			std::string receive(const int fd, const std::chrono::milliseconds stall) const {
+				SSL* ssl = SSL_new(*this);
+				SSL_set_fd(ssl, fd);
+				std::string received;
+				if(SSL_accept(ssl) == 1) {
+					// Let the client fill the socket buffer before reading anything
+					std::this_thread::sleep_for(stall);
+					char buffer[16384];
+					int n;
+					while((n = SSL_read(ssl, buffer, sizeof(buffer))) > 0) received.append(buffer, n);
+				}
+				SSL_free(ssl);
+				close(fd);
+				return received;
+			}
+	};
+
+	struct exchange {
+		std::string received;
+		unsigned int blocked = 0;
+		bool resumed = false;
+	};
+
+	/* Sends the request to the server over a socketpair, driving the client side from epoll as the agent does. If
+	 * given, more is appended to the request the first time the engine is left holding part of it. */
+	exchange send(const server& server, const ssl::context& context, util::buffer& request, const int sendBuffer,
+			const std::chrono::milliseconds stall, const std::string& more = "") {
+		exchange exchange;
+		int fds[2];
+		if(socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, fds) == -1) return exchange;
+		fcntl(fds[1], F_SETFL, 0);
+		setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &sendBuffer, sizeof(sendBuffer));
+		std::thread serverThread([&] { exchange.received = server.receive(fds[1], stall); });
+
+		epoll epoll;
+		net::socket socket;
+		std::unique_ptr<ssl::connection> connection;
+		bool flushed = false;
+		bool appended = more.empty();
+		epoll::callback handler([&](const std::uint32_t events) {
+			if((events & EPOLLOUT) != 0) socket.writable(true);
+			if((events & EPOLLIN) != 0) socket.readable(true);
+			if(socket.readable()) connection->readFromSocket();
+			if(connection->inConnectInit() && !connection->connect()) return;
+			exchange.resumed = connection->resumed();
+			if(request) connection->write(request);
+			// As the agent queues requests while a write is stalled, which may move the buffer the engine retries from
+			if(request && !appended) {
+				request.append(more);
+				appended = true;
+			}
+			flushed = connection->writeToSocket();
+			if(!socket.writable()) ++exchange.blocked;
+			connection->read([](const char*, std::size_t) {});
+		});
+		socket.attach(fds[0], epoll, handler);
+		connection.reset(new ssl::connection(context, socket));
+
+		// Wait for the session as well, as TLS 1.3 delivers it after the handshake
+		while((request || !flushed || (context.session() == nullptr)) && (epoll.dispatch(std::chrono::seconds(5)) != 0));
+		connection->shutdown();
+		shutdown(fds[0], SHUT_WR);
+		serverThread.join();
+		return exchange;
+	}
+
+	util::buffer pattern(const std::size_t size, std::string& copy) {
+		std::unique_ptr<uint8_t[]> data(new uint8_t[size]);
+		for(std::size_t i = 0; i < size; ++i) data[i] = static_cast<uint8_t>(i * 7 + (i >> 12));
+		copy.assign(reinterpret_cast<const char*>(data.get()), size);
+		return util::buffer(std::move(data), size);
+	}
+
+	bool writeLargeRequest() {
+		const server server;
+		const ssl::context context;
+		std::string expected;
+		util::buffer request = pattern(1 << 20, expected);
+		const exchange exchange = send(server, context, request, 4096, std::chrono::milliseconds(50));
+		std::cout << "# Sent " << exchange.received.size() << " bytes, blocking " << exchange.blocked << " times"
+			<< std::endl;
+		return (exchange.received == expected) && (exchange.blocked != 0);
+	}
+
+	bool appendWhileBlocked() {
+		const server server;
+		const ssl::context context;
+		std::string expected;
+		util::buffer request = pattern(1 << 18, expected);
+		const std::string more(1 << 16, 'x');
+		const exchange exchange = send(server, context, request, 4096, std::chrono::milliseconds(50), more);
+		return (exchange.received == expected + more) && (exchange.blocked != 0);
+	}
+
+	bool resumeSession() {
+		const server server;
+		const ssl::context context;
+		std::string expected;
+		util::buffer first = pattern(100, expected);
+		const exchange full = send(server, context, first, 65536, std::chrono::milliseconds(0));
+		util::buffer second = pattern(100, expected);
+		const exchange resumed = send(server, context, second, 65536, std::chrono::milliseconds(0));
+		std::cout << "# First handshake " << (full.resumed ? "resumed" : "full") << ", second "
+			<< (resumed.resumed ? "resumed" : "full") << std::endl;
+		return !full.resumed && (full.received == expected) && resumed.resumed && (resumed.received == expected);
+	}
+}
+
+int main(int argc, char** argv) {
+	ssl::library library;
+	return test::suite {
+		{ "large request over a small socket buffer", writeLargeRequest },
+		{ "appending to a request while blocked", appendWhileBlocked },
+		{ "session resumption", resumeSession },
+	}.run();
+}
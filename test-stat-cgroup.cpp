@@ -0,0 +1,173 @@
+// Copyright (C) 2015 Philip Cronje. All rights reserved.
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "test-framework.h"
+#include "test-temporary.h"
+
+#include "stat-cgroup.h"
+
+namespace {
+	/* A directory laid out like a cgroup v2 hierarchy, which is removed afterwards. */
+	struct fakeHierarchy : test::temporaryDirectory {
+		fakeHierarchy() : temporaryDirectory("test-cgroup") {}
+
+		std::filesystem::path directory(const std::string& cgroup) const {
+			return std::filesystem::path(path + cgroup);
+		}
+
+		void write(const std::string& cgroup, const std::string& file, const std::string& text) const {
+			std::ofstream(directory(cgroup) / file) << text;
+		}
+
+		/* Creates a cgroup with its interface files in place, by moving it into the hierarchy once complete, as the
+		 * kernel creates them along with the directory. */
+		void create(const std::string& cgroup, const unsigned long long usageUsec = 0, const bool populated = true) {
+			const std::filesystem::path staging = path + ".staging";
+			std::filesystem::create_directory(staging);
+			std::ofstream(staging / "cpu.stat") << "usage_usec " << usageUsec << "\nuser_usec 0\nsystem_usec 0\n";
+			std::ofstream(staging / "memory.current") << "1048576\n";
+			std::ofstream(staging / "memory.events") << "low 0\nhigh 0\nmax 0\noom 0\noom_kill 0\n";
+			std::ofstream(staging / "io.stat") << "8:0 rbytes=0 wbytes=0 rios=0 wios=0 dbytes=0 dios=0\n";
+			std::ofstream(staging / "cgroup.events") << "populated " << populated << "\nfrozen 0\n";
+			std::filesystem::rename(staging, directory(cgroup));
+		}
+
+		void removeCgroup(const std::string& cgroup) const { std::filesystem::remove_all(directory(cgroup)); }
+	};
+
+	std::vector<std::string> paths(const std::vector<stat::metric>& metrics, const std::string& name) {
+		std::vector<std::string> paths;
+		for(const stat::metric& metric: metrics) {
+			if((metric.name == name) && (metric.dimensions.size() == 1) && (metric.dimensions[0].first == "CGroup")) {
+				paths.push_back(metric.dimensions[0].second);
+			}
+		}
+		return paths;
+	}
+
+	const stat::metric* find(const std::vector<stat::metric>& metrics, const std::string& name,
+			const std::string& path) {
+		for(const stat::metric& metric: metrics) {
+			if((metric.name == name) && (metric.dimensions[0].second == path)) return &metric;
+		}
+		return nullptr;
+	}
+
+	bool parseInterfaceFiles() {
+		const std::string cpuStat = "usage_usec 1500\nuser_usec 1000\nsystem_usec 500\nnr_periods 0\n";
+		const std::string ioStat = "8:0 rbytes=4096 wbytes=8192 rios=1 wios=2 dbytes=0 dios=0\n"
+			"259:0 rbytes=100 wbytes=0 rios=1 wios=0 dbytes=0 dios=0\n";
+		const std::pair<unsigned long long, unsigned long long> bytes =
+			stat::cgroupIoBytes(procfs::scanner(ioStat.c_str()));
+		return (stat::cgroupValue(procfs::scanner(cpuStat.c_str()), "usage_usec") == 1500)
+			&& (stat::cgroupValue(procfs::scanner(cpuStat.c_str()), "system_usec") == 500)
+			&& (stat::cgroupValue(procfs::scanner(cpuStat.c_str()), "missing") == 0)
+			&& (bytes.first == 4196) && (bytes.second == 8192);
+	}
+
+	bool walkHierarchy() {
+		fakeHierarchy hierarchy;
+		hierarchy.create("/system.slice");
+		hierarchy.create("/system.slice/sshd.service");
+		hierarchy.create("/system.slice-other");
+		stat::cgroupCollector collector(hierarchy.path);
+		const std::vector<std::string> memory = paths(collector.metrics(), "CGroupMemory");
+		return (collector.tracked() == 4) && !collector.metricsChanged()
+			&& (memory == std::vector<std::string> { "/system.slice", "/system.slice-other",
+				"/system.slice/sshd.service" });
+	}
+
+	bool followEvents() {
+		fakeHierarchy hierarchy;
+		hierarchy.create("/kubepods");
+		hierarchy.create("/kubepods/pod1");
+		stat::cgroupCollector collector(hierarchy.path);
+		collector.metrics();
+
+		hierarchy.create("/kubepods/pod2");
+		hierarchy.create("/kubepods-other");
+		collector.sample();
+		const bool created = (collector.tracked() == 5) && collector.metricsChanged()
+			&& (paths(collector.metrics(), "CGroupCPU").size() == 4);
+
+		// Removing a cgroup takes its descendants with it, but not a sibling sharing the start of its name
+		hierarchy.removeCgroup("/kubepods");
+		collector.sample();
+		const std::vector<stat::metric> metrics = collector.metrics();
+		return created && (collector.tracked() == 2)
+			&& (paths(metrics, "CGroupCPU") == std::vector<std::string> { "/kubepods-other" });
+	}
+
+	bool readChanges() {
+		fakeHierarchy hierarchy;
+		hierarchy.create("/busy", 0);
+		hierarchy.create("/idle", 0, false);
+		stat::cgroupCollector collector(hierarchy.path);
+
+		hierarchy.write("/busy", "cpu.stat", "usage_usec 500000\n");
+		hierarchy.write("/busy", "io.stat", "8:0 rbytes=1000000 wbytes=0 rios=1 wios=0 dbytes=0 dios=0\n");
+		hierarchy.write("/busy", "memory.events", "low 0\nhigh 0\nmax 2\noom 1\noom_kill 1\n");
+		hierarchy.write("/idle", "memory.events", "low 0\nhigh 0\nmax 1\noom 1\noom_kill 2\n");
+		collector.sample();
+		collector.sample();
+		const std::vector<stat::metric> metrics = collector.metrics();
+		const stat::metric* cpu = find(metrics, "CGroupCPU", "/busy");
+		const stat::metric* reads = find(metrics, "CGroupIORead", "/busy");
+		const stat::metric* idle = find(metrics, "CGroupCPU", "/idle");
+		const stat::metric* busyKills = find(metrics, "CGroupOOMKills", "/busy");
+		const stat::metric* idleKills = find(metrics, "CGroupOOMKills", "/idle");
+		if((cpu == nullptr) || (reads == nullptr) || (idle == nullptr) || (busyKills == nullptr)
+				|| (idleKills == nullptr)) {
+			return false;
+		}
+		std::cout << "# /busy: " << cpu->statistics->max << "% CPU, " << reads->statistics->max << " B/s read"
+			<< std::endl;
+		// An empty cgroup is not read, though the kills that emptied it are counted
+		return (cpu->statistics->count == 2) && (cpu->statistics->max > 0) && (reads->statistics->max > 0)
+			&& (idle->statistics->count == 0) && (busyKills->statistics->sum == 1) && (idleKills->statistics->sum == 2)
+			&& (find(metrics, "CGroupMemory", "/busy")->statistics->max == 1048576);
+	}
+
+	bool scaleToManyCgroups() {
+		fakeHierarchy hierarchy;
+		for(int i = 0; i < 300; ++i) hierarchy.create("/container" + std::to_string(i), 0, i < 30);
+		stat::cgroupCollector collector(hierarchy.path);
+		const auto start = std::chrono::steady_clock::now();
+		for(int i = 0; i < 100; ++i) collector.sample();
+		const std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+		std::cout << "# " << elapsed.count() / 100 << " us per sample of 300 cgroups, 30 populated" << std::endl;
+		return (collector.tracked() == 301) && (paths(collector.metrics(), "CGroupCPU").size() == 300);
+	}
+
+	bool collectSysFsCgroup() {
+		const char* root = (access("/sys/fs/cgroup/cgroup.controllers", F_OK) == 0) ? "/sys/fs/cgroup"
+			: "/sys/fs/cgroup/unified";
+		if(access((std::string(root) + "/cgroup.controllers").c_str(), F_OK) != 0) {
+			std::cout << "# No cgroup v2 hierarchy mounted" << std::endl;
+			return true;
+		}
+		stat::cgroupCollector collector(root);
+		collector.sample();
+		std::cout << "# " << collector.tracked() << " cgroups under " << root << ", "
+			<< collector.metrics().size() << " metrics" << std::endl;
+		return collector.tracked() > 0;
+	}
+}
+
+int main(int argc, char** argv) {
+	return test::suite {
+		{ "interface file parsing", parseInterfaceFiles },
+		{ "hierarchy walk", walkHierarchy },
+		{ "cgroups created and removed", followEvents },
+		{ "populated cgroups and memory events", readChanges },
+		{ "hundreds of containers", scaleToManyCgroups },
+		{ "/sys/fs/cgroup collection", collectSysFsCgroup },
+	}.run();
+}
@@ -35,6 +35,52 @@ namespace {
 		diagnose(cpu, "Semi-junk CPU metrics");
 		return (cpu.total == 100 + 10 + 50 + 1000 + 200);
 	}
+
+	bool scanProcStat() {
+		const procfs::file file("/proc/stat");
+		const stat::cpu cpu = stat::cpu(file.scan());
+		diagnose(cpu, "CPU stats from live /proc/stat via procfs::file");
+		return cpu.total > 0;
+	}
+
+	bool scanReordered() {
+		const procfs::file file("test-stat-cpu.reordered");
+		const stat::cpu cpu = stat::cpu(file.scan());
+		diagnose(cpu, "Re-ordered CPU stats from test-stat-cpu.reordered via procfs::file");
+		return (cpu.total == (705754 + 914 + 64367 + 16413999 + 40284 + 5 + 9943))
+			&& (cpu.user == (705754 + 914))
+			&& (cpu.system == 64367)
+			&& (cpu.ioWait == 40284);
+	}
+
+	bool scanSemiJunk() {
+		const stat::cpu cpu = stat::cpu(procfs::scanner("cpu  100 10 50 1000 200 junk this is all junk 999"));
+		diagnose(cpu, "Semi-junk CPU metrics via procfs::scanner");
+		return (cpu.total == 100 + 10 + 50 + 1000 + 200);
+	}
+
+	bool scanCores() {
+		stat::cores cores(procfs::scanner("cpu  300 0 150 3000 30\n"
+					"cpu0 100 0 50 1000 10\n"
+					"cpu1 100 0 50 1000 10\n"
+					"cpu2 100 0 50 1000 10\n"
+					"intr 12345\n"));
+		cores.update(procfs::scanner("cpu  500 0 250 3600 60\n"
+					"cpu0 100 0 50 1100 10\n"
+					"cpu1 150 0 100 1100 10\n"
+					"cpu2 110 0 60 1180 10\n"
+					"intr 12345\n"));
+		std::cout << "# Per-core busy: " << cores.busy(0) << ", " << cores.busy(1) << ", " << cores.busy(2) << std::endl;
+
+		stat::aggregation<double> hottest[2];
+		cores.aggregateHottest(hottest, 2);
+		return (cores.count() == 3)
+			&& (cores.busy(0) == 0.0)
+			&& (cores.busy(1) == 50.0)
+			&& (cores.busy(2) == 10.0)
+			&& (hottest[0].sum == 50.0)
+			&& (hottest[1].sum == 10.0);
+	}
 }
 
 int main(int argc, char** argv) {
@@ -42,5 +88,9 @@ int main(int argc, char** argv) {
 		{ "/proc/stat parsing", parseProcStat },
 		{ "re-ordered parsing", parseReordered },
 		{ "semi-junk parsing", parseSemiJunk },
+		{ "/proc/stat scanning", scanProcStat },
+		{ "re-ordered scanning", scanReordered },
+		{ "semi-junk scanning", scanSemiJunk },
+		{ "per-core scanning", scanCores },
 	}.run();
 }
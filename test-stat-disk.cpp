@@ -0,0 +1,123 @@
+// Copyright (C) 2015 Philip Cronje. All rights reserved.
+#include <chrono>
+#include <cmath>
+#include <string>
+
+#include "test-framework.h"
+
+#include "stat-disk.h"
+
+namespace {
+	// Partitions are told apart by name here, rather than from /sys/block
+	bool wanted(const std::string& name) {
+		return (name.compare(0, 4, "loop") != 0) && (name != "sda1") && (name != "nvme0n1p1");
+	}
+
+	std::string line(const char* name, const unsigned long long reads, const unsigned long long readSectors,
+			const unsigned long long readTime, const unsigned long long writes, const unsigned long long writeSectors,
+			const unsigned long long writeTime, const unsigned long long weightedTime) {
+		return "   8       0 " + std::string(name) + " " + std::to_string(reads) + " 0 " + std::to_string(readSectors)
+			+ " " + std::to_string(readTime) + " " + std::to_string(writes) + " 0 " + std::to_string(writeSectors)
+			+ " " + std::to_string(writeTime) + " 0 " + std::to_string(weightedTime / 2) + " "
+			+ std::to_string(weightedTime) + " 0 0 0 0 0 0\n";
+	}
+
+	const stat::disks::device* find(const stat::disks& disks, const std::string& name) {
+		for(const stat::disks::device& device: disks.devices()) {
+			if(device.name == name) return &device;
+		}
+		return nullptr;
+	}
+
+	bool close(const double value, const double expected) { return std::fabs(value - expected) < 1e-9; }
+
+	bool computeRates() {
+		const std::string first = line("loop0", 5, 5, 5, 0, 0, 0, 0) + line("sda", 100, 800, 50, 200, 1600, 150, 400)
+			+ line("sda1", 100, 800, 50, 200, 1600, 150, 400);
+		// Over two seconds, 300 reads and 100 writes of 4 KiB each, taking 1200 ms in all
+		const std::string second = line("loop0", 5, 5, 5, 0, 0, 0, 0) + line("sda", 400, 3200, 950, 300, 2400, 450, 3400)
+			+ line("sda1", 400, 3200, 950, 300, 2400, 450, 3400);
+		stat::disks disks(procfs::scanner(first.c_str()), wanted);
+		const bool rebuilt = disks.update(procfs::scanner(second.c_str()), std::chrono::seconds(2));
+		const stat::disks::device* sda = find(disks, "sda");
+		if((sda == nullptr) || !sda->measured) return false;
+		std::cout << "# sda: " << sda->iops << " IOPS, " << sda->throughput << " B/s, queue depth " << sda->queueDepth
+			<< ", latency " << sda->latency << " ms" << std::endl;
+		return !rebuilt && (disks.devices().size() == 1) && close(sda->iops, 200) && close(sda->throughput, 819200)
+			&& close(sda->queueDepth, 1.5) && close(sda->latency, 3);
+	}
+
+	bool handleWrapAndReset() {
+		// The time fields wrap at 2^32 milliseconds, while counts going backwards mean the device was re-registered
+		const std::string first = line("sda", 1000, 8000, 0xFFFFFF00ULL, 0, 0, 0, 0xFFFFFF00ULL);
+		const std::string second = line("sda", 10, 80, 0x100ULL, 0, 0, 0, 0x100ULL);
+		stat::disks disks(procfs::scanner(first.c_str()), wanted);
+		disks.update(procfs::scanner(second.c_str()), std::chrono::seconds(1));
+		const stat::disks::device* sda = find(disks, "sda");
+		return (sda != nullptr) && sda->measured && (sda->operations == 0) && (sda->throughput == 0)
+			&& close(sda->queueDepth, 0.512) && (sda->latency == 0);
+	}
+
+	bool keepSlots() {
+		const std::string before = line("sda", 10, 80, 10, 0, 0, 0, 10) + line("sdb", 10, 80, 10, 0, 0, 0, 10);
+		const std::string same = line("sda", 20, 160, 20, 0, 0, 0, 20) + line("sdb", 30, 240, 30, 0, 0, 0, 30);
+		const std::string added = line("sda", 30, 240, 30, 0, 0, 0, 30) + line("nvme0n1", 1, 8, 1, 0, 0, 0, 1)
+			+ line("sdb", 50, 400, 50, 0, 0, 0, 50);
+		const std::string removed = line("nvme0n1", 2, 16, 2, 0, 0, 0, 2) + line("sdb", 60, 480, 60, 0, 0, 0, 60);
+
+		stat::disks disks(procfs::scanner(before.c_str()), wanted);
+		const stat::disks::device* const slot = &disks.devices()[0];
+		const bool stable = !disks.update(procfs::scanner(same.c_str()), std::chrono::seconds(1))
+			&& (&disks.devices()[0] == slot) && (disks.devices()[1].operations == 20);
+
+		// Devices that remain carry their counters over, and a new device has no rates until its second sample
+		const bool grown = disks.update(procfs::scanner(added.c_str()), std::chrono::seconds(1))
+			&& (disks.devices().size() == 3) && (find(disks, "sdb")->operations == 20)
+			&& find(disks, "sda")->measured && !find(disks, "nvme0n1")->measured;
+		const bool shrunk = disks.update(procfs::scanner(removed.c_str()), std::chrono::seconds(1))
+			&& (disks.devices().size() == 2) && (find(disks, "sda") == nullptr)
+			&& (find(disks, "nvme0n1")->operations == 1) && (find(disks, "sdb")->operations == 10);
+		return stable && grown && shrunk;
+	}
+
+	bool scaleToManyNamespaces() {
+		std::string first, second;
+		for(int i = 0; i < 512; ++i) {
+			const std::string name = "nvme" + std::to_string(i / 64) + "n" + std::to_string(i % 64 + 1);
+			first += line(name.c_str(), i, 8 * i, i, 0, 0, 0, i);
+			second += line(name.c_str(), 2 * i, 16 * i, 2 * i, 0, 0, 0, 2 * i);
+		}
+		stat::disks disks(procfs::scanner(first.c_str()), wanted);
+		const auto start = std::chrono::steady_clock::now();
+		bool rebuilt = false;
+		for(int i = 0; i < 1000; ++i) {
+			const std::string& sample = (i % 2 == 0) ? second : first;
+			rebuilt = disks.update(procfs::scanner(sample.c_str()), std::chrono::seconds(1)) || rebuilt;
+		}
+		const std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+		std::cout << "# " << elapsed.count() / 1000 << " us per sample of 512 namespaces" << std::endl;
+		return !rebuilt && (disks.devices().size() == 512) && (disks.devices()[511].name == "nvme7n64");
+	}
+
+	bool collectProcDiskstats() {
+		stat::diskCollector collector;
+		collector.sample();
+		collector.sample();
+		const std::vector<stat::metric> metrics = collector.metrics();
+		for(const stat::metric& metric: metrics) {
+			std::cout << "# " << metric.name << ": " << metric.statistics->max << " " << metric.unit << std::endl;
+			if(metric.name.compare(0, 4, "loop") == 0) return false;
+		}
+		return (metrics.size() % 4 == 0) && !collector.metricsChanged();
+	}
+}
+
+int main(int argc, char** argv) {
+	return test::suite {
+		{ "rates from two samples", computeRates },
+		{ "wrapped and reset counters", handleWrapAndReset },
+		{ "slots kept until devices change", keepSlots },
+		{ "hundreds of NVMe namespaces", scaleToManyNamespaces },
+		{ "/proc/diskstats collection", collectProcDiskstats },
+	}.run();
+}
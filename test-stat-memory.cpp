@@ -0,0 +1,94 @@
+// Copyright (C) 2015 Philip Cronje. All rights reserved.
+#include <string>
+
+#include "test-framework.h"
+
+#include "stat-memory.h"
+
+namespace {
+	const std::string sample =
+		"MemTotal:       16318684 kB\n"
+		"MemFree:          754100 kB\n"
+		"MemAvailable:    9771620 kB\n"
+		"Buffers:          612468 kB\n"
+		"Cached:          8321636 kB\n"
+		"SwapCached:         2048 kB\n"
+		"SwapTotal:       2097148 kB\n"
+		"SwapFree:        2095100 kB\n"
+		"Dirty:               436 kB\n"
+		"HugePages_Total:       8\n"
+		"HugePages_Free:        6\n"
+		"HugePages_Rsvd:        1\n"
+		"HugePages_Surp:        0\n"
+		"Hugepagesize:       2048 kB\n";
+
+	bool parseFields() {
+		const stat::meminfo meminfo(sample.data(), sample.size());
+		return (meminfo.value(stat::meminfo::MemAvailable) == 9771620)
+			&& (meminfo.value(stat::meminfo::Cached) == 8321636)
+			&& (meminfo.value(stat::meminfo::Dirty) == 436)
+			&& (meminfo.value(stat::meminfo::SwapTotal) == 2097148)
+			&& (meminfo.value(stat::meminfo::SwapFree) == 2095100)
+			&& (meminfo.value(stat::meminfo::SwapCached) == 2048)
+			&& (meminfo.value(stat::meminfo::HugePagesTotal) == 8)
+			&& (meminfo.value(stat::meminfo::HugePagesFree) == 6)
+			&& (meminfo.value(stat::meminfo::HugePagesReserved) == 1)
+			&& meminfo.present(stat::meminfo::HugePagesSurplus) && (meminfo.reindexed() == 0);
+	}
+
+	bool reuseOffsets() {
+		stat::meminfo meminfo(sample.data(), sample.size());
+		// Values change width without moving any key, as the padding absorbs them
+		std::string changed = sample;
+		changed.replace(changed.find(" 9771620"), 8, "10000000");
+		changed.replace(changed.find("   436"), 6, "123456");
+		meminfo.update(changed.data(), changed.size());
+		return (meminfo.value(stat::meminfo::MemAvailable) == 10000000)
+			&& (meminfo.value(stat::meminfo::Dirty) == 123456) && (meminfo.reindexed() == 0);
+	}
+
+	bool reindexMovedKeys() {
+		stat::meminfo meminfo(sample.data(), sample.size());
+		const std::string moved = "Active:         4000000 kB\n" + sample;
+		meminfo.update(moved.data(), moved.size());
+		const bool found = (meminfo.reindexed() == 1) && (meminfo.value(stat::meminfo::Cached) == 8321636)
+			&& (meminfo.value(stat::meminfo::HugePagesFree) == 6);
+		meminfo.update(moved.data(), moved.size());
+		return found && (meminfo.reindexed() == 1);
+	}
+
+	bool skipMissingKeys() {
+		// As on a kernel without MemAvailable, and with no swap or huge pages configured
+		const std::string older = "MemTotal:        1000 kB\nCached:            200 kB\nDirty:              10 kB\n";
+		stat::meminfo meminfo(older.data(), older.size());
+		meminfo.update(older.data(), older.size());
+		return !meminfo.present(stat::meminfo::MemAvailable) && !meminfo.present(stat::meminfo::SwapTotal)
+			&& meminfo.present(stat::meminfo::Cached) && (meminfo.value(stat::meminfo::Dirty) == 10)
+			&& (meminfo.reindexed() == 0);
+	}
+
+	bool collectProcMeminfo() {
+		stat::memoryCollector collector;
+		const std::vector<stat::metric> metrics = collector.metrics();
+		collector.sample();
+		collector.sample();
+		bool sampled = !metrics.empty();
+		for(const stat::metric& metric: metrics) {
+			std::cout << "# " << metric.name << ": " << metric.statistics->max << " " << metric.unit << std::endl;
+			sampled = sampled && (metric.statistics->count == 2)
+				&& ((metric.unit == "Bytes") || (metric.unit == "Count"));
+		}
+		collector.reset();
+		return sampled && (metrics.front().statistics->count == 0);
+	}
+}
+
+int main(int argc, char** argv) {
+	return test::suite {
+		{ "field parsing", parseFields },
+		{ "reusing key offsets", reuseOffsets },
+		{ "re-indexing moved keys", reindexMovedKeys },
+		{ "missing keys", skipMissingKeys },
+		{ "/proc/meminfo collection", collectProcMeminfo },
+	}.run();
+}
@@ -0,0 +1,129 @@
+// Copyright (C) 2015 Philip Cronje. All rights reserved.
+#include <chrono>
+#include <string>
+
+#include "test-framework.h"
+
+#include "stat-net.h"
+
+namespace {
+	const std::string header =
+		"Inter-|   Receive                                                |  Transmit\n"
+		" face |bytes    packets errs drop fifo frame compressed multicast"
+		"|bytes    packets errs drop fifo colls carrier compressed\n";
+
+	std::string line(const char* name, const unsigned long long rxBytes, const unsigned long long rxDrops,
+			const unsigned long long txBytes, const unsigned long long txErrors) {
+		return std::string(name) + ": " + std::to_string(rxBytes) + " 10 0 " + std::to_string(rxDrops)
+			+ " 0 0 0 0 " + std::to_string(txBytes) + " 20 " + std::to_string(txErrors) + " 0 0 0 0 0\n";
+	}
+
+	const stat::interfaces::interface* find(const stat::interfaces& interfaces, const std::string& name) {
+		for(const stat::interfaces::interface& interface: interfaces.list()) {
+			if(interface.name == name) return &interface;
+		}
+		return nullptr;
+	}
+
+	bool matchPatterns() {
+		const stat::interfacePatterns patterns(stat::interfacePatterns::split("eth*,ens*"),
+				stat::interfacePatterns::split("eth9,"));
+		const stat::interfacePatterns everything({ }, stat::interfacePatterns::split("lo"));
+		return patterns("eth0") && patterns("ens5") && !patterns("eth9") && !patterns("docker0")
+			&& everything("docker0") && !everything("lo");
+	}
+
+	bool computeRates() {
+		const std::string first = header + line("    lo", 100, 0, 100, 0) + line("  eth0", 1000, 5, 2000, 0);
+		const std::string second = header + line("    lo", 900, 0, 900, 0) + line("  eth0", 5000, 9, 2400, 2);
+		unsigned int filtered = 0;
+		stat::interfaces interfaces(procfs::scanner(first.c_str()), [&filtered](const std::string& name) {
+			++filtered;
+			return name != "lo";
+		});
+		const bool unchanged = !interfaces.update(procfs::scanner(second.c_str()), std::chrono::seconds(2))
+			&& !interfaces.update(procfs::scanner(second.c_str()), std::chrono::seconds(2));
+		interfaces.update(procfs::scanner(second.c_str()), std::chrono::seconds(2));
+		// The filter is only consulted when an interface appears
+		const bool once = filtered == 2;
+
+		stat::interfaces rates(procfs::scanner(first.c_str()), [](const std::string& name) { return name != "lo"; });
+		rates.update(procfs::scanner(second.c_str()), std::chrono::seconds(2));
+		const stat::interfaces::interface* eth0 = find(rates, "eth0");
+		return unchanged && once && (rates.list().size() == 1) && (eth0 != nullptr) && eth0->measured
+			&& (eth0->rates[stat::interfaces::RxBytes] == 2000) && (eth0->rates[stat::interfaces::RxDrops] == 2)
+			&& (eth0->rates[stat::interfaces::TxBytes] == 200) && (eth0->rates[stat::interfaces::TxErrors] == 1)
+			&& (eth0->rates[stat::interfaces::RxPackets] == 0);
+	}
+
+	bool handleWrap() {
+		// A 32-bit counter that has wrapped, and 64-bit ones that have been reset, from small values as well as large
+		const bool wrapped = stat::counterDelta(0xFFFFFF00ULL, 0x100ULL, 32) == 0x200;
+		const bool reset = (stat::counterDelta(0x500000000ULL, 0x100ULL, 64) == 0)
+			&& (stat::counterDelta(0x1000ULL, 0x10ULL, 64) == 0);
+
+		// An interface recreated with its counters starting afresh
+		const std::string first = header + line("eth0", 0x1000ULL, 0, 0, 0);
+		const std::string second = header + line("eth0", 0x10ULL, 0, 0, 0);
+		stat::interfaces interfaces(procfs::scanner(first.c_str()), [](const std::string&) { return true; });
+		interfaces.update(procfs::scanner(second.c_str()), std::chrono::seconds(1));
+		return wrapped && reset && (interfaces.list()[0].rates[stat::interfaces::RxBytes] == 0);
+	}
+
+	bool followInterfaces() {
+		const std::string before = header + line("eth0", 0, 0, 0, 0);
+		const std::string after = header + line("eth0", 100, 0, 0, 0) + line("veth1a2b", 50, 0, 0, 0);
+		stat::interfaces interfaces(procfs::scanner(before.c_str()), [](const std::string&) { return true; });
+		const bool rebuilt = interfaces.update(procfs::scanner(after.c_str()), std::chrono::seconds(1));
+		return rebuilt && (interfaces.list().size() == 2) && find(interfaces, "eth0")->measured
+			&& (find(interfaces, "eth0")->rates[stat::interfaces::RxBytes] == 100)
+			&& !find(interfaces, "veth1a2b")->measured;
+	}
+
+	bool parseSnmp() {
+		const std::string snmp =
+			"Ip: Forwarding DefaultTTL InReceives\n"
+			"Ip: 1 64 1000\n"
+			"Tcp: RtoAlgorithm RtoMin RtoMax MaxConn ActiveOpens RetransSegs InErrs\n"
+			"Tcp: 1 200 120000 -1 30 75 2\n"
+			"Udp: InDatagrams NoPorts\n"
+			"Udp: 10 1\n";
+		stat::snmpCounters tcp("Tcp:", { "RetransSegs", "MaxConn", "Missing" });
+		tcp.update(snmp.data(), snmp.size());
+		const bool parsed = tcp.present(0) && (tcp.value(0) == 75) && tcp.present(1) && !tcp.present(2);
+
+		// A kernel reporting a new column moves the others along
+		const std::string moved =
+			"Tcp: RtoAlgorithm RtoMin RtoMax MaxConn ActiveOpens PassiveOpens RetransSegs InErrs\n"
+			"Tcp: 1 200 120000 -1 30 7 80 2\n";
+		tcp.update(moved.data(), moved.size());
+		return parsed && (tcp.value(0) == 80);
+	}
+
+	bool collectProcNet() {
+		stat::interfaceCollector interfaces(stat::interfacePatterns({ }, { "lo" }));
+		stat::tcpCollector tcp;
+		interfaces.sample();
+		tcp.sample();
+		const std::vector<stat::metric> interfaceMetrics = interfaces.metrics();
+		const std::vector<stat::metric> tcpMetrics = tcp.metrics();
+		for(const stat::metric& metric: interfaceMetrics) {
+			if(metric.name.compare(0, 2, "lo") == 0) return false;
+		}
+		for(const stat::metric& metric: tcpMetrics) {
+			std::cout << "# " << metric.name << ": " << metric.statistics->max << " " << metric.unit << std::endl;
+		}
+		return (interfaceMetrics.size() % stat::interfaces::CounterCount == 0) && (tcpMetrics.size() == 3);
+	}
+}
+
+int main(int argc, char** argv) {
+	return test::suite {
+		{ "interface patterns", matchPatterns },
+		{ "interface rates", computeRates },
+		{ "counter wrap and reset", handleWrap },
+		{ "interfaces appearing", followInterfaces },
+		{ "SNMP counters", parseSnmp },
+		{ "/proc/net collection", collectProcNet },
+	}.run();
+}
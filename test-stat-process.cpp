@@ -0,0 +1,146 @@
+// Copyright (C) 2015 Philip Cronje. All rights reserved.
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "test-framework.h"
+#include "test-temporary.h"
+
+#include "stat-process.h"
+
+namespace {
+	std::string statLine(const int pid, const std::string& name, const unsigned long long utime,
+			const unsigned long long stime, const unsigned long long rssPages) {
+		return std::to_string(pid) + " (" + name + ") S 1 " + std::to_string(pid) + " " + std::to_string(pid)
+			+ " 0 -1 4194560 100 0 0 0 " + std::to_string(utime) + " " + std::to_string(stime)
+			+ " 0 0 20 -5 1 0 100 1000000 " + std::to_string(rssPages)
+			+ " 18446744073709551615 1 1 0 0 0 0 0 0 0 0 0 0 17 0 0 0 0 0 0\n";
+	}
+
+	/* A directory laid out like /proc, holding only the stat file of each process, which is removed afterwards. */
+	struct fakeProc : test::temporaryDirectory {
+		fakeProc() : temporaryDirectory("test-process") {}
+
+		/* Rewrites the stat file in place, as an open descriptor to it sees the new contents. */
+		void write(const int pid, const std::string& name, const unsigned long long ticks,
+				const unsigned long long rssPages) {
+			const std::filesystem::path directory = std::filesystem::path(path) / std::to_string(pid);
+			std::filesystem::create_directory(directory);
+			std::ofstream(directory / "stat") << statLine(pid, name, ticks, 0, rssPages);
+		}
+
+		void remove(const int pid) { std::filesystem::remove_all(std::filesystem::path(path) / std::to_string(pid)); }
+	};
+
+	const stat::metric* find(const std::vector<stat::metric>& metrics, const std::string& name,
+			const std::string& process) {
+		for(const stat::metric& metric: metrics) {
+			if((metric.name == name) && (metric.dimensions.size() == 1) && (metric.dimensions[0].second == process)) {
+				return &metric;
+			}
+		}
+		return nullptr;
+	}
+
+	bool parseStatLine() {
+		const std::string line = statLine(42, "tricky) (name", 150, 50, 300);
+		stat::processStat stat;
+		const bool parsed = stat.parse(line.data(), line.size()) && (stat.name == "tricky) (name")
+			&& (stat.ticks == 200) && (stat.rssPages == 300);
+		const std::string truncated = line.substr(0, 60);
+		return parsed && !stat.parse(truncated.data(), truncated.size());
+	}
+
+	bool coverEveryIndex() {
+		stat::workerPool pool(3);
+		std::vector<std::atomic<int>> visits(1001);
+		for(int round = 0; round < 10; ++round) {
+			pool.run(visits.size(), [&visits](const std::size_t begin, const std::size_t end) {
+				for(std::size_t i = begin; i < end; ++i) ++visits[i];
+			});
+		}
+		for(const std::atomic<int>& count: visits) {
+			if(count != 10) return false;
+		}
+		return true;
+	}
+
+	bool followProcesses() {
+		fakeProc proc;
+		proc.write(100, "init", 0, 10);
+		proc.write(200, "sshd", 0, 20);
+		stat::processCollector collector(5, 0, 1, proc.path);
+		const bool listed = (collector.tracked() == 2) && (collector.open() == 2);
+
+		proc.write(300, "new", 0, 30);
+		proc.remove(100);
+		collector.sample();
+		const bool followed = (collector.tracked() == 2) && (collector.open() == 2);
+		const std::vector<stat::metric> metrics = collector.metrics();
+		return listed && followed && (find(metrics, "ProcessRSS", "new") != nullptr)
+			&& (find(metrics, "ProcessRSS", "init") == nullptr);
+	}
+
+	bool chooseTopProcesses() {
+		fakeProc proc;
+		proc.write(1, "idle", 0, 1);
+		proc.write(2, "worker", 0, 100);
+		proc.write(3, "worker", 0, 100);
+		proc.write(4, "compiler", 0, 50);
+		stat::processCollector collector(2, 0, 1, proc.path);
+
+		// Both workers together use more CPU than the compiler, which is the largest single process
+		proc.write(2, "worker", 100, 100);
+		proc.write(3, "worker", 100, 100);
+		proc.write(4, "compiler", 150, 5000);
+		collector.sample();
+		const std::vector<stat::metric> metrics = collector.metrics();
+		if(metrics.size() != 4) return false;
+		const bool ranked = (metrics[0].name == "ProcessCPU") && (metrics[0].dimensions[0].second == "worker")
+			&& (metrics[1].dimensions[0].second == "compiler") && (metrics[2].name == "ProcessRSS")
+			&& (metrics[2].dimensions[0].second == "compiler") && (metrics[3].dimensions[0].second == "worker")
+			&& (metrics[0].dimensions[0].first == "Process") && (metrics[2].unit == "Bytes");
+		const bool summed = metrics[3].statistics->max == 200 * sysconf(_SC_PAGESIZE);
+		return ranked && summed && (find(metrics, "ProcessCPU", "idle") == nullptr);
+	}
+
+	bool readWithWorkers() {
+		fakeProc proc;
+		for(int pid = 1000; pid < 1500; ++pid) proc.write(pid, "p" + std::to_string(pid), 0, pid);
+		stat::processCollector collector(3, 2, 1, proc.path);
+		collector.sample();
+		const std::vector<stat::metric> metrics = collector.metrics();
+		return (collector.tracked() == 500) && (metrics.size() == 6)
+			&& (find(metrics, "ProcessRSS", "p1499") == &metrics[3]);
+	}
+
+	bool collectProc() {
+		stat::processCollector collector(5, 2);
+		const auto start = std::chrono::steady_clock::now();
+		collector.sample();
+		const std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+		std::cout << "# " << elapsed.count() << " us to sample " << collector.tracked() << " processes" << std::endl;
+		const std::vector<stat::metric> metrics = collector.metrics();
+		for(const stat::metric& metric: metrics) {
+			std::cout << "# " << metric.name << " " << metric.dimensions[0].second << ": " << metric.statistics->max
+				<< " " << metric.unit << std::endl;
+		}
+		return (collector.tracked() > 0) && !metrics.empty() && (metrics.size() <= 10);
+	}
+}
+
+int main(int argc, char** argv) {
+	return test::suite {
+		{ "stat line parsing", parseStatLine },
+		{ "worker pool slices", coverEveryIndex },
+		{ "processes appearing and exiting", followProcesses },
+		{ "top processes by name", chooseTopProcesses },
+		{ "reading with workers", readWithWorkers },
+		{ "/proc collection", collectProc },
+	}.run();
+}
@@ -0,0 +1,233 @@
+// Copyright (C) 2015 Philip Cronje. All rights reserved.
+#include <chrono>
+#include <csignal>
+#include <memory>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "test-framework.h"
+#include "test-tls.h"
+
+#include "coroutine.h"
+#include "epoll.h"
+#include "http.h"
+#include "stream.h"
+
+namespace {
+	/* Accepts a TLS connection on the blocking end of a socketpair, reads a request of a known size, answers it
+	 * and waits for the client to close the connection. Returns what was read. */
+	std::string serve(const test::tlsServer& server, const int fd, const std::size_t requestSize,
+			const std::string& response, const std::chrono::milliseconds stall = std::chrono::milliseconds(0)) {
+		SSL* ssl = SSL_new(server);
+		SSL_set_fd(ssl, fd);
+		std::string received;
+		if(SSL_accept(ssl) == 1) {
+			// Let the client fill the socket buffer before reading anything
+			std::this_thread::sleep_for(stall);
+			char buffer[16384];
+			int n = 1;
+			while((received.size() < requestSize) && ((n = SSL_read(ssl, buffer, sizeof(buffer))) > 0)) {
+				received.append(buffer, n);
+			}
+			if(!response.empty()) SSL_write(ssl, response.data(), response.size());
+			while(SSL_read(ssl, buffer, sizeof(buffer)) > 0);
+		}
+		SSL_free(ssl);
+		close(fd);
+		return received;
+	}
+
+	/* One client connection over a socketpair, served on a thread of its own. */
+	struct connection {
+		int fds[2];
+		std::string received;
+		std::thread server;
+
+		connection(const test::tlsServer& tlsServer, const std::size_t requestSize, const std::string& response,
+				const int sendBuffer = 0, const std::chrono::milliseconds stall = std::chrono::milliseconds(0)) {
+			socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, fds);
+			fcntl(fds[1], F_SETFL, 0);
+			if(sendBuffer != 0) setsockopt(fds[0], SOL_SOCKET, SO_SNDBUF, &sendBuffer, sizeof(sendBuffer));
+			server = std::thread([&, requestSize, response, stall] {
+				received = serve(tlsServer, fds[1], requestSize, response, stall);
+			});
+		}
+		~connection() { if(server.joinable()) server.join(); }
+	};
+
+	util::buffer text(const std::string& text) {
+		util::buffer buffer;
+		buffer.append(text);
+		return buffer;
+	}
+
+	/* Sends a request and waits for its response, in straight-line code. */
+	co::task<http::response> roundTrip(ssl::stream& stream, const std::string request) {
+		http::client client;
+		http::response response;
+		co_await stream.handshake();
+		client.enqueue(text(request), [&response](const http::response& response_) { response = response_; });
+		co_await stream.writeAll(client.outbound());
+		const bool answered = co_await stream.readResponse(client);
+		if(!answered) throw std::runtime_error("Connection closed");
+		stream.close();
+		co_return response;
+	}
+
+	/* Starts the tasks that have not started yet, and dispatches events until every one is done. Returns false if
+	 * nothing happens for five seconds. */
+	template<typename T>
+	bool run(epoll& epoll, const std::vector<co::task<T>*>& tasks, const bool started = false) {
+		if(!started) {
+			for(co::task<T>* task: tasks) task->start();
+		}
+		const auto done = [&tasks] {
+			for(const co::task<T>* task: tasks) {
+				if(!task->done()) return false;
+			}
+			return true;
+		};
+		while(!done()) {
+			if(epoll.dispatch(std::chrono::seconds(5)) == 0) return false;
+		}
+		return true;
+	}
+
+	typedef std::vector<co::task<http::response>*> responseTasks;
+
+	const std::string ok = "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nok";
+
+	bool exchangeRequest() {
+		const test::tlsServer server;
+		const ssl::context context;
+		epoll epoll;
+		const std::string request = "POST / HTTP/1.1\r\nContent-Length: 0\r\n\r\n";
+		connection connection(server, request.size(), ok);
+		ssl::stream stream(epoll, context);
+		stream.attach(connection.fds[0]);
+		co::task<http::response> task = roundTrip(stream, request);
+		const bool finished = run(epoll, responseTasks { &task });
+		connection.server.join();
+		const http::response response = task.result();
+		return finished && (response.status == 200) && (response.body == "ok") && (connection.received == request)
+			&& !stream.open();
+	}
+
+	bool writeOverSmallBuffer() {
+		const test::tlsServer server;
+		const ssl::context context;
+		epoll epoll;
+		std::string request(1 << 20, 'x');
+		for(std::size_t i = 0; i < request.size(); ++i) request[i] = static_cast<char>(i * 7 + (i >> 12));
+		connection connection(server, request.size(), ok, 4096, std::chrono::milliseconds(50));
+		ssl::stream stream(epoll, context);
+		stream.attach(connection.fds[0]);
+		co::task<http::response> task = roundTrip(stream, request);
+		task.start();
+		// The write cannot complete until the server starts reading, so the coroutine must have suspended
+		const bool suspended = !task.done();
+		const bool finished = run(epoll, responseTasks { &task }, true);
+		connection.server.join();
+		return suspended && finished && (task.result().status == 200) && (connection.received == request);
+	}
+
+	bool manyConcurrentStreams() {
+		const test::tlsServer server;
+		const ssl::context context;
+		epoll epoll;
+		constexpr unsigned int count = 8;
+		std::vector<std::unique_ptr<connection>> connections;
+		std::vector<std::unique_ptr<ssl::stream>> streams;
+		std::vector<co::task<http::response>> tasks;
+		responseTasks pointers;
+		std::vector<std::string> requests;
+		for(unsigned int i = 0; i < count; ++i) {
+			requests.push_back("GET /" + std::to_string(i) + " HTTP/1.1\r\n\r\n");
+			const std::string body = std::to_string(i);
+			connections.emplace_back(new connection(server, requests.back().size(),
+					"HTTP/1.1 200 OK\r\nContent-Length: " + std::to_string(body.size()) + "\r\n\r\n" + body));
+			streams.emplace_back(new ssl::stream(epoll, context));
+			streams.back()->attach(connections.back()->fds[0]);
+			tasks.push_back(roundTrip(*streams.back(), requests.back()));
+		}
+		for(co::task<http::response>& task: tasks) pointers.push_back(&task);
+		// Every stream makes progress from the same thread, each as its own socket becomes ready
+		const bool finished = run(epoll, pointers);
+		bool answered = true;
+		for(unsigned int i = 0; i < count; ++i) {
+			connections[i]->server.join();
+			answered = answered && (tasks[i].result().body == std::to_string(i))
+				&& (connections[i]->received == requests[i]);
+		}
+		return finished && answered;
+	}
+
+	co::task<void> connectOnly(ssl::stream& stream, const std::vector<net::address> addresses,
+			const std::uint16_t port) {
+		co_await stream.connect(addresses, port);
+	}
+
+	bool failToConnect() {
+		// Bind a port and leave it unlistened, so that connecting to it is refused
+		const int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		net::address address;
+		net::address::parse("127.0.0.1", address);
+		bind(fd, reinterpret_cast<const sockaddr*>(&address.storage), address.length);
+		getsockname(fd, reinterpret_cast<sockaddr*>(&address.storage), &address.length);
+		const std::uint16_t port = ntohs(reinterpret_cast<const sockaddr_in&>(address.storage).sin_port);
+
+		const ssl::context context;
+		epoll epoll;
+		ssl::stream stream(epoll, context);
+		co::task<void> task = connectOnly(stream, { address }, port);
+		const bool finished = run(epoll, std::vector<co::task<void>*> { &task });
+		close(fd);
+		try {
+			task.result();
+		} catch(const std::system_error& e) {
+			return finished && (e.code().value() == ECONNREFUSED);
+		}
+		return false;
+	}
+
+	bool closedBeforeResponse() {
+		const test::tlsServer server;
+		const ssl::context context;
+		epoll epoll;
+		const std::string request = "GET / HTTP/1.1\r\n\r\n";
+		// The server closes the connection without answering, once the client has
+		connection connection(server, request.size(), "");
+		ssl::stream stream(epoll, context);
+		stream.attach(connection.fds[0]);
+		co::task<http::response> task = roundTrip(stream, request);
+		task.start();
+		while(!task.done() && connection.received.empty() && (epoll.dispatch(std::chrono::milliseconds(100)) != 0));
+		shutdown(connection.fds[1], SHUT_RDWR);
+		const bool finished = run(epoll, responseTasks { &task }, true);
+		try {
+			task.result();
+		} catch(const std::runtime_error&) {
+			return finished;
+		}
+		return false;
+	}
+}
+
+int main(int argc, char** argv) {
+	// A server that has gone away shows up as EPIPE, as it does in the agent
+	std::signal(SIGPIPE, SIG_IGN);
+	ssl::library library;
+	return test::suite {
+		{ "request and response", exchangeRequest },
+		{ "large write over a small socket buffer", writeOverSmallBuffer },
+		{ "concurrent streams on one thread", manyConcurrentStreams },
+		{ "connection refused", failToConnect },
+		{ "connection closed before a response", closedBeforeResponse },
+	}.run();
+}
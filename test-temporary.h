@@ -0,0 +1,41 @@
+// Copyright (C) 2015 Philip Cronje. All rights reserved.
+#pragma once
+
+#include <cerrno>
+#include <cstdlib>
+#include <filesystem>
+#include <string>
+#include <system_error>
+
+#include <unistd.h>
+
+namespace test {
+	/* A new directory under /tmp, which is removed along with everything in it afterwards. */
+	struct temporaryDirectory {
+		std::string path;
+
+		explicit temporaryDirectory(const std::string& prefix) : path("/tmp/" + prefix + ".XXXXXX") {
+			if(mkdtemp(path.data()) == nullptr) {
+				throw std::system_error(errno, std::system_category(), "Failed to create " + path);
+			}
+		}
+		temporaryDirectory(const temporaryDirectory&) = delete;
+		~temporaryDirectory() {
+			std::error_code error;
+			std::filesystem::remove_all(path, error);
+		}
+	};
+
+	/* A new, empty file under /tmp, which is removed afterwards. */
+	struct temporaryFile {
+		std::string path;
+
+		explicit temporaryFile(const std::string& prefix) : path("/tmp/" + prefix + ".XXXXXX") {
+			const int fd = mkstemp(path.data());
+			if(fd == -1) throw std::system_error(errno, std::system_category(), "Failed to create " + path);
+			close(fd);
+		}
+		temporaryFile(const temporaryFile&) = delete;
+		~temporaryFile() { unlink(path.c_str()); }
+	};
+}
@@ -0,0 +1,46 @@
+// Copyright (C) 2015 Philip Cronje. All rights reserved.
+#pragma once
+
+#include <openssl/ec.h>
+#include <openssl/evp.h>
+#include <openssl/ssl.h>
+#include <openssl/x509.h>
+
+namespace test {
+	/* A TLS server context with a throwaway self-signed certificate, for serving the blocking end of a socketpair. */
+	class tlsServer {
+		SSL_CTX* context_;
+		EVP_PKEY* key_ = nullptr;
+		X509* certificate_;
+
+		public:
+			tlsServer() : context_(SSL_CTX_new(SSLv23_server_method())), certificate_(X509_new()) {
+				EVP_PKEY_CTX* keyContext = EVP_PKEY_CTX_new_id(EVP_PKEY_EC, nullptr);
+				EVP_PKEY_keygen_init(keyContext);
+				EVP_PKEY_CTX_set_ec_paramgen_curve_nid(keyContext, NID_X9_62_prime256v1);
+				EVP_PKEY_keygen(keyContext, &key_);
+				EVP_PKEY_CTX_free(keyContext);
+
+				ASN1_INTEGER_set(X509_get_serialNumber(certificate_), 1);
+				X509_gmtime_adj(X509_get_notBefore(certificate_), 0);
+				X509_gmtime_adj(X509_get_notAfter(certificate_), 3600);
+				X509_set_pubkey(certificate_, key_);
+				X509_NAME* name = X509_get_subject_name(certificate_);
+				X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC,
+						reinterpret_cast<const unsigned char*>("localhost"), -1, -1, 0);
+				X509_set_issuer_name(certificate_, name);
+				X509_sign(certificate_, key_, EVP_sha256());
+
+				SSL_CTX_use_certificate(context_, certificate_);
+				SSL_CTX_use_PrivateKey(context_, key_);
+			}
+			tlsServer(const tlsServer&) = delete;
+			~tlsServer() {
+				X509_free(certificate_);
+				EVP_PKEY_free(key_);
+				SSL_CTX_free(context_);
+			}
+
+			operator SSL_CTX*() const noexcept { return context_; }
+	};
+}
@@ -0,0 +1,119 @@
+// Copyright (C) 2015 Philip Cronje. All rights reserved.
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <functional>
+#include <stdexcept>
+
+/* Hierarchical timing wheel counting time in ticks. Each level has slotCount slots, and each slot of a level spans a
+ * full revolution of the level below it. A timer is placed on the lowest level whose range covers its expiry and is
+ * moved down a level as the wheel turns towards it, so scheduling, cancelling and expiring a timer are all O(1). */
+class timerWheel {
+	public:
+		class timer {
+			friend class timerWheel;
+
+			std::function<void()> callback_;
+			unsigned long long expiry_ = 0;
+			unsigned long long period_ = 0;
+			timer* next_ = nullptr;
+			// The pointer that points at this timer, or null if it is not scheduled
+			timer** previous_ = nullptr;
+
+			void unlink() noexcept {
+				if(next_ != nullptr) next_->previous_ = previous_;
+				*previous_ = next_;
+				next_ = nullptr;
+				previous_ = nullptr;
+			}
+
+			void link(timer*& head) noexcept {
+				next_ = head;
+				if(next_ != nullptr) next_->previous_ = &next_;
+				previous_ = &head;
+				head = this;
+			}
+
+			public:
+				explicit timer(std::function<void()> callback) : callback_(std::move(callback)) {}
+				timer(const timer&) = delete;
+				~timer() noexcept { if(scheduled()) unlink(); }
+
+				bool scheduled() const noexcept { return previous_ != nullptr; }
+				unsigned long long expiry() const noexcept { return expiry_; }
+		};
+
+	private:
+		constexpr static unsigned int levelBits = 6;
+		constexpr static unsigned int slotCount = 1 << levelBits;
+		constexpr static unsigned int levelCount = 4;
+		constexpr static unsigned long long range = 1ULL << (levelBits * levelCount);
+
+		std::array<timer*, slotCount * levelCount> slots_ {};
+		unsigned long long now_ = 0;
+
+		void insert(timer& timer) noexcept {
+			// Timers beyond the range of the wheel wait in the top level and are re-inserted when it turns
+			const unsigned long long delta = std::min(timer.expiry_ - now_, range - 1);
+			const unsigned long long expiry = now_ + delta;
+			unsigned int level = 0;
+			while((delta >> (levelBits * (level + 1))) != 0) ++level;
+			const unsigned int slot = (expiry >> (levelBits * level)) & (slotCount - 1);
+			timer.link(slots_[level * slotCount + slot]);
+		}
+
+		/* Moves the list of timers in a slot to a local list head. */
+		static void detach(timer*& slot, timer*& head) noexcept {
+			head = slot;
+			slot = nullptr;
+			if(head != nullptr) head->previous_ = &head;
+		}
+
+		void tick() {
+			++now_;
+			// Whenever a level completes a revolution, move the timers of the next slot of the level above down
+			for(unsigned int level = 1; (level < levelCount) && ((now_ & ((1ULL << (levelBits * level)) - 1)) == 0);
+					++level) {
+				timer* cascaded;
+				detach(slots_[level * slotCount + ((now_ >> (levelBits * level)) & (slotCount - 1))], cascaded);
+				while(cascaded != nullptr) {
+					timer& timer = *cascaded;
+					timer.unlink();
+					insert(timer);
+				}
+			}
+
+			timer* expired;
+			detach(slots_[now_ & (slotCount - 1)], expired);
+			while(expired != nullptr) {
+				timer& timer = *expired;
+				timer.unlink();
+				if(timer.period_ != 0) {
+					timer.expiry_ += timer.period_;
+					insert(timer);
+				}
+				timer.callback_();
+			}
+		}
+
+	public:
+		timerWheel() = default;
+		timerWheel(const timerWheel&) = delete;
+
+		unsigned long long now() const noexcept { return now_; }
+
+		/* Schedules the timer to fire after delay ticks, and then every period ticks if period is not zero. */
+		void schedule(timer& timer, const unsigned long long delay, const unsigned long long period = 0) {
+			if(delay == 0) throw std::logic_error("Timers must be scheduled at least one tick ahead");
+			if(timer.scheduled()) timer.unlink();
+			timer.expiry_ = now_ + delay;
+			timer.period_ = period;
+			insert(timer);
+		}
+
+		void cancel(timer& timer) noexcept { if(timer.scheduled()) timer.unlink(); }
+
+		/* Turns the wheel by the given number of ticks, firing every timer that expires on the way. */
+		void advance(unsigned long long ticks) { while(ticks-- != 0) tick(); }
+};
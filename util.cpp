@@ -1,15 +1,54 @@
 // Copyright (C) 2015 Philip Cronje. All rights reserved.
+#include <algorithm>
+#include <cctype>
+
 #include "util.h"
 
+void util::buffer::grow(const size_t headroom, const size_t tailroom) {
+	const size_t front = std::max(headroom, static_cast<size_t>(begin_ - data_.get()));
+	const size_t content = end_ - begin_;
+	const size_t capacity = std::max(2 * capacity_, front + content + tailroom);
+
+	std::unique_ptr<uint8_t[]> data(new uint8_t[capacity]);
+	uint8_t* begin = data.get() + front;
+	if(content != 0) std::memcpy(begin, begin_, content);
+	cursor_ = begin + (cursor_ - begin_);
+	begin_ = begin;
+	end_ = begin + content;
+	data_ = std::move(data);
+	capacity_ = capacity;
+}
+
 std::string util::hexEncode(const uint8_t* data, const size_t size) {
+	std::string result(2 * size, '\0');
+	hexEncode(data, size, &result[0]);
+	return result;
+}
+
+void util::hexEncode(const uint8_t* data, const size_t size, char* output) {
 	constexpr const char* hex = "0123456789abcdef";
-	std::string result;
 	for(unsigned int i = 0; i < size; ++i) {
 		const uint8_t byte = data[i];
 		const uint8_t high = (byte & 0xF0) >> 4;
 		const uint8_t low = byte & 0x0F;
-		result.push_back(hex[high]);
-		result.push_back(hex[low]);
+		*output++ = hex[high];
+		*output++ = hex[low];
+	}
+}
+
+std::string util::urlEncode(const std::string& value) {
+	constexpr const char* hex = "0123456789ABCDEF";
+	std::string result;
+	result.reserve(value.size());
+	for(const char c: value) {
+		if(std::isalnum(static_cast<unsigned char>(c)) || (c == '-') || (c == '_') || (c == '.') || (c == '~')) {
+			result.push_back(c);
+		} else {
+			const uint8_t byte = c;
+			result.push_back('%');
+			result.push_back(hex[(byte & 0xF0) >> 4]);
+			result.push_back(hex[byte & 0x0F]);
+		}
 	}
 	return result;
 }
@@ -1,33 +1,91 @@
 // Copyright (C) 2015 Philip Cronje. All rights reserved.
 #pragma once
 
+#include <cstdint>
+#include <cstring>
 #include <memory>
+#include <stdexcept>
+#include <string>
 
 namespace util {
+	/* Byte buffer with a read cursor. A buffer can also be reused as an arena: clear() rewinds it without releasing
+	 * its storage, append() writes at the end and prepend() fills the headroom reserved in front of the content, so
+	 * once a buffer has grown to fit its largest content it no longer allocates. */
 	class buffer {
 		std::unique_ptr<uint8_t[]> data_;
+		size_t capacity_;
+		uint8_t* begin_;
 		uint8_t* cursor_;
-		int size_;
+		uint8_t* end_;
+
+		void grow(const size_t headroom, const size_t tailroom);
 
 		public:
-			buffer() : data_(nullptr), cursor_(nullptr), size_(0) {}
-			buffer(std::unique_ptr<uint8_t[]>&& data, const int size) : data_(std::move(data)), cursor_(data_.get()), size_(size) {}
+			buffer() : data_(nullptr), capacity_(0), begin_(nullptr), cursor_(nullptr), end_(nullptr) {}
+			buffer(std::unique_ptr<uint8_t[]>&& data, const size_t size) : data_(std::move(data)), capacity_(size),
+					begin_(data_.get()), cursor_(begin_), end_(begin_ + size) {}
 			buffer(util::buffer&& buffer) = default;
 
 			buffer& operator=(buffer&& buffer) = default;
 
-			operator bool() const noexcept { return cursor_ - data_.get() < size_; }
+			operator bool() const noexcept { return cursor_ < end_; }
 			operator void*() const noexcept { return cursor_; }
 
-			size_t size() const noexcept { return size_; }
-			size_t remaining() const noexcept { return size_ - (cursor_ - data_.get()); }
+			const uint8_t* data() const noexcept { return begin_; }
+			size_t size() const noexcept { return end_ - begin_; }
+			size_t remaining() const noexcept { return end_ - cursor_; }
 
 			void advance(const size_t n) {
-				if((cursor_ += n) > data_.get() + size_) {
+				if((cursor_ += n) > end_) {
 					throw std::logic_error("Overflowed buffer");
 				}
 			}
+
+			/* Discards the content, leaving at least headroom bytes free in front of it for prepend(). */
+			void clear(const size_t headroom = 0) {
+				if(capacity_ < headroom) grow(headroom, 0);
+				begin_ = cursor_ = end_ = data_.get() + headroom;
+			}
+
+			void append(const void* data, const size_t size) {
+				if(static_cast<size_t>(data_.get() + capacity_ - end_) < size) grow(0, size);
+				std::memcpy(end_, data, size);
+				end_ += size;
+			}
+			void append(const char* string) { append(string, std::strlen(string)); }
+			void append(const std::string& string) { append(string.data(), string.size()); }
+			void append(const char c) { append(&c, 1); }
+
+			/* Discards the content beyond its first size bytes. */
+			void truncate(const size_t size) {
+				if(size > static_cast<size_t>(end_ - begin_)) throw std::logic_error("Overflowed buffer");
+				end_ = begin_ + size;
+				if(cursor_ > end_) cursor_ = end_;
+			}
+
+			/* Makes room for at least size bytes after the content and returns where they begin, so that they can
+			 * be written in place; extend() then adds those that were written to the content. */
+			uint8_t* reserve(const size_t size) {
+				if(static_cast<size_t>(data_.get() + capacity_ - end_) < size) grow(0, size);
+				return end_;
+			}
+			void extend(const size_t size) {
+				if(static_cast<size_t>(data_.get() + capacity_ - end_) < size) throw std::logic_error("Overflowed buffer");
+				end_ += size;
+			}
+
+			void prepend(const void* data, const size_t size) {
+				if(static_cast<size_t>(begin_ - data_.get()) < size) grow(size, 0);
+				begin_ -= size;
+				cursor_ = begin_;
+				std::memcpy(begin_, data, size);
+			}
 	};
 
 	std::string hexEncode(const uint8_t* data, const size_t size);
+	void hexEncode(const uint8_t* data, const size_t size, char* output);
+
+	/* Percent-encodes everything except the unreserved characters of RFC 3986, as required for form values in AWS
+	 * requests. */
+	std::string urlEncode(const std::string& value);
 }